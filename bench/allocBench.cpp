@@ -0,0 +1,145 @@
+// Counts the heap allocations made while handling each opcode, from recv() into the receive buffer to the flushed
+// replies, and exits with an error if any of them allocates once the server has warmed up. Clients are connected through
+// socket pairs, and each scenario runs long enough beforehand for the send queues, the slab pools and the like to have
+// grown to what it needs. Connecting and disconnecting is measured as well, but isn't checked: a new player's record
+// string is still allocated once per connection
+#include "benchSupport.hpp"
+#include <string.h>
+#include <functional>
+#include <vector>
+
+#define WARMUP_ROUNDS 1000
+#define MEASURED_ROUNDS 10000
+
+static socketServer *server;
+static std::vector<benchClient> clients;
+
+// Sends a message the way a client would and has the server read and handle it
+static void sendToServer(benchClient &client, const char *message){
+	send(client.peer, message, strlen(message) + 1, 0);
+	server->receiveData(client.handle);
+}
+
+// Ends the pass like the event loop would, and throws away what the clients were sent
+static void drainPeers(){
+	server->flushSendQueues();
+	server->handOffRacers();
+	for(unsigned int d = 0; d < clients.size(); d++){
+		drainPeer(clients[d]);
+	}
+}
+
+struct allocResult{
+	const char *name;
+	unsigned long long allocations;
+	bool checked;  // Whether allocating counts as a failure
+};
+
+static std::vector<allocResult> results;
+
+static void measure(const char *name, std::function<void(unsigned int)> round, bool checked = true){
+
+	for(unsigned int d = 0; d < WARMUP_ROUNDS; d++){
+		round(d);
+		drainPeers();
+	}
+
+	unsigned long long startAllocations = allocations;
+	for(unsigned int d = 0; d < MEASURED_ROUNDS; d++){
+		round(d);
+		drainPeers();
+	}
+
+	allocResult result;
+	result.name = name;
+	result.allocations = allocations - startAllocations;
+	result.checked = checked;
+	results.push_back(result);
+
+}
+
+int main(){
+
+	const unsigned int LOBBY_PLAYERS = 100;
+
+	// The server logs chat messages to stdout, so keep the real stdout for the results and send the rest to /dev/null
+	FILE *output = fdopen(dup(fileno(stdout)), "w");
+	if(output == NULL || freopen("/dev/null", "w", stdout) == NULL){
+		perror("Unable to redirect stdout");
+		return 1;
+	}
+
+	server = new socketServer();
+	server->idleTimeout = 0;  // The bench never advances the idle timers, so they would only pile up
+	for(unsigned int d = 0; d < LOBBY_PLAYERS; d++){
+		clients.push_back(addClient(*server));
+		char login[64];
+		snprintf(login, sizeof(login), "nPlayer%u`500`1`1`1`50`50`50", d);
+		sendToServer(clients.back(), login);
+		sendToServer(clients.back(), "o");
+	}
+	drainPeers();
+
+	benchClient &sender = clients[0];
+	measure("a", [&](unsigned int){ sendToServer(sender, "a"); });
+	measure("n", [&](unsigned int){ sendToServer(sender, "nPlayer0`500`1`1`1`50`50`50"); });
+	measure("n (long name)", [&](unsigned int){ sendToServer(sender, "nSomeoneWithAVeryLongName`500`1`1`1`50`50`50"); });
+	measure("o", [&](unsigned int){ sendToServer(sender, "o"); });
+	measure("n o", [&](unsigned int){  // Rebuilds the lobby snapshot every time
+		sendToServer(sender, "nPlayer0`500`1`1`1`50`50`50");
+		sendToServer(sender, "o");
+	});
+	measure("^", [&](unsigned int){ sendToServer(sender, "^Hello everyone!"); });
+	measure("^ (long)", [&](unsigned int){
+		sendToServer(sender, "^A chat message long enough to be sent to everyone from one shared buffer instead of being copied into each "
+							 "player's send queue, which only happens once a message is longer than SHARED_MESSAGE_MIN_LENGTH bytes......");
+	});
+	measure("j", [&](unsigned int d){ sendToServer(sender, d % 2 == 0 ? "j1`1" : "jnone`none"); });
+	measure("j r #s", [&](unsigned int){  // Starts a single player race and leaves it again
+		sendToServer(sender, "j1`1");
+		sendToServer(sender, "r");
+		sendToServer(sender, "#s");
+	});
+	measure("connect n o disconnect", [&](unsigned int){
+		benchClient joining = addClient(*server);
+		sendToServer(joining, "nVisitor`500`1`1`1`50`50`50");
+		sendToServer(joining, "o");
+		server->disconnectSocket(*server->connections.get(joining.handle));
+		closesocket(joining.peer);
+	}, false);
+
+	/* Put four players in a race for the race opcodes */
+	const char *slotMessages[4] = {"j1`1", "j1`2", "j1`3", "j1`4"};
+	for(unsigned int d = 0; d < 4; d++){
+		sendToServer(clients[d], slotMessages[d]);
+	}
+	for(unsigned int d = 0; d < 4; d++){
+		sendToServer(clients[d], "r");
+	}
+	drainPeers();
+	if(server->connections.get(sender.handle)->playerData.roomID == LOBBY_ROOM){
+		fprintf(output, "Failed to start a race.\n");
+		return 1;
+	}
+
+	measure("#q", [&](unsigned int){ sendToServer(sender, "#q120`340`1`0"); });
+	measure("#t", [&](unsigned int){ sendToServer(sender, "#tu`1"); });
+	measure("#k", [&](unsigned int){ sendToServer(sender, "#k3"); });
+	measure("%f", [&](unsigned int){ sendToServer(sender, "%f25.31"); });
+	measure("b", [&](unsigned int){
+		server->currentRaces.at(server->connections.get(sender.handle)->playerData.roomID).playersFinished = 0;  // Keep the rank change small
+		sendToServer(sender, "b");
+	});
+
+	unsigned long long total = 0;
+	for(unsigned int d = 0; d < results.size(); d++){
+		fprintf(output, "%-24s %8.4f allocations per round%s\n", results[d].name, (double)results[d].allocations / MEASURED_ROUNDS, results[d].checked ? "" : " (not checked)");
+		if(results[d].checked){
+			total += results[d].allocations;
+		}
+	}
+	fprintf(output, total == 0 ? "No allocations.\n" : "Some opcodes allocate.\n");
+	fclose(output);
+	return total == 0 ? 0 : 1;
+
+}
@@ -0,0 +1,75 @@
+#ifndef BENCHSUPPORT_H
+#define BENCHSUPPORT_H
+
+// What the benchmarks that check for allocations have in common. Including this replaces the global operator new and
+// delete with ones that count every heap allocation, so it can only be included by one file in each program (each
+// benchmark is a single file). Clients are connected to the server through socket pairs instead of real TCP connections
+#include "../src/socketServer.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+inline unsigned long long allocations = 0;
+
+inline void *countedAllocation(size_t size){
+	allocations++;
+	void *memory = malloc(size == 0 ? 1 : size);
+	if(memory == NULL){
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+// Every form of new and delete is replaced, so nothing allocated by one of them can be freed by the default version
+// of another (which GCC rightly warns about)
+void *operator new(size_t size){
+	return countedAllocation(size);
+}
+
+void *operator new[](size_t size){
+	return countedAllocation(size);
+}
+
+void operator delete(void *memory) noexcept{
+	free(memory);
+}
+
+void operator delete[](void *memory) noexcept{
+	free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept{
+	free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept{
+	free(memory);
+}
+
+struct benchClient{
+	connectionHandle handle;
+	SOCKET peer;  // The "client" end of the socket pair
+};
+
+inline benchClient addClient(socketServer &server){
+
+	benchClient client;
+	SOCKET sockets[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0){
+		perror("socketpair");
+		exit(1);
+	}
+	client.handle = server.addConnection(sockets[0])->handle;
+	client.peer = sockets[1];
+	setNonBlocking(client.peer);
+	return client;
+
+}
+
+// Throws away whatever the server has sent the client
+inline void drainPeer(benchClient &client){
+	static char discard[65536];
+	while(recv(client.peer, discard, sizeof(discard), 0) > 0);
+}
+
+#endif
@@ -0,0 +1,594 @@
+// Load generator that connects thousands of headless bots to a running server and plays the game the way the client
+// does: log in ('n'), join the lobby ('o'), take a race slot and ready up ('j' and 'r'), send race input while racing
+// ('#q' once a second, '#t' several times a second, '#k' now and then), finish ('%f' and 'b') and go back to the lobby.
+// Every bot also sends 'a' once a second. '#t' carries the time it was sent, so the bots receiving the relayed 't' can
+// measure the relay latency. Linux only, as it runs every bot on a single epoll loop.
+//
+// Usage: botSwarm [--host 127.0.0.1] [--port 9104] [--bots 1000] [--seconds 30] [--connect-rate 500] [--race-seconds 20]
+#include "../src/platform.hpp"
+#include "../src/eventPoller.hpp"
+#include "../src/receiveBuffer.hpp"
+#include "../src/sendQueue.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock botClock;
+
+#define NO_GROUP 0xFFFFFFFF
+#define KEY_INPUTS_PER_SECOND 5  // Roughly how often a player presses or releases a key while racing
+#define SLOT_TIMEOUT 10  // Seconds a group waits for its race to start before giving up on it
+
+enum botState{
+	BOT_WAITING,     // Not connected yet
+	BOT_CONNECTING,
+	BOT_LOGGING_IN,  // Waiting for the 'i' reply
+	BOT_IDLE,        // In the lobby, waiting to be put in a race
+	BOT_JOINING,     // Sent 'j', waiting for the race to start
+	BOT_RACING,
+	BOT_FINISHED,    // Sent '%f' and 'b', goes back to the lobby shortly
+	BOT_CLOSED
+};
+
+struct bot{
+
+	SOCKET socket;
+	botState state;
+	unsigned int id;  // Player ID from the server's 'i' reply
+	unsigned int group;
+	unsigned int slot;
+	std::unique_ptr<receiveBuffer> incoming;
+	sendQueue outgoing;
+	botClock::time_point connectStart;
+	botClock::time_point nextKeepalive;
+	botClock::time_point nextPosition;  // '#q'
+	botClock::time_point nextKey;  // '#t'
+	botClock::time_point nextItem;  // '#k'
+	botClock::time_point stateEnd;  // When the bot finishes its race or goes back to the lobby
+
+	bot(){
+		socket = INVALID_SOCKET;
+		state = BOT_WAITING;
+		id = 0;
+		group = NO_GROUP;
+		slot = 0;
+	}
+
+};
+
+// Four idle bots that have been sent to the same map's race slots
+struct raceGroup{
+	unsigned int bots[4];
+	unsigned int raceMap;
+	unsigned int slotsTaken;  // 'j' broadcasts for the group seen by its first bot
+	bool started;
+	botClock::time_point deadline;
+};
+
+struct swarmStats{
+
+	unsigned long long connected;
+	unsigned long long failed;
+	unsigned long long sent;
+	unsigned long long received;
+	unsigned long long racesStarted;
+	unsigned long long racesFinished;
+	std::vector<unsigned int> loginLatencies;  // Microseconds from connect() to 'i'
+	std::vector<unsigned int> relayLatencies;  // Microseconds from sending '#t' to another bot receiving 't'
+
+	swarmStats(){
+		connected = 0;
+		failed = 0;
+		sent = 0;
+		received = 0;
+		racesStarted = 0;
+		racesFinished = 0;
+	}
+
+};
+
+struct botSwarm{
+
+	const char *host;
+	uint16_t port;
+	unsigned int botCount;
+	unsigned int seconds;
+	unsigned int connectRate;
+	unsigned int raceSeconds;
+
+	sockaddr_in serverAddress;
+	eventPoller poller;
+	std::vector<pollerEvent> readySockets;
+	std::vector<bot> bots;
+	std::vector<raceGroup> groups;
+	std::vector<unsigned int> freeGroups;
+	std::vector<unsigned int> idleBots;
+	std::vector<unsigned int> pendingFlushes;
+	unsigned int mapGroups[8];  // Group using each map's slots (NO_GROUP if they're free)
+	botClock::time_point start;
+	unsigned int nextConnect;
+	swarmStats stats;
+	unsigned int randomNumber;
+
+	botSwarm(){
+		host = "127.0.0.1";
+		port = 9104;
+		botCount = 1000;
+		seconds = 30;
+		connectRate = 500;
+		raceSeconds = 20;
+		nextConnect = 0;
+		randomNumber = 12345;
+		for(unsigned int d = 0; d < 8; d++){
+			mapGroups[d] = NO_GROUP;
+		}
+	}
+
+	unsigned int nextRandom(){
+		randomNumber = randomNumber * 1103515245 + 12345;
+		return (randomNumber >> 16) & 0x7FFF;
+	}
+
+	botClock::duration jitter(unsigned int maxMilliseconds){
+		return std::chrono::milliseconds(nextRandom() % (maxMilliseconds + 1));
+	}
+
+	void queue(unsigned int index, const char *message, unsigned int length){
+		bot &sender = bots[index];
+		sender.outgoing.push(message, length + 1);
+		stats.sent++;
+		if(!sender.outgoing.flushScheduled){
+			sender.outgoing.flushScheduled = true;
+			pendingFlushes.push_back(index);
+		}
+	}
+
+	void closeBot(unsigned int index, bool failed){
+		bot &closing = bots[index];
+		if(closing.state == BOT_CLOSED){
+			return;
+		}
+		if(failed){
+			stats.failed++;
+		}
+		poller.removeSocket(closing.socket);
+		closesocket(closing.socket);
+		closing.state = BOT_CLOSED;
+	}
+
+	void connectBot(unsigned int index){
+
+		bot &connecting = bots[index];
+		connecting.socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if(connecting.socket == INVALID_SOCKET || !setNonBlocking(connecting.socket)){
+			printf("Unable to create a socket for bot %u: %s\n", index, strerror(errno));
+			connecting.state = BOT_CLOSED;
+			stats.failed++;
+			return;
+		}
+
+		connecting.connectStart = botClock::now();
+		if(connect(connecting.socket, (sockaddr *)&serverAddress, sizeof(serverAddress)) == SOCKET_ERROR && errno != EINPROGRESS){
+			closeBot(index, true);
+			return;
+		}
+		connecting.state = BOT_CONNECTING;
+		connecting.incoming.reset(new receiveBuffer());
+		if(!poller.addSocket(connecting.socket, index)){
+			closeBot(index, true);
+		}
+
+	}
+
+	void connected(unsigned int index){
+
+		bot &client = bots[index];
+		int socketError = 0;
+		socklen_t errorLength = sizeof(socketError);
+		if(getsockopt(client.socket, SOL_SOCKET, SO_ERROR, &socketError, &errorLength) != 0 || socketError != 0){
+			closeBot(index, true);
+			return;
+		}
+
+		client.state = BOT_LOGGING_IN;
+		char login[64];
+		int length = snprintf(login, sizeof(login), "nBot%u`500`%u`%u`%u`50`50`50", index, 1 + index % 11, 1 + index / 11 % 11, 1 + index / 121 % 11);
+		queue(index, login, length);
+		queue(index, "o", 1);
+
+	}
+
+	void receiveData(unsigned int index){
+
+		while(bots[index].state != BOT_CLOSED){
+
+			bot &receiver = bots[index];
+			unsigned int freeBytes = receiver.incoming->prepareWrite();
+			if(freeBytes == 0){
+				printf("Bot %u was sent a message longer than %u bytes.\n", index, RECEIVE_BUFFER_SIZE);
+				closeBot(index, true);
+				return;
+			}
+
+			int recvBytes = recv(receiver.socket, receiver.incoming->writePointer(), freeBytes, 0);
+			if(recvBytes == -1){
+				if(!socketWouldBlock(errno)){
+					closeBot(index, true);
+				}
+				return;
+			}else if(recvBytes == 0){
+				printf("The server closed bot %u's connection.\n", index);
+				closeBot(index, true);
+				return;
+			}
+			receiver.incoming->commitWrite(recvBytes);
+
+			std::string_view message;
+			while(bots[index].state != BOT_CLOSED && receiver.incoming->nextMessage(message)){
+				stats.received++;
+				handleMessage(index, message);
+			}
+
+		}
+
+	}
+
+	void handleMessage(unsigned int index, std::string_view message){
+
+		bot &receiver = bots[index];
+		botClock::time_point now = botClock::now();
+
+		if(message[0] == 'i' && receiver.state == BOT_LOGGING_IN){  // Logged in
+
+			receiver.id = atoi(message.data() + 1);
+			receiver.state = BOT_IDLE;
+			receiver.nextKeepalive = now + jitter(1000);
+			idleBots.push_back(index);
+			stats.connected++;
+			stats.loginLatencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(now - receiver.connectStart).count());
+
+		}else if(message[0] == 't'){  // Relayed key input from another racer: t<time sent>
+
+			unsigned long long sentAt = strtoull(message.data() + 1, NULL, 10);
+			unsigned long long received = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+			if(received >= sentAt){
+				stats.relayLatencies.push_back(received - sentAt);
+			}
+
+		}else if(message[0] == 'j' && receiver.state == BOT_JOINING && receiver.group != NO_GROUP){  // Someone took a race slot
+
+			raceGroup &group = groups[receiver.group];
+			if(group.bots[0] == index && (unsigned int)atoi(message.data() + 1) == group.raceMap){
+				group.slotsTaken++;
+				if(group.slotsTaken == 4){  // Everyone has a slot, so they can all ready up without the race starting early
+					for(unsigned int d = 0; d < 4; d++){
+						queue(group.bots[d], "r", 1);
+					}
+				}
+			}
+
+		}else if(message[0] == 'm' && receiver.state == BOT_JOINING){  // The race has started
+
+			raceGroup &group = groups[receiver.group];
+			if(!group.started){
+				group.started = true;
+				mapGroups[group.raceMap - 1] = NO_GROUP;  // Starting the race clears its slots
+				stats.racesStarted++;
+			}
+			receiver.state = BOT_RACING;
+			receiver.nextPosition = now + jitter(1000);
+			receiver.nextKey = now + jitter(1000 / KEY_INPUTS_PER_SECOND);
+			receiver.nextItem = now + std::chrono::seconds(2) + jitter(5000);
+			receiver.stateEnd = now + std::chrono::seconds(raceSeconds) + jitter(3000);
+
+		}
+
+	}
+
+	void finishRace(unsigned int index, botClock::time_point now){
+
+		bot &racer = bots[index];
+		char finish[32];
+		int length = snprintf(finish, sizeof(finish), "%%f%u", raceSeconds * 1000 + nextRandom() % 3000);
+		queue(index, finish, length);
+		queue(index, "b", 1);
+		racer.state = BOT_FINISHED;
+		racer.stateEnd = now + std::chrono::seconds(1);
+
+		// The group is done once its last racer has finished
+		raceGroup &group = groups[racer.group];
+		bool everyoneFinished = true;
+		for(unsigned int d = 0; d < 4; d++){
+			if(bots[group.bots[d]].group == racer.group && bots[group.bots[d]].state == BOT_RACING){  // Bots that have gone back to the lobby may already be in another group
+				everyoneFinished = false;
+			}
+		}
+		if(everyoneFinished){
+			stats.racesFinished++;
+		}
+
+	}
+
+	void update(botClock::time_point now){
+
+		/* Connect more bots, no faster than the connect rate */
+		unsigned int connectTarget = std::min<unsigned long long>(botCount, (unsigned long long)(std::chrono::duration<double>(now - start).count() * connectRate) + 1);
+		while(nextConnect < connectTarget){
+			connectBot(nextConnect++);
+		}
+
+		/* Put idle bots in races while there are free maps */
+		for(unsigned int raceMap = 1; raceMap <= 8 && idleBots.size() >= 4; raceMap++){
+
+			if(mapGroups[raceMap - 1] != NO_GROUP){
+				continue;
+			}
+
+			unsigned int groupIndex;
+			if(!freeGroups.empty()){
+				groupIndex = freeGroups.back();
+				freeGroups.pop_back();
+			}else{
+				groupIndex = groups.size();
+				groups.push_back(raceGroup());
+			}
+			raceGroup &group = groups[groupIndex];
+			group.raceMap = raceMap;
+			group.slotsTaken = 0;
+			group.started = false;
+			group.deadline = now + std::chrono::seconds(SLOT_TIMEOUT);
+			mapGroups[raceMap - 1] = groupIndex;
+
+			for(unsigned int d = 0; d < 4; d++){
+				unsigned int index = idleBots.back();
+				idleBots.pop_back();
+				group.bots[d] = index;
+				bots[index].group = groupIndex;
+				bots[index].slot = d + 1;
+				bots[index].state = BOT_JOINING;
+				char join[16];
+				int length = snprintf(join, sizeof(join), "j%u`%u", raceMap, d + 1);
+				queue(index, join, length);
+			}
+
+		}
+
+		/* Give up on groups whose race never started, so their map can be used again */
+		for(unsigned int raceMap = 1; raceMap <= 8; raceMap++){
+			unsigned int groupIndex = mapGroups[raceMap - 1];
+			if(groupIndex != NO_GROUP && now > groups[groupIndex].deadline){
+				printf("The race on map %u didn't start in time, freeing its slots.\n", raceMap);
+				for(unsigned int d = 0; d < 4; d++){
+					unsigned int index = groups[groupIndex].bots[d];
+					if(bots[index].state == BOT_JOINING){
+						queue(index, "jnone`none", 10);
+						bots[index].state = BOT_IDLE;
+						bots[index].group = NO_GROUP;
+						idleBots.push_back(index);
+					}
+				}
+				mapGroups[raceMap - 1] = NO_GROUP;
+				freeGroups.push_back(groupIndex);
+			}
+		}
+
+		/* Send each bot's timed messages */
+		char message[64];
+		for(unsigned int index = 0; index < nextConnect; index++){
+
+			bot &client = bots[index];
+			if(client.state < BOT_IDLE || client.state == BOT_CLOSED){
+				continue;
+			}
+
+			if(now >= client.nextKeepalive){
+				queue(index, "a", 1);
+				client.nextKeepalive += std::chrono::seconds(1);
+			}
+
+			if(client.state == BOT_RACING){
+
+				if(now >= client.nextPosition){
+					int length = snprintf(message, sizeof(message), "#q%u`%u", nextRandom() % 5000, nextRandom() % 2000);
+					queue(index, message, length);
+					client.nextPosition += std::chrono::seconds(1);
+				}
+				if(now >= client.nextKey){
+					int length = snprintf(message, sizeof(message), "#t%llu", (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count());
+					queue(index, message, length);
+					client.nextKey += std::chrono::milliseconds(1000 / KEY_INPUTS_PER_SECOND);
+				}
+				if(now >= client.nextItem){
+					int length = snprintf(message, sizeof(message), "#k%u", 1 + nextRandom() % 8);
+					queue(index, message, length);
+					client.nextItem += std::chrono::seconds(5);
+				}
+				if(now >= client.stateEnd){
+					finishRace(index, now);
+				}
+
+			}else if(client.state == BOT_FINISHED && now >= client.stateEnd){  // Back to the lobby, which also leaves the race
+
+				queue(index, "o", 1);
+				unsigned int groupIndex = client.group;
+				client.state = BOT_IDLE;
+				client.group = NO_GROUP;
+				idleBots.push_back(index);
+
+				bool groupDone = true;
+				for(unsigned int d = 0; d < 4; d++){
+					if(bots[groups[groupIndex].bots[d]].group == groupIndex){
+						groupDone = false;
+					}
+				}
+				if(groupDone){
+					freeGroups.push_back(groupIndex);
+				}
+
+			}
+
+		}
+
+	}
+
+	void flush(){
+		for(unsigned int d = 0; d < pendingFlushes.size(); d++){
+			bot &client = bots[pendingFlushes[d]];
+			client.outgoing.flushScheduled = false;
+			if(client.state != BOT_CLOSED && client.state != BOT_CONNECTING && !client.outgoing.flush(client.socket)){
+				closeBot(pendingFlushes[d], true);
+			}
+		}
+		pendingFlushes.clear();
+	}
+
+	void printProgress(double elapsed, unsigned long long sent, unsigned long long received){
+		unsigned int racing = 0;
+		for(unsigned int d = 0; d < nextConnect; d++){
+			racing += bots[d].state == BOT_RACING;
+		}
+		printf("[%5.1fs] %llu bots logged in, %u racing, %llu sent/s, %llu received/s, %llu races started\n",
+			   elapsed, stats.connected, racing, stats.sent - sent, stats.received - received, stats.racesStarted);
+	}
+
+	bool run(){
+
+		memset(&serverAddress, 0, sizeof(serverAddress));
+		serverAddress.sin_family = AF_INET;
+		serverAddress.sin_port = htons(port);
+		if(inet_pton(AF_INET, host, &serverAddress.sin_addr) != 1){
+			printf("Invalid host: %s\n", host);
+			return false;
+		}
+
+		poller.init(eventPoller::BACKEND_EPOLL);
+		if(!poller.edgeTriggered()){
+			printf("botSwarm needs epoll.\n");
+			return false;
+		}
+
+		bots.resize(botCount);
+		start = botClock::now();
+		botClock::time_point end = start + std::chrono::seconds(seconds);
+		botClock::time_point nextReport = start + std::chrono::seconds(1);
+		unsigned long long reportSent = 0, reportReceived = 0;
+
+		while(botClock::now() < end){
+
+			poller.wait(readySockets, 10);  // Wake up regularly to send the bots' timed messages
+
+			for(unsigned int d = 0; d < readySockets.size(); d++){
+				unsigned int index = readySockets[d].key;
+				if(bots[index].state == BOT_CLOSED){
+					continue;
+				}
+				if(bots[index].state == BOT_CONNECTING){
+					if(readySockets[d].writable){
+						connected(index);
+					}else{
+						continue;
+					}
+				}
+				if(readySockets[d].writable && !bots[index].outgoing.empty() && !bots[index].outgoing.flushScheduled){
+					bots[index].outgoing.flushScheduled = true;
+					pendingFlushes.push_back(index);
+				}
+				if(readySockets[d].readable){
+					receiveData(index);
+				}
+			}
+
+			botClock::time_point now = botClock::now();
+			update(now);
+			flush();
+
+			if(now >= nextReport){
+				printProgress(std::chrono::duration<double>(now - start).count(), reportSent, reportReceived);
+				reportSent = stats.sent;
+				reportReceived = stats.received;
+				nextReport += std::chrono::seconds(1);
+			}
+
+		}
+
+		double elapsed = std::chrono::duration<double>(botClock::now() - start).count();
+		for(unsigned int d = 0; d < nextConnect; d++){
+			closeBot(d, false);
+		}
+		report(elapsed);
+		return true;
+
+	}
+
+	static unsigned int percentile(std::vector<unsigned int> &samples, double fraction){
+		if(samples.empty()){
+			return 0;
+		}
+		return samples[std::min<size_t>(samples.size() - 1, (size_t)(fraction * samples.size()))];
+	}
+
+	static void printLatencies(const char *name, std::vector<unsigned int> &samples){
+		std::sort(samples.begin(), samples.end());
+		printf("%s (%u samples, microseconds): p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n", name, (unsigned int)samples.size(),
+			   percentile(samples, 0.5), percentile(samples, 0.9), percentile(samples, 0.99), percentile(samples, 0.999), samples.empty() ? 0 : samples.back());
+	}
+
+	void report(double elapsed){
+		printf("\n%llu of %u bots logged in (%llu failed) in %.1fs\n", stats.connected, botCount, stats.failed, elapsed);
+		if(!stats.loginLatencies.empty()){
+			printf("Connection rate: %.0f logins/s (limited to %u/s)\n", stats.loginLatencies.size() / std::min(elapsed, (double)botCount / connectRate), connectRate);
+		}
+		printf("Messages: %llu sent (%.0f/s), %llu received (%.0f/s)\n", stats.sent, stats.sent / elapsed, stats.received, stats.received / elapsed);
+		printf("Races: %llu started, %llu finished\n", stats.racesStarted, stats.racesFinished);
+		printLatencies("Login latency", stats.loginLatencies);
+		printLatencies("Relay latency", stats.relayLatencies);
+	}
+
+};
+
+static void raiseDescriptorLimit(unsigned int needed){
+	rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < needed){
+		limit.rlim_cur = std::min<rlim_t>(needed, limit.rlim_max);
+		setrlimit(RLIMIT_NOFILE, &limit);
+		if(limit.rlim_cur < needed){
+			printf("Only %u descriptors are available, so some bots won't be able to connect.\n", (unsigned int)limit.rlim_cur);
+		}
+	}
+}
+
+int main(int argc, char *argv[]){
+
+	botSwarm swarm;
+	for(int d = 1; d + 1 < argc; d += 2){
+		if(strcmp(argv[d], "--host") == 0){
+			swarm.host = argv[d + 1];
+		}else if(strcmp(argv[d], "--port") == 0){
+			swarm.port = atoi(argv[d + 1]);
+		}else if(strcmp(argv[d], "--bots") == 0){
+			swarm.botCount = atoi(argv[d + 1]);
+		}else if(strcmp(argv[d], "--seconds") == 0){
+			swarm.seconds = atoi(argv[d + 1]);
+		}else if(strcmp(argv[d], "--connect-rate") == 0){
+			swarm.connectRate = std::max(1, atoi(argv[d + 1]));
+		}else if(strcmp(argv[d], "--race-seconds") == 0){
+			swarm.raceSeconds = atoi(argv[d + 1]);
+		}else{
+			printf("Unknown option %s\n", argv[d]);
+			return 1;
+		}
+	}
+
+	socketStartup();
+	raiseDescriptorLimit(swarm.botCount + 64);
+	printf("Connecting %u bots to %s:%u at %u/s for %us, races last %us.\n", swarm.botCount, swarm.host, swarm.port, swarm.connectRate, swarm.seconds, swarm.raceSeconds);
+	return swarm.run() ? 0 : 1;
+
+}
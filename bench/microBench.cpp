@@ -0,0 +1,250 @@
+// Microbenchmarks for the server's core routines: parsing player data, rank calculation, race slots, handleBuffer for
+// each opcode and the lobby broadcasts at 10 to 10000 players. Players aren't connected to anything; queued messages
+// go to a sink that just empties the send queues, so only the server's own work is measured.
+// Results are written to stdout as JSON (progress goes to stderr), so runs can be compared between releases:
+//
+//	./microBench > results.json
+#include "../src/socketServer.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define MIN_SECONDS 0.2  // Each benchmark runs for at least this long
+
+struct benchResult{
+	std::string name;
+	unsigned int players;  // 0 if it doesn't depend on a player count
+	unsigned long long iterations;
+	double nanoseconds;  // Per iteration
+	unsigned long long bytesQueued;  // Per iteration, for the ones that send anything
+};
+
+static std::vector<benchResult> results;
+static unsigned long long sunkBytes = 0;
+
+// Empties every queue the server would have flushed, as if the clients had received everything
+static void sinkQueues(socketServer &server){
+	for(unsigned int d = 0; d < server.pendingSends.size(); d++){
+		connection *recipient = server.connections.get(server.pendingSends[d]);
+		if(recipient != NULL){
+			sunkBytes += recipient->outgoing.queuedBytes;
+			recipient->outgoing.clear();
+			recipient->outgoing.flushScheduled = false;
+		}
+	}
+	server.pendingSends.clear();
+}
+
+// Runs the benchmark with more and more iterations until it takes at least MIN_SECONDS
+template<typename benchFunction>
+static void measure(const char *name, unsigned int players, socketServer *server, benchFunction run){
+
+	unsigned long long iterations = 1;
+	while(true){
+
+		unsigned long long startBytes = sunkBytes;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(unsigned long long d = 0; d < iterations; d++){
+			run(d);
+			if(server != NULL){
+				sinkQueues(*server);
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if(seconds >= MIN_SECONDS || iterations >= (1ULL << 32)){
+			benchResult result;
+			result.name = name;
+			result.players = players;
+			result.iterations = iterations;
+			result.nanoseconds = seconds * 1e9 / iterations;
+			result.bytesQueued = (sunkBytes - startBytes) / iterations;
+			results.push_back(result);
+			fprintf(stderr, "%-24s %6u players %12.1f ns/op\n", name, players, result.nanoseconds);
+			return;
+		}
+		iterations = seconds < MIN_SECONDS / 100 ? iterations * 10 : iterations * 2;
+
+	}
+
+}
+
+static connection &addPlayer(socketServer &server, unsigned int number){
+
+	connectionHandle handle = server.connections.insert(connection());
+	connection &newPlayer = *server.connections.get(handle);
+	newPlayer.handle = handle;
+	newPlayer.id = handle.index + 1;
+
+	char login[64];
+	snprintf(login, sizeof(login), "nPlayer%u`500`1`1`1`50`50`50", number);
+	server.handleBuffer(newPlayer, login);
+	return *server.connections.get(handle);
+
+}
+
+static void send(socketServer &server, connectionHandle sender, const char *message){
+	server.handleBuffer(*server.connections.get(sender), message);
+}
+
+static void benchRoutines(){
+
+	player parsed;
+	measure("infoIsValid", 0, NULL, [&](unsigned long long){
+		parsed.infoIsValid("nJiggmin`12.5`3`7`2`50`50`50");
+	});
+
+	raceInstance race;
+	race.totalPlayers = 4;
+	measure("calculateRank", 0, NULL, [&](unsigned long long d){
+		race.playersFinished = d % 4;
+		race.calculateRank(1, 1 + d % 8);
+	});
+
+	lobbySlotHandler slots;
+	measure("raceReady", 0, NULL, [&](unsigned long long d){
+		for(unsigned int slot = 0; slot < 4; slot++){
+			slots.playerIDs[slot] = slot + 1;
+			slots.playerStates[slot] = slot == d % 4 ? 1 : 2;
+		}
+		slots.raceReady();
+	});
+
+	measure("generateRace", 0, NULL, [&](unsigned long long){
+		for(unsigned int slot = 0; slot < 4; slot++){
+			slots.playerIDs[slot] = slot + 1;
+			slots.playerStates[slot] = 2;
+		}
+		slots.generateRace();
+	});
+
+}
+
+static void benchOpcodes(){
+
+	const unsigned int LOBBY_PLAYERS = 100;
+
+	socketServer server;
+	std::vector<connectionHandle> players;
+	for(unsigned int d = 0; d < LOBBY_PLAYERS; d++){
+		players.push_back(addPlayer(server, d).handle);
+	}
+	sinkQueues(server);
+
+	connectionHandle sender = players[0];
+	measure("handleBuffer a", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "a");
+	});
+	measure("handleBuffer n", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "nPlayer0`500`1`1`1`50`50`50");
+	});
+	measure("handleBuffer o", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "o");
+	});
+	measure("handleBuffer ^", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "^Hello everyone!");
+	});
+	measure("handleBuffer j", LOBBY_PLAYERS, &server, [&](unsigned long long d){
+		send(server, sender, d % 2 == 0 ? "j1`1" : "jnone`none");  // Take a slot, then leave it again
+	});
+
+	// Starting a race needs 'j' and 'r', and the race is left with '#s' so the next iteration can start it again
+	measure("handleBuffer j r #s", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "j1`1");
+		send(server, sender, "r");
+		send(server, sender, "#s");
+	});
+
+	/* Put four players in a race for the race opcodes */
+	const char *slotMessages[4] = {"j1`1", "j1`2", "j1`3", "j1`4"};
+	for(unsigned int d = 0; d < 4; d++){
+		send(server, players[d], slotMessages[d]);
+	}
+	for(unsigned int d = 0; d < 4; d++){
+		send(server, players[d], "r");
+	}
+	sinkQueues(server);
+	if(server.connections.get(sender)->playerData.roomID == LOBBY_ROOM){
+		fprintf(stderr, "Failed to start a race, skipping the race opcodes.\n");
+		return;
+	}
+
+	measure("handleBuffer #q", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "#q120`340`1`0");
+	});
+	measure("handleBuffer #t", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "#tu`1");
+	});
+	measure("handleBuffer #k", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "#k3");
+	});
+	measure("handleBuffer %f", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		send(server, sender, "%f25.31");
+	});
+	measure("handleBuffer b", LOBBY_PLAYERS, &server, [&](unsigned long long){
+		server.currentRaces.at(server.connections.get(sender)->playerData.roomID).playersFinished = 0;  // Keep the rank change small
+		send(server, sender, "b");
+	});
+
+}
+
+static void benchBroadcasts(){
+
+	const unsigned int playerCounts[4] = {10, 100, 1000, 10000};
+
+	for(unsigned int count = 0; count < 4; count++){
+
+		unsigned int players = playerCounts[count];
+		socketServer server;
+		std::vector<connectionHandle> handles;
+		for(unsigned int d = 0; d < players; d++){
+			handles.push_back(addPlayer(server, d).handle);
+			if(d % 256 == 255){
+				sinkQueues(server);
+			}
+		}
+		sinkQueues(server);
+
+		const std::string &record = server.connections.get(handles[0])->playerData.record;
+		measure("queueRoomMessage lobby", players, &server, [&](unsigned long long){
+			server.queueRoomMessage(LOBBY_ROOM, sharedMessageRef::copy(record));
+		});
+		measure("lobby join o", players, &server, [&](unsigned long long d){
+			send(server, handles[d % players], "o");
+		});
+		measure("lobby chat ^", players, &server, [&](unsigned long long d){
+			send(server, handles[d % players], "^Hello everyone!");
+		});
+		measure("player update n", players, &server, [&](unsigned long long){
+			send(server, handles[0], "nPlayer0`500`1`1`1`50`50`50");
+		});
+
+	}
+
+}
+
+int main(){
+
+	// The server logs chat messages to stdout, so keep the real stdout for the results and send the rest to /dev/null
+	FILE *output = fdopen(dup(fileno(stdout)), "w");
+	if(output == NULL || freopen("/dev/null", "w", stdout) == NULL){
+		perror("Unable to redirect stdout");
+		return 1;
+	}
+
+	benchRoutines();
+	benchOpcodes();
+	benchBroadcasts();
+
+	fprintf(output, "{\n\t\"benchmarks\": [\n");
+	for(unsigned int d = 0; d < results.size(); d++){
+		fprintf(output, "\t\t{\"name\": \"%s\", \"players\": %u, \"iterations\": %llu, \"ns_per_op\": %.2f, \"bytes_per_op\": %llu}%s\n",
+			   results[d].name.c_str(), results[d].players, results[d].iterations, results[d].nanoseconds, results[d].bytesQueued, d + 1 < results.size() ? "," : "");
+	}
+	fprintf(output, "\t]\n}\n");
+	fclose(output);
+	return 0;
+
+}
@@ -0,0 +1,174 @@
+// Measures player::infoIsValid(), which parses every 'n' message, and checks it gives the same results as the
+// istringstream-based parser it replaced for a mix of real and mangled player data. Also checks parsing doesn't allocate
+#include "benchSupport.hpp"
+#include <string.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The parser as it was before it was rewritten with from_chars
+static bool legacyInfoIsValid(player &parsed, const char buffer[2048]){
+
+	std::string playerInfo = buffer;
+	unsigned int lastGrave;
+	unsigned int grave = playerInfo.length();
+	for(unsigned int d = 0; d <= 7; d++){
+		lastGrave = grave - 1;
+		grave = playerInfo.rfind("`", lastGrave - 1);
+		switch(d){
+			case(0):
+				std::istringstream(playerInfo.substr(grave + 1)) >> parsed.tractionPoints;
+			break;
+			case(1):
+				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> parsed.jumpPoints;
+			break;
+			case(2):
+				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> parsed.speedPoints;
+			break;
+			case(3):
+				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> parsed.footNum;
+			break;
+			case(4):
+				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> parsed.bodyNum;
+			break;
+			case(5):
+				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> parsed.headNum;
+			break;
+			case(6):
+				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> parsed.rank;
+				parsed.user = playerInfo.substr(1, grave - 1);
+			break;
+		}
+	}
+
+	const std::string &user = parsed.user;
+	return user.length() > 0 && user.find("<") == std::string::npos && user.find("&#0;") == std::string::npos && user.find("`") == std::string::npos &&
+		   parsed.headNum >= 1 && parsed.headNum <= 11 && parsed.bodyNum >= 1 && parsed.bodyNum <= 11 && parsed.footNum >= 1 && parsed.footNum <= 11 &&
+		   parsed.speedPoints + parsed.jumpPoints + parsed.tractionPoints <= 150 && parsed.speedPoints <= 100 && parsed.jumpPoints <= 100 && parsed.tractionPoints <= 100;
+
+}
+
+static unsigned int randomNumber = 12345;
+static unsigned int nextRandom(){
+	randomNumber = randomNumber * 1103515245 + 12345;
+	return (randomNumber >> 16) & 0x7FFF;
+}
+
+static std::vector<std::string> buildCorpus(){
+
+	std::vector<std::string> corpus;
+	const char *names[] = {"Jiggmin", "bls1999", "a", "Grave`Name", "<b>bold</b>", "&#0;", "a very long username indeed", " spaced "};
+	const char *ranks[] = {"0", "12", "3.5", "-1", "1e3", "1e", "1e99", "1e-99", "+4", " 7", "inf", "nan", ".5", "5.", ".", "abc", "0x10"};
+	const char *numbers[] = {"1", "11", "12", "0", "50", "100", "101", "-0", "-5", "+3", " 4", "4 ", "4x", "x", "99999999999", "4294967296", "08"};
+
+	for(unsigned int d = 0; d < 20000; d++){
+		std::string info = "n";
+		info += names[nextRandom() % 8];
+		info += "`";
+		info += ranks[nextRandom() % 17];
+		for(unsigned int field = 0; field < 6; field++){
+			info += "`";
+			info += numbers[nextRandom() % 17];
+		}
+		corpus.push_back(info);
+	}
+
+	// Mangle some copies: drop, duplicate or swap characters, which moves the graves around
+	const unsigned int cleanSize = corpus.size();
+	for(unsigned int d = 0; d < cleanSize; d++){
+		std::string mangled = corpus[d];
+		unsigned int position = 1 + nextRandom() % (mangled.length() - 1);
+		switch(nextRandom() % 4){
+			case 0:
+				mangled.erase(position, 1);
+			break;
+			case 1:
+				mangled.insert(position, 1, '`');
+			break;
+			case 2:
+				mangled.insert(position, 1, mangled[position]);
+			break;
+			case 3:
+				mangled[position] = "`0 -"[nextRandom() % 4];
+			break;
+		}
+		corpus.push_back(mangled);
+	}
+
+	// A few that are mostly graves or too short
+	const char *oddities[] = {"n", "n`", "n``", "n```````", "n````````", "nname", "nname`1`1`1`1`1`1", "n`1`1`1`1`1`1`1", "nname``1`1`1`1`1`1", "nname`1`1`1`1`1`1`1`"};
+	for(unsigned int d = 0; d < sizeof(oddities) / sizeof(oddities[0]); d++){
+		corpus.push_back(oddities[d]);
+	}
+	return corpus;
+
+}
+
+static bool sameResult(bool validA, const player &a, bool validB, const player &b){
+	if(validA != validB){
+		return false;
+	}
+	if(!validA){  // Nothing else is used when the data isn't valid
+		return true;
+	}
+	return a.user == b.user && (a.rank == b.rank || (a.rank != a.rank && b.rank != b.rank)) && a.headNum == b.headNum && a.bodyNum == b.bodyNum &&
+		   a.footNum == b.footNum && a.speedPoints == b.speedPoints && a.jumpPoints == b.jumpPoints && a.tractionPoints == b.tractionPoints;
+}
+
+int main(){
+
+	const unsigned int ROUNDS = 20;
+
+	std::vector<std::string> corpus = buildCorpus();
+
+	/* Differential check against the old parser */
+	unsigned int mismatches = 0;
+	unsigned int valid = 0;
+	for(unsigned int d = 0; d < corpus.size(); d++){
+		player legacy, current;
+		bool legacyValid = legacyInfoIsValid(legacy, corpus[d].c_str());
+		bool currentValid = current.infoIsValid(corpus[d]);
+		valid += currentValid;
+		if(!sameResult(legacyValid, legacy, currentValid, current)){
+			if(mismatches < 10){
+				printf("Mismatch for \"%s\": old %s (%s %g %u %u %u %u %u %u), new %s (%s %g %u %u %u %u %u %u)\n", corpus[d].c_str(),
+					   legacyValid ? "valid" : "invalid", legacy.user.c_str(), legacy.rank, legacy.headNum, legacy.bodyNum, legacy.footNum, legacy.speedPoints, legacy.jumpPoints, legacy.tractionPoints,
+					   currentValid ? "valid" : "invalid", current.user.c_str(), current.rank, current.headNum, current.bodyNum, current.footNum, current.speedPoints, current.jumpPoints, current.tractionPoints);
+			}
+			mismatches++;
+		}
+	}
+	printf("Compared %u messages (%u valid) with the old parser: %u mismatches\n", (unsigned int)corpus.size(), valid, mismatches);
+
+	/* Throughput of both parsers */
+	player legacyParsed, parsed;
+	parsed.user.reserve(64);  // Like a player object that's reused, so assigning the username doesn't allocate
+	unsigned int checksum = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(unsigned int round = 0; round < ROUNDS; round++){
+		for(unsigned int d = 0; d < corpus.size(); d++){
+			checksum += legacyInfoIsValid(legacyParsed, corpus[d].c_str());
+		}
+	}
+	double legacySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned long long startAllocations = allocations;
+	start = std::chrono::steady_clock::now();
+	for(unsigned int round = 0; round < ROUNDS; round++){
+		for(unsigned int d = 0; d < corpus.size(); d++){
+			checksum += parsed.infoIsValid(corpus[d]);
+		}
+	}
+	double currentSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	unsigned long long parseAllocations = allocations - startAllocations;
+
+	unsigned int parses = ROUNDS * corpus.size();
+	printf("Old parser: %.0f messages/s (%.1f ns/message)\n", parses / legacySeconds, legacySeconds * 1e9 / parses);
+	printf("New parser: %.0f messages/s (%.1f ns/message), %.1fx faster\n", parses / currentSeconds, currentSeconds * 1e9 / parses, legacySeconds / currentSeconds);
+	printf("Allocations: %llu (%.4f per message, checksum %u)\n", parseAllocations, (double)parseAllocations / parses, checksum);
+
+	return mismatches == 0 && parseAllocations == 0 ? 0 : 1;
+
+}
@@ -0,0 +1,75 @@
+// Measures the race relay path ('#q', '#t' and '#k') through socketServer::handleBuffer and checks that
+// relaying a message doesn't allocate. Racers are connected through socket pairs instead of real TCP connections
+#include "benchSupport.hpp"
+#include <chrono>
+
+static void sendToServer(socketServer &server, benchClient &client, std::string_view message){
+	server.handleBuffer(*server.connections.get(client.handle), message);
+}
+
+static void drainPeers(benchClient *clients, unsigned int clientCount){
+	for(unsigned int d = 0; d < clientCount; d++){
+		drainPeer(clients[d]);
+	}
+}
+
+int main(){
+
+	const unsigned int RACERS = 4;
+	const unsigned int MESSAGES = 1000000;
+	const unsigned int FLUSH_EVERY = 16;  // Roughly how many messages one pass of the event loop handles under load
+
+	socketServer server;
+	benchClient clients[RACERS];
+
+	/* Log everyone in and start a race on Newbieland */
+	const char *logins[RACERS] = {"nRacer1`0`1`1`1`50`50`50", "nRacer2`0`1`1`1`50`50`50", "nRacer3`0`1`1`1`50`50`50", "nRacer4`0`1`1`1`50`50`50"};
+	const char *slots[RACERS] = {"j1`1", "j1`2", "j1`3", "j1`4"};
+	for(unsigned int d = 0; d < RACERS; d++){
+		clients[d] = addClient(server);
+		sendToServer(server, clients[d], logins[d]);
+		sendToServer(server, clients[d], "o");
+		sendToServer(server, clients[d], slots[d]);
+	}
+	for(unsigned int d = 0; d < RACERS; d++){
+		sendToServer(server, clients[d], "r");
+	}
+	if(server.rooms.members(1).size() != RACERS){
+		printf("Failed to start the race.\n");
+		return 1;
+	}
+	server.flushSendQueues();
+	drainPeers(clients, RACERS);
+
+	const char *raceMessages[3] = {"#q120`340`1`0", "#tu`1", "#k3"};
+
+	/* Warm up so the send queues and pendingSends have reached their steady-state capacity */
+	for(unsigned int d = 0; d < 10000; d++){
+		sendToServer(server, clients[d % RACERS], raceMessages[d % 3]);
+		if(d % FLUSH_EVERY == FLUSH_EVERY - 1){
+			server.flushSendQueues();
+			drainPeers(clients, RACERS);
+		}
+	}
+
+	unsigned long long startAllocations = allocations;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for(unsigned int d = 0; d < MESSAGES; d++){
+		sendToServer(server, clients[d % RACERS], raceMessages[d % 3]);
+		if(d % FLUSH_EVERY == FLUSH_EVERY - 1){
+			server.flushSendQueues();
+			drainPeers(clients, RACERS);
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	unsigned long long relayAllocations = allocations - startAllocations;
+
+	printf("Relayed %u messages to %u racers in %.3fs (%.0f messages/s, %.1f ns/message)\n",
+		   MESSAGES, RACERS - 1, seconds, MESSAGES / seconds, seconds * 1e9 / MESSAGES);
+	printf("Allocations: %llu (%.4f per message)\n", relayAllocations, (double)relayAllocations / MESSAGES);
+
+	return relayAllocations == 0 ? 0 : 1;
+
+}
@@ -0,0 +1,138 @@
+#include "admissionFilter.hpp"
+#include "platform.hpp"
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+
+#define MAX_RECENT_ADDRESSES 4096  // Once this many addresses are being counted, ones from earlier seconds are forgotten
+
+prefixNode::prefixNode(){
+	children[0] = 0;
+	children[1] = 0;
+	listed = false;
+}
+
+admissionFilter::admissionFilter(){
+	whitelist = false;
+	connectionRate = 0;
+	ranges.resize(1);
+}
+
+bool admissionFilter::load(const std::string &path){
+
+	std::ifstream xlist(path.c_str());
+	if(!xlist.is_open()){
+		return false;
+	}
+
+	std::string line;
+	unsigned int lineNumber = 0;
+	while(getline(xlist, line)){
+
+		lineNumber++;
+		std::string::size_type commentPos = line.find("//");
+		if(commentPos != std::string::npos){
+			line.erase(commentPos);
+		}
+
+		std::string entry;
+		std::istringstream(line) >> entry;  // Drops surrounding whitespace
+		if(!entry.empty() && !add(entry)){
+			printf("Unable to read line %u of the xlist: %s\n", lineNumber, entry.c_str());
+		}
+
+	}
+	return true;
+
+}
+
+bool admissionFilter::add(const std::string &entry){
+
+	std::string::size_type slash = entry.find('/');
+	unsigned int prefixLength = 32;
+	if(slash != std::string::npos){
+		std::istringstream lengthStream(entry.substr(slash + 1));
+		if(!(lengthStream >> prefixLength) || prefixLength > 32){
+			return false;
+		}
+	}
+
+	in_addr parsed;
+	if(inet_pton(AF_INET, entry.substr(0, slash).c_str(), (char*)&parsed) != 1){
+		return false;
+	}
+	uint32_t address = ntohl(parsed.s_addr);
+
+	if(prefixLength == 32){  // Single addresses only need the hash set
+		addresses.insert(address);
+		return true;
+	}
+
+	uint32_t node = 0;
+	for(unsigned int d = 0; d < prefixLength; d++){
+		unsigned int bit = (address >> (31 - d)) & 1;
+		if(ranges[node].children[bit] == 0){
+			ranges[node].children[bit] = ranges.size();
+			ranges.push_back(prefixNode());  // May move the nodes, so the index is looked up again next time round
+		}
+		node = ranges[node].children[bit];
+	}
+	ranges[node].listed = true;
+	return true;
+
+}
+
+unsigned int admissionFilter::size() const{
+	unsigned int rangeCount = 0;
+	for(unsigned int d = 0; d < ranges.size(); d++){
+		rangeCount += ranges[d].listed;
+	}
+	return addresses.size() + rangeCount;
+}
+
+bool admissionFilter::listed(uint32_t address) const{
+
+	if(!addresses.empty() && addresses.count(address) != 0){
+		return true;
+	}
+
+	// Follow the address down the trie until a range covers it or there's nowhere left to go
+	uint32_t node = 0;
+	for(unsigned int d = 0; d < 32; d++){
+		if(ranges[node].listed){
+			return true;
+		}
+		node = ranges[node].children[(address >> (31 - d)) & 1];
+		if(node == 0){
+			return false;
+		}
+	}
+	return ranges[node].listed;
+
+}
+
+bool admissionFilter::rateLimited(uint32_t address, uint64_t second){
+
+	if(connectionRate == 0){
+		return false;
+	}
+
+	if(recent.size() >= MAX_RECENT_ADDRESSES){
+		for(std::unordered_map<uint32_t, recentConnections>::iterator entry = recent.begin(); entry != recent.end();){
+			if(entry->second.second != second){
+				entry = recent.erase(entry);
+			}else{
+				++entry;
+			}
+		}
+	}
+
+	recentConnections &connections = recent[address];
+	if(connections.second != second){
+		connections.second = second;
+		connections.count = 0;
+	}
+	connections.count++;
+	return connections.count > connectionRate;
+
+}
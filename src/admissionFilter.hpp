@@ -0,0 +1,45 @@
+#ifndef ADMISSIONFILTER_H
+#define ADMISSIONFILTER_H
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// A node in the admissionFilter's range trie, one level per bit of the address
+struct prefixNode{
+	uint32_t children[2];  // Index of the node for the next bit being 0 or 1 (0 if there isn't one, as nothing points back to the root)
+	bool listed;  // A range ends here, so every address below it is listed
+	prefixNode();
+};
+
+// Connections from the last second for one address
+struct recentConnections{
+	uint64_t second;
+	unsigned int count;
+};
+
+// Decides whether to keep an accepted connection, before anything is set up for it. Addresses from xlist.txt are kept in
+// a hash set, and ranges (CIDR) in a binary trie, so checking an address costs at most one hash lookup and 32 steps
+// down the trie. Addresses are IPv4 in host byte order
+struct admissionFilter{
+
+	bool whitelist;  // Whether xlist.txt lists the only addresses allowed (xlist = 1) or the ones blocked (xlist = 0)
+	unsigned int connectionRate;  // Most connections an address can make in a second (0 for no limit)
+	std::unordered_set<uint32_t> addresses;
+	std::vector<prefixNode> ranges;  // ranges[0] is the root
+	std::unordered_map<uint32_t, recentConnections> recent;
+
+	admissionFilter();
+
+	bool load(const std::string &path);  // One address or range per line, "//" starts a comment
+	bool add(const std::string &entry);  // "1.2.3.4" or "1.2.0.0/16", returns false if it isn't either
+	unsigned int size() const;
+	bool listed(uint32_t address) const;
+	bool admits(uint32_t address) const{ return listed(address) == whitelist; }
+	bool rateLimited(uint32_t address, uint64_t second);  // Counts the connection, returns true if there have been too many this second
+
+};
+
+#endif
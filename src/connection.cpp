@@ -0,0 +1,11 @@
+#include "connection.hpp"
+
+connection::connection(){
+	socket = INVALID_SOCKET;
+	handle.index = 0;
+	handle.generation = 0;
+	id = 0;
+	registered = false;
+	worker = 0;
+	lastActive = 0;
+}
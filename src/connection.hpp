@@ -0,0 +1,29 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "platform.hpp"
+#include "slotMap.hpp"
+#include "player.hpp"
+#include "receiveBuffer.hpp"
+#include "sendQueue.hpp"
+
+typedef slotHandle connectionHandle;
+
+// Everything the server keeps for a single connected client
+struct connection{
+
+	SOCKET socket;
+	connectionHandle handle;
+	unsigned int id;  // ID other clients know the player by (the connection's slot + 1, so 0 can mean "no player")
+	bool registered;  // Whether the client has sent valid player data yet
+	unsigned int worker;  // Race worker that currently owns the socket and buffers (0 if it's this thread)
+	uint64_t lastActive;  // Idle timer tick the client last sent anything on
+	player playerData;
+	receiveBuffer incoming;  // Received data, split into messages
+	sendQueue outgoing;  // Messages waiting to be sent
+
+	connection();
+
+};
+
+#endif
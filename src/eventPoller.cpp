@@ -0,0 +1,540 @@
+#include "eventPoller.hpp"
+#include <stdio.h>
+
+#ifdef POLLER_HAS_EPOLL
+	#include <unistd.h>
+	#include <errno.h>
+#endif
+
+#ifdef POLLER_HAS_URING
+	#include <errno.h>
+	#include <limits.h>
+	#include <poll.h>
+	#include <thread>
+
+	#define URING_ENTRIES 1024  // Submission queue size, the completion queue is bigger (see uringQueue::init())
+	#define URING_RECEIVE_BUFFERS 1024  // Shared by every stream, once they're all waiting to be copied out receives fall back to recv()
+	#define URING_RECEIVE_BUFFER_SIZE 4096
+
+	// What a submission was for, kept in the top byte of its user data. The generation and descriptor make up the rest
+	enum uringOperation{
+		URING_RECEIVE = 1,  // Multishot receive (addStream())
+		URING_POLL,         // Multishot poll for readability (addSocket())
+		URING_ACCEPT,       // Multishot accept (addListener())
+		URING_WRITABLE,     // One-shot poll for writability (setWriteInterest())
+		URING_SEND,         // queueSend(), the descriptor is replaced by the send's index
+		URING_CANCEL        // removeSocket()
+	};
+
+	#define URING_SEND_PENDING INT_MIN  // Result of a send that hasn't completed yet
+
+	static uint64_t uringTag(unsigned int operation, uint32_t generation, uint32_t descriptor){
+		return ((uint64_t)operation << 56) | ((uint64_t)(generation & 0xFFFFFF) << 32) | descriptor;
+	}
+#endif
+
+eventPoller::eventPoller(){
+	backend = BACKEND_SELECT;
+	FD_ZERO(&socketSet);
+	FD_ZERO(&writeSet);
+	#ifdef POLLER_HAS_EPOLL
+		epollFD = -1;
+	#endif
+	#ifdef POLLER_HAS_URING
+		sendsInFlight = 0;
+	#endif
+}
+
+eventPoller::~eventPoller(){
+	#ifdef POLLER_HAS_EPOLL
+		if(epollFD != -1){
+			close(epollFD);
+		}
+	#endif
+}
+
+bool eventPoller::init(backendType preferredBackend){
+
+	backend = BACKEND_SELECT;
+
+	#ifdef POLLER_HAS_URING
+		if(preferredBackend == BACKEND_URING){
+			if(ring.init(URING_ENTRIES, URING_RECEIVE_BUFFERS, URING_RECEIVE_BUFFER_SIZE) && ring.multishotReceiveWorks()){
+				backend = BACKEND_URING;
+				return true;
+			}
+			ring.shutdown();
+			printf("io_uring can't be used here (Linux 6.0 or newer is needed), falling back to epoll.\n");
+			preferredBackend = BACKEND_EPOLL;
+		}
+	#else
+		if(preferredBackend == BACKEND_URING){
+			printf("io_uring is not available on this platform, falling back to epoll.\n");
+			preferredBackend = BACKEND_EPOLL;
+		}
+	#endif
+
+	#ifdef POLLER_HAS_EPOLL
+		if(preferredBackend == BACKEND_EPOLL){
+			epollFD = epoll_create1(EPOLL_CLOEXEC);
+			if(epollFD != -1){
+				backend = BACKEND_EPOLL;
+				readyEvents.resize(256);  // Grows if every slot is used in a single wakeup
+			}else{
+				printf("epoll_create1() has failed (%i), falling back to select().\n", errno);
+			}
+		}
+	#else
+		if(preferredBackend == BACKEND_EPOLL){
+			printf("epoll is not available on this platform, falling back to select().\n");
+		}
+	#endif
+
+	return true;
+
+}
+
+bool eventPoller::edgeTriggered() const{
+	return backend == BACKEND_EPOLL || backend == BACKEND_URING;  // A multishot operation only completes again once something new happens too
+}
+
+bool eventPoller::addSocket(SOCKET newSocket, uint64_t key){
+
+	#ifdef POLLER_HAS_URING
+		if(backend == BACKEND_URING){
+			return watch(newSocket, key, URING_POLL);
+		}
+	#endif
+
+	#ifdef POLLER_HAS_EPOLL
+		if(backend == BACKEND_EPOLL){
+			epoll_event event;
+			event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;  // Edge-triggered EPOLLOUT is only reported again after a send() has run out of space, so it can stay registered
+			event.data.u64 = key;
+			if(epoll_ctl(epollFD, EPOLL_CTL_ADD, newSocket, &event) == -1){
+				printf("epoll_ctl() has failed to add socket #%i: %i\n", newSocket, errno);
+				return false;
+			}
+			return true;
+		}
+	#endif
+
+	#ifndef _WIN32
+		if(newSocket >= FD_SETSIZE){  // select() can't watch descriptors past FD_SETSIZE
+			printf("Socket #%i exceeds FD_SETSIZE (%i) and cannot be watched by select().\n", newSocket, FD_SETSIZE);
+			return false;
+		}
+	#endif
+	if(watchedSockets.size() >= FD_SETSIZE){
+		printf("select() is already watching %i sockets, which is the most it can handle.\n", FD_SETSIZE);
+		return false;
+	}
+	watchedSockets.push_back(newSocket);
+	watchedKeys.push_back(key);
+	return true;
+
+}
+
+bool eventPoller::addListener(SOCKET newSocket, uint64_t key){
+	#ifdef POLLER_HAS_URING
+		if(backend == BACKEND_URING){
+			return watch(newSocket, key, URING_ACCEPT);
+		}
+	#endif
+	return addSocket(newSocket, key);
+}
+
+bool eventPoller::addStream(SOCKET newSocket, uint64_t key){
+	#ifdef POLLER_HAS_URING
+		if(backend == BACKEND_URING){
+			return watch(newSocket, key, URING_RECEIVE);
+		}
+	#endif
+	return addSocket(newSocket, key);
+}
+
+void eventPoller::removeSocket(SOCKET oldSocket, std::string *unread){
+
+	#ifdef POLLER_HAS_URING
+		if(backend == BACKEND_URING){
+
+			if(oldSocket < 0 || (unsigned int)oldSocket >= watches.size() || !watches[oldSocket].active){
+				return;
+			}
+			uringWatch &watched = watches[oldSocket];
+			uint32_t oldGeneration = watched.generation;
+			watched.active = false;
+			watched.writeArmed = false;
+			watched.generation = (watched.generation + 1) & 0xFFFFFF;  // Anything still to come for it is dropped
+
+			// Cancel everything submitted for the descriptor and wait for it to finish, as it must be done with before the
+			// socket is closed (or handed to someone else). Data it had already received is kept for the caller
+			io_uring_sqe *entry = ring.next();
+			entry->opcode = IORING_OP_ASYNC_CANCEL;
+			entry->fd = oldSocket;
+			entry->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+			uint64_t cancelTag = uringTag(URING_CANCEL, 0, oldSocket);
+			entry->user_data = cancelTag;
+
+			uint64_t receiveTag = uringTag(URING_RECEIVE, oldGeneration, oldSocket);
+			for(unsigned int d = 0; d < deferredCompletions.size(); d++){  // Some may have been put aside already
+				uringCompletion &deferred = deferredCompletions[d];
+				if(deferred.userData == receiveTag && deferred.result > 0 && (deferred.flags & IORING_CQE_F_BUFFER)){
+					if(unread != NULL){
+						unread->append(ring.buffer(deferred.flags >> IORING_CQE_BUFFER_SHIFT), deferred.result);
+					}
+					ring.recycle(deferred.flags >> IORING_CQE_BUFFER_SHIFT);
+					deferred.flags &= ~IORING_CQE_F_BUFFER;
+				}
+			}
+
+			bool cancelled = false;
+			while(!cancelled && ring.enter(1) >= 0){
+				uringCompletion completed;
+				while(ring.completion(completed)){
+					if(completed.userData == cancelTag){
+						cancelled = true;
+					}else if(completed.userData == receiveTag && completed.result > 0 && (completed.flags & IORING_CQE_F_BUFFER)){
+						if(unread != NULL){
+							unread->append(ring.buffer(completed.flags >> IORING_CQE_BUFFER_SHIFT), completed.result);
+						}
+						ring.recycle(completed.flags >> IORING_CQE_BUFFER_SHIFT);
+					}else{
+						deferredCompletions.push_back(completed);
+					}
+				}
+			}
+			return;
+
+		}
+	#endif
+
+	#ifdef POLLER_HAS_EPOLL
+		if(backend == BACKEND_EPOLL){
+			epoll_ctl(epollFD, EPOLL_CTL_DEL, oldSocket, NULL);  // Closing the socket removes it anyway, so failures can be ignored
+			return;
+		}
+	#endif
+
+	setWriteInterest(oldSocket, false);
+	for(unsigned int d = 0; d < watchedSockets.size(); d++){
+		if(watchedSockets.at(d) == oldSocket){
+			watchedSockets.at(d) = watchedSockets.back();  // Order doesn't matter, so swap with the last socket rather than shifting everything down
+			watchedSockets.pop_back();
+			watchedKeys.at(d) = watchedKeys.back();
+			watchedKeys.pop_back();
+			break;
+		}
+	}
+
+}
+
+void eventPoller::setWriteInterest(SOCKET socket, bool interested){
+
+	if(backend == BACKEND_EPOLL){  // Always registered for EPOLLOUT
+		return;
+	}
+
+	#ifdef POLLER_HAS_URING
+		if(backend == BACKEND_URING){  // A one-shot poll, which is left to complete if interest is lost (the caller checks there's still something to send)
+			if(interested && socket >= 0 && (unsigned int)socket < watches.size() && watches[socket].active && !watches[socket].writeArmed){
+				uringWatch &watched = watches[socket];
+				watched.writeArmed = true;
+				io_uring_sqe *entry = ring.next();
+				entry->opcode = IORING_OP_POLL_ADD;
+				entry->fd = socket;
+				entry->poll32_events = POLLOUT;
+				entry->user_data = uringTag(URING_WRITABLE, watched.generation, socket);
+			}
+			return;
+		}
+	#endif
+
+	for(unsigned int d = 0; d < writeSockets.size(); d++){
+		if(writeSockets.at(d) == socket){
+			if(!interested){
+				writeSockets.at(d) = writeSockets.back();
+				writeSockets.pop_back();
+			}
+			return;
+		}
+	}
+	if(interested){
+		writeSockets.push_back(socket);
+	}
+
+}
+
+int eventPoller::wait(std::vector<pollerEvent> &readySockets, int timeoutMilliseconds){
+
+	readySockets.clear();
+
+	#ifdef POLLER_HAS_URING
+		if(backend == BACKEND_URING){
+
+			// The last wait()'s data has been copied out by now
+			for(unsigned int d = 0; d < heldBuffers.size(); d++){
+				ring.recycle(heldBuffers[d]);
+			}
+			heldBuffers.clear();
+
+			for(unsigned int d = 0; d < deferredCompletions.size(); d++){
+				handleCompletion(deferredCompletions[d], readySockets);
+			}
+			deferredCompletions.clear();
+
+			// Submits everything queued since the last call, and only waits if nothing is ready yet
+			int result = ring.enter(readySockets.empty() ? 1 : 0, timeoutMilliseconds);
+			if(result < 0){
+				errno = -result;
+				return -1;
+			}
+			uringCompletion completed;
+			while(ring.completion(completed)){
+				handleCompletion(completed, readySockets);
+			}
+			return readySockets.size();
+
+		}
+	#endif
+
+	#ifdef POLLER_HAS_EPOLL
+		if(backend == BACKEND_EPOLL){
+
+			int readyCount = epoll_wait(epollFD, &readyEvents[0], readyEvents.size(), timeoutMilliseconds);
+			if(readyCount == -1){
+				return errno == EINTR ? 0 : -1;
+			}
+
+			for(int d = 0; d < readyCount; d++){
+				pollerEvent event;
+				event.key = readyEvents[d].data.u64;
+				event.readable = (readyEvents[d].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0;
+				event.writable = (readyEvents[d].events & EPOLLOUT) != 0;
+				readySockets.push_back(event);
+			}
+			if((unsigned int)readyCount == readyEvents.size()){  // Every slot was used, so make room for more next time
+				readyEvents.resize(readyEvents.size() * 2);
+			}
+			return readyCount;
+
+		}
+	#endif
+
+	/* Empties and refills socketSet and writeSet, as select() modifies them */
+	FD_ZERO(&socketSet);
+	FD_ZERO(&writeSet);
+	SOCKET maxSocket = 0;
+	for(unsigned int d = 0; d < watchedSockets.size(); d++){
+		FD_SET(watchedSockets.at(d), &socketSet);
+		if(watchedSockets.at(d) > maxSocket){
+			maxSocket = watchedSockets.at(d);
+		}
+	}
+	for(unsigned int d = 0; d < writeSockets.size(); d++){
+		FD_SET(writeSockets.at(d), &writeSet);
+	}
+
+	// Checks which sockets have changed state, and removes the ones that haven't from the sets
+	timeval timeout;
+	timeout.tv_sec = timeoutMilliseconds / 1000;
+	timeout.tv_usec = timeoutMilliseconds % 1000 * 1000;
+	int changedSockets = select(maxSocket + 1, &socketSet, writeSockets.empty() ? NULL : &writeSet, NULL, timeoutMilliseconds < 0 ? NULL : &timeout);  // The first parameter is ignored on Windows
+	if(changedSockets > 0){
+		for(unsigned int d = 0; d < watchedSockets.size(); d++){
+			pollerEvent event;
+			event.key = watchedKeys.at(d);
+			event.readable = FD_ISSET(watchedSockets.at(d), &socketSet) != 0;
+			event.writable = !writeSockets.empty() && FD_ISSET(watchedSockets.at(d), &writeSet) != 0;
+			if(event.readable || event.writable){
+				readySockets.push_back(event);
+			}
+		}
+	}
+	return changedSockets;
+
+}
+
+const char *eventPoller::waitFunction() const{
+	switch(backend){
+		case BACKEND_URING:
+			return "io_uring_enter()";
+		case BACKEND_EPOLL:
+			return "epoll_wait()";
+		default:
+			return "select()";
+	}
+}
+
+#ifdef POLLER_HAS_URING
+
+bool eventPoller::watch(SOCKET newSocket, uint64_t key, unsigned int operation){
+
+	if(newSocket < 0){
+		return false;
+	}
+	if((unsigned int)newSocket >= watches.size()){
+		watches.resize(newSocket + 1);  // Value-initialised, so inactive
+	}
+	uringWatch &watched = watches[newSocket];
+	watched.key = key;
+	watched.operation = operation;
+	watched.active = true;
+	watched.writeArmed = false;
+	arm(newSocket);  // Submitted with the next system call
+	return true;
+
+}
+
+void eventPoller::arm(SOCKET socket){
+
+	uringWatch &watched = watches[socket];
+	io_uring_sqe *entry = ring.next();
+	entry->fd = socket;
+	entry->user_data = uringTag(watched.operation, watched.generation, socket);
+	if(watched.operation == URING_RECEIVE){
+		entry->opcode = IORING_OP_RECV;
+		entry->ioprio = IORING_RECV_MULTISHOT;
+		entry->flags = IOSQE_BUFFER_SELECT;  // The kernel picks one of the ring's receive buffers when data arrives
+		entry->buf_group = 0;
+	}else if(watched.operation == URING_ACCEPT){
+		entry->opcode = IORING_OP_ACCEPT;
+		entry->ioprio = IORING_ACCEPT_MULTISHOT;
+		entry->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	}else{
+		entry->opcode = IORING_OP_POLL_ADD;
+		entry->poll32_events = POLLIN;
+		entry->len = IORING_POLL_ADD_MULTI;
+	}
+
+}
+
+void eventPoller::handleCompletion(const uringCompletion &completed, std::vector<pollerEvent> &readySockets){
+
+	unsigned int operation = completed.userData >> 56;
+	uint32_t generation = (completed.userData >> 32) & 0xFFFFFF;
+	SOCKET socket = (SOCKET)(uint32_t)completed.userData;
+	bool hasBuffer = (completed.flags & IORING_CQE_F_BUFFER) != 0;
+	unsigned int bufferID = completed.flags >> IORING_CQE_BUFFER_SHIFT;
+
+	// Drop anything for a descriptor that has been removed since, giving back the buffer it came with
+	if(operation == URING_SEND || operation == URING_CANCEL || (unsigned int)socket >= watches.size()
+	   || !watches[socket].active || watches[socket].generation != generation){
+		if(hasBuffer){
+			ring.recycle(bufferID);
+		}
+		return;
+	}
+	uringWatch &watched = watches[socket];
+	bool more = (completed.flags & IORING_CQE_F_MORE) != 0;
+
+	pollerEvent event;
+	event.key = watched.key;
+	if(operation == URING_WRITABLE){
+
+		watched.writeArmed = false;
+		if(completed.result < 0){
+			return;
+		}
+		event.writable = true;
+
+	}else if(operation == URING_RECEIVE){
+
+		// Without data (at the end of the stream, after an error or when every receive buffer is in use) the caller calls
+		// recv() itself, which reports what happened or picks up what couldn't be received here
+		event.readable = true;
+		if(completed.result > 0 && hasBuffer){
+			event.data = ring.buffer(bufferID);
+			event.length = completed.result;
+			heldBuffers.push_back(bufferID);
+		}
+		if(!more && completed.result != 0){  // Stopped early (e.g. every buffer was in use), so start it again. There's nothing more after the end of the stream
+			arm(socket);
+		}
+
+	}else if(operation == URING_ACCEPT){
+
+		event.readable = true;
+		if(completed.result >= 0){
+			event.accepted = completed.result;
+		}
+		if(!more){
+			arm(socket);
+		}
+
+	}else{
+
+		event.readable = true;
+		if(!more){
+			arm(socket);
+		}
+
+	}
+	readySockets.push_back(event);
+
+}
+
+void eventPoller::queueSend(SOCKET socket, msghdr *message, unsigned int index){
+	io_uring_sqe *entry = ring.next();
+	entry->opcode = IORING_OP_SENDMSG;
+	entry->fd = socket;
+	entry->addr = (uint64_t)(uintptr_t)message;
+	entry->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;  // Without MSG_DONTWAIT, io_uring would wait for room instead of failing
+	entry->user_data = uringTag(URING_SEND, 0, index);
+	queuedSends.push_back(index);
+	sendsInFlight++;
+}
+
+bool eventPoller::submitSends(std::vector<int> &results){
+
+	for(unsigned int d = 0; d < queuedSends.size(); d++){
+		results[queuedSends[d]] = URING_SEND_PENDING;
+	}
+
+	// Nothing returns while a send is in flight, as the kernel can read its message and buffers until it completes, and
+	// giving up on it would have it gathered and sent again. io_uring_enter() failing with EAGAIN or EBUSY (or being
+	// interrupted) only means the kernel has to catch up, so it's tried again. Anything else means the ring is broken and
+	// no more will complete, so the sends still waiting fail with the error and their connections are closed
+	bool failed = false;
+	while(sendsInFlight > 0){
+		int result = ring.enter(sendsInFlight);
+		if(result == -EAGAIN || result == -EBUSY){
+			std::this_thread::yield();
+		}else if(result < 0){
+			for(unsigned int d = 0; d < queuedSends.size(); d++){
+				if(results[queuedSends[d]] == URING_SEND_PENDING){
+					results[queuedSends[d]] = result;
+				}
+			}
+			sendsInFlight = 0;
+			errno = -result;
+			failed = true;
+			break;
+		}
+		uringCompletion completed;
+		while(ring.completion(completed)){
+			if((completed.userData >> 56) == URING_SEND){
+				results[(uint32_t)completed.userData] = completed.result;
+				sendsInFlight--;
+			}else{
+				deferredCompletions.push_back(completed);
+			}
+		}
+	}
+	queuedSends.clear();
+	return !failed;
+
+}
+
+#endif
+
+const char *eventPoller::backendName(backendType type){
+	switch(type){
+		case BACKEND_URING:
+			return "io_uring";
+		case BACKEND_EPOLL:
+			return "epoll";
+		default:
+			return "select";
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef EVENTPOLLER_H
+#define EVENTPOLLER_H
+
+#include "platform.hpp"
+#include "uringQueue.hpp"
+
+#ifdef __linux__
+	#include <sys/epoll.h>
+	#define POLLER_HAS_EPOLL
+#endif
+
+#include <string>
+#include <vector>
+
+struct pollerEvent{
+	uint64_t key;  // Identifies the socket, as given to addSocket()
+	bool readable;  // Data (or a disconnect) is waiting to be received
+	bool writable;  // Queued data can be sent again
+	const char *data;  // io_uring only: data already received from the socket, valid until the next wait(). NULL if it still has to be received
+	unsigned int length;
+	SOCKET accepted;  // io_uring only: a connection already accepted on a listening socket, INVALID_SOCKET if accept() still has to be called
+	pollerEvent(){ key = 0; readable = false; writable = false; data = NULL; length = 0; accepted = INVALID_SOCKET; }
+};
+
+#ifdef POLLER_HAS_URING
+// What the io_uring backend is doing with a descriptor. Completions carry the generation, so ones for a descriptor that has
+// been removed (and maybe reused) since they were submitted are recognised and dropped
+struct uringWatch{
+	uint64_t key;
+	uint32_t generation;
+	uint8_t operation;  // The multishot operation kept armed for it
+	bool active;
+	bool writeArmed;  // Whether a one-shot POLLOUT is waiting
+};
+#endif
+
+// Waits for sockets to become readable or writable. The epoll backend only reports the sockets that are actually ready
+// and has no limit on how many sockets it can watch; select() is kept as a fallback for other platforms.
+// The io_uring backend goes a step further for sockets added with addListener() and addStream(): connections are accepted
+// and data received by the kernel, and handed over with the events, so a busy pass needs one system call rather than one
+// per socket. It can also send to many sockets with a single system call (see queueSend())
+struct eventPoller{
+
+	enum backendType{
+		BACKEND_SELECT,
+		BACKEND_EPOLL,
+		BACKEND_URING
+	};
+
+	backendType backend;
+
+	// select() backend
+	fd_set socketSet;
+	fd_set writeSet;
+	std::vector<SOCKET> watchedSockets;
+	std::vector<uint64_t> watchedKeys;  // Key of each socket in watchedSockets
+	std::vector<SOCKET> writeSockets;  // Sockets with data that couldn't be sent straight away
+
+	#ifdef POLLER_HAS_EPOLL
+		// epoll backend
+		int epollFD;
+		std::vector<epoll_event> readyEvents;
+	#endif
+
+	#ifdef POLLER_HAS_URING
+		// io_uring backend
+		uringQueue ring;
+		std::vector<uringWatch> watches;  // Indexed by descriptor
+		std::vector<uringCompletion> deferredCompletions;  // Taken while waiting for something else, handled by the next wait()
+		std::vector<unsigned int> heldBuffers;  // Receive buffers handed out with the last wait()'s events
+		std::vector<unsigned int> queuedSends;  // Indexes of the sends queued since the last submitSends()
+		unsigned int sendsInFlight;
+	#endif
+
+	eventPoller();
+	~eventPoller();
+
+	bool init(backendType preferredBackend);
+	bool edgeTriggered() const;  // If true, a ready socket must be drained until it would block, as it won't be reported again until new data arrives
+	bool addSocket(SOCKET newSocket, uint64_t key);  // The key is returned with the socket's events
+	bool addListener(SOCKET newSocket, uint64_t key);  // Like addSocket(), but io_uring accepts the connections (see pollerEvent::accepted)
+	bool addStream(SOCKET newSocket, uint64_t key);  // Like addSocket(), but io_uring receives the data (see pollerEvent::data)
+	void removeSocket(SOCKET oldSocket, std::string *unread = NULL);  // With io_uring, anything already received from a stream that hasn't been handed out is appended to unread
+	void setWriteInterest(SOCKET socket, bool interested);  // Whether to report the socket once it's writable again
+	int wait(std::vector<pollerEvent> &readySockets, int timeoutMilliseconds = -1);  // Blocks until at least one socket is ready or the timeout (-1 = none) runs out, returns the number of ready sockets or SOCKET_ERROR
+	const char *waitFunction() const;  // For error messages
+
+	bool batchesSends() const{ return backend == BACKEND_URING; }
+	#ifdef POLLER_HAS_URING
+		// Sends are queued up, then all submitted with one system call. The message (and what it points to) must stay valid
+		// until submitSends() returns. They never wait for room in the socket's send buffer, failing with -EAGAIN instead
+		void queueSend(SOCKET socket, msghdr *message, unsigned int index);
+		bool submitSends(std::vector<int> &results);  // Sets results[index] to what sendmsg() returned for each queued send, or -errno. False if the ring has failed
+		bool watch(SOCKET newSocket, uint64_t key, unsigned int operation);
+		void arm(SOCKET socket);  // Queues the socket's multishot operation
+		void handleCompletion(const uringCompletion &completed, std::vector<pollerEvent> &readySockets);
+	#endif
+
+	static const char *backendName(backendType type);
+
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "lobbySnapshot.hpp"
+#include <string.h>
+#include <sstream>
+
+lobbySnapshot::lobbySnapshot(){
+	version = 1;
+	blobVersion = 0;
+	recordsStale = true;
+	slotsStale = true;
+	chatStale = true;
+	seenRecords = 0;
+	seenSlots = 0;
+	seenChat = 0;
+}
+
+void lobbySnapshot::recordAdded(const std::string &record){
+	if(!recordsStale){
+		records.append(record.c_str(), record.length() + 1);
+	}
+	version++;
+}
+
+void lobbySnapshot::recordsChanged(){
+	recordsStale = true;
+	version++;
+}
+
+void lobbySnapshot::slotsChanged(){
+	slotsStale = true;
+	version++;
+}
+
+void lobbySnapshot::chatChanged(){
+	chatStale = true;
+	version++;
+}
+
+const sharedMessageRef &lobbySnapshot::get(slotMap<connection> &connections, lobbySlotHandler lobbyMaps[8], const std::string &motd, const std::vector<std::string> &lastMessages){
+
+	if(blobVersion == version){
+		return blob;
+	}
+
+	if(recordsStale){
+		records.clear();
+		for(unsigned int d = 0; d < connections.size(); d++){
+			if(connections.at(d).registered){
+				records.append(connections.at(d).playerData.record.c_str(), connections.at(d).playerData.record.length() + 1);
+			}
+		}
+		recordsStale = false;
+	}
+
+	if(slotsStale){
+		slots = slotMessages(lobbyMaps);
+		slotsStale = false;
+	}
+
+	if(chatStale){
+		chat.assign(motd.c_str(), motd.length() + 1);
+		for(unsigned int d = 0; d < lastMessages.size(); d++){
+			chat.append(lastMessages.at(d).c_str(), lastMessages.at(d).length() + 1);
+		}
+		chatStale = false;
+	}
+
+	join();
+	blobVersion = version;
+	return blob;
+
+}
+
+const sharedMessageRef &lobbySnapshot::get(processCluster &cluster, const std::string &motd){
+
+	// Copy whatever has changed out of the shared lobby, and start again if another process changed something meanwhile.
+	// The versions are only kept once a copy has made it through, so a torn copy is never mistaken for an up to date one
+	const sharedLobby &shared = *cluster.shared;
+	uint32_t recordsVersion, slotsVersion, chatVersion;
+	uint32_t sequence;
+	do{
+
+		sequence = cluster.readBegin();
+		recordsVersion = shared.recordsVersion;
+		slotsVersion = shared.slotsVersion;
+		chatVersion = shared.chatVersion;
+
+		if(recordsVersion != seenRecords){
+			records.clear();
+			for(unsigned int d = 0; d < CLUSTER_MAX_PLAYERS; d++){
+				uint32_t length = shared.records[d].length;
+				if(length != 0 && length <= CLUSTER_RECORD_SIZE){  // Checked, as the length may be mid-change
+					records.append(shared.records[d].data, length);
+				}
+			}
+		}
+
+		if(slotsVersion != seenSlots){
+			slots = slotMessages(shared.lobbyMaps);
+		}
+
+		if(chatVersion != seenChat){
+			chat.assign(motd.c_str(), motd.length() + 1);
+			for(unsigned int d = 0; d < shared.chatCount && d < 20; d++){
+				const sharedChat &message = shared.chat[(shared.firstChat + d) % 20];
+				if(message.length != 0 && message.length <= CLUSTER_CHAT_SIZE){
+					chat.append(message.data, message.length);
+				}
+			}
+		}
+
+	}while(cluster.readRetry(sequence));
+
+	if(recordsVersion == seenRecords && slotsVersion == seenSlots && chatVersion == seenChat){
+		return blob;
+	}
+	seenRecords = recordsVersion;
+	seenSlots = slotsVersion;
+	seenChat = chatVersion;
+
+	join();
+	return blob;
+
+}
+
+void lobbySnapshot::join(){
+	blob = sharedMessageRef::allocate(records.length() + slots.length() + chat.length());
+	memcpy(blob->data(), records.data(), records.length());
+	memcpy(blob->data() + records.length(), slots.data(), slots.length());
+	memcpy(blob->data() + records.length() + slots.length(), chat.data(), chat.length());
+}
+
+std::string lobbySnapshot::slotMessages(const lobbySlotHandler lobbyMaps[8]){
+
+	// Tell the joiner which slot of which race each waiting player is in, and whether they're ready
+	std::ostringstream ss;
+	for(unsigned int raceMap = 1; raceMap <= 8; raceMap++){
+		for(unsigned int raceSlot = 1; raceSlot <= 4; raceSlot++){
+			unsigned int playerID = lobbyMaps[raceMap - 1].playerIDs[raceSlot - 1];
+			if(playerID != 0){
+				ss << "j" << raceMap << "`" << raceSlot << "`" << playerID << '\0';
+				if(lobbyMaps[raceMap - 1].playerStates[raceSlot - 1] == 2){
+					ss << "r" << playerID << '\0';
+				}
+			}
+		}
+	}
+	return ss.str();
+
+}
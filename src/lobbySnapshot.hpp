@@ -0,0 +1,45 @@
+#ifndef LOBBYSNAPSHOT_H
+#define LOBBYSNAPSHOT_H
+
+#include "connection.hpp"
+#include "lobbySlotHandler.hpp"
+#include "processCluster.hpp"
+#include "sharedMessage.hpp"
+#include <string>
+#include <vector>
+
+// Everything a player is sent when they join the lobby ('o'): every registered player's record, who is waiting in which
+// race slot, the MotD and the last 20 chat messages, as one blob of null-terminated messages. Each part is only rebuilt
+// after it changes, so a join queues a single buffer however many players are online. The blob is a shared message, so
+// everyone joining before the next change is sent the same one without it being copied
+struct lobbySnapshot{
+
+	std::string records;  // 'p' messages
+	std::string slots;  // 'j' and 'r' messages
+	std::string chat;  // MotD and chat messages
+	sharedMessageRef blob;  // The three parts joined together
+	unsigned int version;  // Bumped by every change
+	unsigned int blobVersion;  // Version the blob was last built from
+	bool recordsStale;
+	bool slotsStale;
+	bool chatStale;
+	uint32_t seenRecords;  // Versions of the cluster's shared lobby the parts were last built from
+	uint32_t seenSlots;
+	uint32_t seenChat;
+
+	lobbySnapshot();
+
+	void recordAdded(const std::string &record);  // A player has registered, so their record can just be appended
+	void recordsChanged();  // A record has changed or a player has left
+	void slotsChanged();
+	void chatChanged();
+	const sharedMessageRef &get(slotMap<connection> &connections, lobbySlotHandler lobbyMaps[8], const std::string &motd, const std::vector<std::string> &lastMessages);
+	const sharedMessageRef &get(processCluster &cluster, const std::string &motd);  // When clustered, everything comes from the shared lobby
+	void join();  // Builds a new blob, leaving the old one to whoever still has it queued
+
+	static std::string slotMessages(const lobbySlotHandler lobbyMaps[8]);
+
+
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "messageArena.hpp"
+#include <stdarg.h>
+#include <stdio.h>
+
+messageArena::messageArena(){
+	used = 0;
+}
+
+messageArena::~messageArena(){
+	rewind(0);
+}
+
+char *messageArena::allocate(unsigned int size){
+
+	size = (size + 7) & ~7u;  // Keep everything 8-byte aligned
+	if(size <= MESSAGE_ARENA_SIZE - used){
+		char *allocated = block + used;
+		used += size;
+		return allocated;
+	}
+
+	overflow.push_back(new char[size]);
+	return overflow.back();
+
+}
+
+std::string_view messageArena::format(const char *format, ...){
+
+	va_list args;
+	va_start(args, format);
+	va_list retry;
+	va_copy(retry, args);
+
+	// Try the rest of the block first, which is nearly always enough, and only allocate once the length is known
+	unsigned int space = MESSAGE_ARENA_SIZE - used;
+	int length = vsnprintf(block + used, space, format, args);
+	const char *text = block + used;
+	if(length < 0){  // Only for a bad format string
+		length = 0;
+		text = "";
+	}else if((unsigned int)length < space){
+		used += (length + 8) & ~7u;  // The terminator, rounded up to keep the alignment
+		if(used > MESSAGE_ARENA_SIZE){
+			used = MESSAGE_ARENA_SIZE;
+		}
+	}else{
+		char *heapText = allocate(length + 1);
+		vsnprintf(heapText, length + 1, format, retry);
+		text = heapText;
+	}
+
+	va_end(retry);
+	va_end(args);
+	return std::string_view(text, length);
+
+}
+
+void messageArena::rewind(unsigned int mark){
+
+	used = mark;
+	if(mark == 0){  // Heap allocations aren't tracked by mark, so they're kept until the arena is empty again
+		for(unsigned int d = 0; d < overflow.size(); d++){
+			delete[] overflow[d];
+		}
+		overflow.clear();
+	}
+
+}
@@ -0,0 +1,38 @@
+#ifndef MESSAGEARENA_H
+#define MESSAGEARENA_H
+
+#include <string_view>
+#include <vector>
+
+#define MESSAGE_ARENA_SIZE 8192  // Room for everything built from one message (which can't be longer than RECEIVE_BUFFER_SIZE)
+
+// Scratch memory for the replies and other temporaries built while handling a single message. Allocating just moves
+// an offset along, and everything is freed at once when the message has been handled, so building a reply doesn't
+// touch the heap. Anything that doesn't fit goes to the heap instead and is freed along with the rest
+struct messageArena{
+
+	char block[MESSAGE_ARENA_SIZE];
+	unsigned int used;
+	std::vector<char*> overflow;  // Heap allocations made since the arena was last empty
+
+	messageArena();
+	~messageArena();
+
+	char *allocate(unsigned int size);
+	std::string_view format(const char *format, ...);  // printf() into the arena. The text is followed by a null terminator that isn't part of the view
+	void rewind(unsigned int mark);  // Frees everything allocated since used was mark
+
+};
+
+// Frees what was allocated in the arena while it was in scope, however the scope is left
+struct arenaScope{
+
+	messageArena &arena;
+	unsigned int mark;
+
+	arenaScope(messageArena &scopeArena) : arena(scopeArena){ mark = arena.used; }
+	~arenaScope(){ arena.rewind(mark); }
+
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "metrics.hpp"
+
+latencyHistogram::latencyHistogram(){
+	for(unsigned int d = 0; d < BUCKETS; d++){
+		buckets[d] = 0;
+	}
+	count = 0;
+	total = 0;
+	max = 0;
+}
+
+unsigned int latencyHistogram::bucketIndex(uint64_t value){
+	if(value < SUB_BUCKETS){
+		return value;
+	}
+	// The highest bit picks the power of two, and the next SUB_BUCKET_BITS bits pick the bucket within it
+	unsigned int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+	return (shift + 1) * SUB_BUCKETS + (unsigned int)(value >> shift) - SUB_BUCKETS;
+}
+
+uint64_t latencyHistogram::bucketLimit(unsigned int index){
+	if(index < SUB_BUCKETS){
+		return index;
+	}
+	unsigned int shift = index / SUB_BUCKETS - 1;
+	uint64_t top = SUB_BUCKETS + index % SUB_BUCKETS;
+	return ((top + 1) << shift) - 1;
+}
+
+void latencyHistogram::record(uint64_t value){
+	buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(value, std::memory_order_relaxed);
+	uint64_t currentMax = max.load(std::memory_order_relaxed);
+	while(value > currentMax && !max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed));
+}
+
+uint64_t latencyHistogram::percentile(double fraction) const{
+
+	uint64_t target = (uint64_t)(fraction * count.load(std::memory_order_relaxed));
+	uint64_t seen = 0;
+	for(unsigned int d = 0; d < BUCKETS; d++){
+		seen += buckets[d].load(std::memory_order_relaxed);
+		if(seen > target){
+			uint64_t largest = max.load(std::memory_order_relaxed);
+			return bucketLimit(d) < largest ? bucketLimit(d) : largest;
+		}
+	}
+	return max.load(std::memory_order_relaxed);
+
+}
+
+void latencyHistogram::write(std::ostringstream &out, const char *name, const char *labels) const{
+	const double quantiles[5] = {0.5, 0.9, 0.99, 0.999, 1.0};
+	for(unsigned int d = 0; d < 5; d++){
+		out << name << "{" << (labels != NULL ? labels : "") << (labels != NULL ? "," : "") << "quantile=\"" << quantiles[d] << "\"} "
+			<< (d == 4 ? max.load(std::memory_order_relaxed) : percentile(quantiles[d])) << "\n";
+	}
+	if(labels != NULL){
+		out << name << "_sum{" << labels << "} " << total.load(std::memory_order_relaxed) << "\n";
+		out << name << "_count{" << labels << "} " << count.load(std::memory_order_relaxed) << "\n";
+	}else{
+		out << name << "_sum " << total.load(std::memory_order_relaxed) << "\n";
+		out << name << "_count " << count.load(std::memory_order_relaxed) << "\n";
+	}
+}
+
+serverMetrics::serverMetrics(){
+	timing = false;
+	for(unsigned int d = 0; d < MESSAGE_TYPES; d++){
+		messages[d] = 0;
+	}
+	bytesIn = 0;
+	bytesOut = 0;
+	connectionsAccepted = 0;
+	connectionsClosed = 0;
+	rejectedByXlist = 0;
+	rejectedByRate = 0;
+	sendFailures = 0;
+	slowChatDropped = 0;
+	slowTooBig = 0;
+	slowTooOld = 0;
+	idleDisconnects = 0;
+	clusterDropped = 0;
+	migrationsIn = 0;
+	migrationsOut = 0;
+	migrationsFailed = 0;
+}
+
+messageType serverMetrics::typeOf(const char *message){
+	switch(message[0]){
+		case 'n': return MESSAGE_N;
+		case 'o': return MESSAGE_O;
+		case '^': return MESSAGE_CHAT;
+		case 'j': return MESSAGE_J;
+		case 'r': return MESSAGE_R;
+		case 'b': return MESSAGE_B;
+		case 'a': return MESSAGE_A;
+		case '%': return message[1] == 'f' ? MESSAGE_F : MESSAGE_OTHER;
+		case '#':
+			switch(message[1]){
+				case 'q': return MESSAGE_Q;
+				case 't': return MESSAGE_T;
+				case 'k': return MESSAGE_K;
+				case 's': return MESSAGE_S;
+			}
+		break;
+	}
+	return MESSAGE_OTHER;
+}
+
+const char *serverMetrics::typeName(messageType type){
+	const char *names[MESSAGE_TYPES] = {"n", "o", "^", "j", "r", "#q", "#t", "#k", "#s", "%f", "b", "a", "other"};
+	return names[type];
+}
+
+void serverMetrics::write(std::ostringstream &out) const{
+
+	for(unsigned int d = 0; d < MESSAGE_TYPES; d++){
+		out << "pr1_messages_total{type=\"" << typeName((messageType)d) << "\"} " << messages[d].load(std::memory_order_relaxed) << "\n";
+	}
+	out << "pr1_bytes_in_total " << bytesIn.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_bytes_out_total " << bytesOut.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_connections_accepted_total " << connectionsAccepted.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_connections_closed_total " << connectionsClosed.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_connections_rejected_total{reason=\"xlist\"} " << rejectedByXlist.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_connections_rejected_total{reason=\"rate\"} " << rejectedByRate.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_send_failures_total " << sendFailures.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_slow_chat_dropped_total " << slowChatDropped.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_slow_disconnects_total{reason=\"bytes\"} " << slowTooBig.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_slow_disconnects_total{reason=\"age\"} " << slowTooOld.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_idle_disconnects_total " << idleDisconnects.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_cluster_dropped_total " << clusterDropped.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_migrations_total{direction=\"in\"} " << migrationsIn.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_migrations_total{direction=\"out\"} " << migrationsOut.load(std::memory_order_relaxed) << "\n";
+	out << "pr1_migrations_failed_total " << migrationsFailed.load(std::memory_order_relaxed) << "\n";
+
+	if(timing){
+		dispatchTime.write(out, "pr1_dispatch_nanoseconds");
+		loopTime.write(out, "pr1_loop_nanoseconds");
+	}
+
+	#ifdef PR1SERVER_HANDLER_TIMING
+		for(unsigned int d = 0; d < MESSAGE_TYPES; d++){
+			if(handlerCycles[d].count.load(std::memory_order_relaxed) != 0){
+				std::string labels = std::string("type=\"") + typeName((messageType)d) + "\"";
+				handlerCycles[d].write(out, "pr1_handler_cycles", labels.c_str());
+			}
+		}
+	#endif
+
+}
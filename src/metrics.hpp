@@ -0,0 +1,104 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+
+// Message types counted separately by the metrics
+enum messageType{
+	MESSAGE_N,
+	MESSAGE_O,
+	MESSAGE_CHAT,
+	MESSAGE_J,
+	MESSAGE_R,
+	MESSAGE_Q,
+	MESSAGE_T,
+	MESSAGE_K,
+	MESSAGE_S,
+	MESSAGE_F,
+	MESSAGE_B,
+	MESSAGE_A,
+	MESSAGE_OTHER,
+	MESSAGE_TYPES
+};
+
+inline uint64_t metricsNow(){  // Nanoseconds, for timing things
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Building with PR1SERVER_HANDLER_TIMING times every message handler in CPU cycles. It's a build option rather than a
+// config one so the dispatch isn't slowed down at all without it
+#ifdef PR1SERVER_HANDLER_TIMING
+	#if defined(__x86_64__) || defined(__i386__)
+		#include <x86intrin.h>
+		inline uint64_t cycleCount(){ return __rdtsc(); }
+	#else
+		inline uint64_t cycleCount(){ return metricsNow(); }  // No cycle counter to read, so nanoseconds instead
+	#endif
+#endif
+
+// Counts values in buckets that get wider as the values get bigger (8 per power of two, like an HDR histogram),
+// so percentiles are within 12.5% of the real value whatever the range. Safe to record into from any thread
+struct latencyHistogram{
+
+	static const unsigned int SUB_BUCKET_BITS = 3;
+	static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const unsigned int BUCKETS = 64 * SUB_BUCKETS;
+
+	std::atomic<uint64_t> buckets[BUCKETS];
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> max;
+
+	latencyHistogram();
+
+	void record(uint64_t value);
+	uint64_t percentile(double fraction) const;  // Upper end of the bucket the percentile falls in
+	void write(std::ostringstream &out, const char *name, const char *labels = NULL) const;  // labels are added to every line, e.g. type="n"
+
+	static unsigned int bucketIndex(uint64_t value);
+	static uint64_t bucketLimit(unsigned int index);  // Largest value counted in the bucket
+
+};
+
+// Counters kept while the server runs, served as plain text on the admin port (see socketServer::serveMetrics()).
+// Counters are atomics that are only ever added to, so the race workers can update them without a lock
+struct serverMetrics{
+
+	bool timing;  // Whether to time dispatches and loop passes, which costs two clock reads each
+
+	std::atomic<uint64_t> messages[MESSAGE_TYPES];
+	std::atomic<uint64_t> bytesIn;
+	std::atomic<uint64_t> bytesOut;
+	std::atomic<uint64_t> connectionsAccepted;
+	std::atomic<uint64_t> connectionsClosed;
+	std::atomic<uint64_t> rejectedByXlist;  // Connections closed straight after accept()
+	std::atomic<uint64_t> rejectedByRate;
+	std::atomic<uint64_t> sendFailures;
+	std::atomic<uint64_t> slowChatDropped;  // Chat messages not queued for clients that are behind
+	std::atomic<uint64_t> slowTooBig;  // Clients disconnected for having too much waiting to be sent
+	std::atomic<uint64_t> slowTooOld;  // Clients disconnected for not emptying their send queue in time
+	std::atomic<uint64_t> idleDisconnects;  // Clients disconnected for not sending anything in time
+	std::atomic<uint64_t> clusterDropped;  // Messages too long to post to the other server processes
+	std::atomic<uint64_t> migrationsIn;  // Racers whose socket was sent here by another server process
+	std::atomic<uint64_t> migrationsOut;
+	std::atomic<uint64_t> migrationsFailed;
+	latencyHistogram dispatchTime;  // Handling a single message, in nanoseconds
+	latencyHistogram loopTime;  // One pass of the event loop after the poller wakes up, in nanoseconds
+	#ifdef PR1SERVER_HANDLER_TIMING
+		latencyHistogram handlerCycles[MESSAGE_TYPES];  // Time spent in each message type's handler, in cycles
+	#endif
+
+	serverMetrics();
+
+	static messageType typeOf(const char *message);  // The message must be null-terminated
+	static const char *typeName(messageType type);
+	void countMessage(const char *message){ messages[typeOf(message)].fetch_add(1, std::memory_order_relaxed); }
+	static void add(std::atomic<uint64_t> &counter, uint64_t amount){ counter.fetch_add(amount, std::memory_order_relaxed); }
+	void write(std::ostringstream &out) const;
+
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "platform.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <signal.h>
+#endif
+
+bool socketStartup(){
+
+	#ifdef _WIN32
+		/* Specify the version of Winsock to use and initialize it */
+		WSADATA wsaData;
+		int initError = WSAStartup(WINSOCK_VERSION, &wsaData);
+		if(initError != 0){
+			printf("\nSocket function WSAStartup() has failed: %i\n", initError);
+			return false;
+		}
+	#else
+		// Writing to a socket the client has already closed raises SIGPIPE, which would kill the server
+		signal(SIGPIPE, SIG_IGN);
+	#endif
+	return true;
+
+}
+
+void socketCleanup(){
+	#ifdef _WIN32
+		WSACleanup();
+	#endif
+}
+
+int lastSocketError(){
+	#ifdef _WIN32
+		return WSAGetLastError();
+	#else
+		return errno;
+	#endif
+}
+
+bool socketWouldBlock(int errorCode){
+	#ifdef _WIN32
+		return errorCode == WSAEWOULDBLOCK;
+	#else
+		return errorCode == EAGAIN || errorCode == EWOULDBLOCK;
+	#endif
+}
+
+bool setNonBlocking(SOCKET socket){
+	#ifdef _WIN32
+		u_long nonBlocking = 1;
+		return ioctlsocket(socket, FIONBIO, &nonBlocking) == 0;
+	#else
+		int flags = fcntl(socket, F_GETFL, 0);
+		return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) != -1;
+	#endif
+}
+
+int sendBuffers(SOCKET socket, ioBuffer *buffers, unsigned int bufferCount){
+	#ifdef _WIN32
+		DWORD sentBytes = 0;
+		if(WSASend(socket, buffers, bufferCount, &sentBytes, 0, NULL, NULL) == SOCKET_ERROR){
+			return SOCKET_ERROR;
+		}
+		return sentBytes;
+	#else
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = buffers;
+		message.msg_iovlen = bufferCount;
+		return sendmsg(socket, &message, MSG_NOSIGNAL);
+	#endif
+}
+
+bool allowAddressReuse(SOCKET socket){
+	#ifdef _WIN32
+		(void)socket;
+		return true;
+	#else
+		int reuse = 1;
+		return setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0;
+	#endif
+}
+
+bool allowPortSharing(SOCKET socket){
+	#ifdef SO_REUSEPORT
+		int reuse = 1;
+		return setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (const char *)&reuse, sizeof(reuse)) == 0;
+	#else
+		(void)socket;
+		return false;
+	#endif
+}
+
+void abortConnection(SOCKET socket){
+	linger abort;
+	abort.l_onoff = 1;
+	abort.l_linger = 0;
+	setsockopt(socket, SOL_SOCKET, SO_LINGER, (const char *)&abort, sizeof(abort));
+	closesocket(socket);
+}
+
+std::string programDirectory(const char *prgPath){
+
+	std::string directory = prgPath;
+	std::string::size_type lastSeparator = directory.find_last_of("\\/");  // Windows accepts both separators
+	if(lastSeparator == std::string::npos){  // Launched from the current directory
+		return std::string();
+	}
+	directory.erase(lastSeparator + 1);  // Removes program name (everything after the last separator) from the path
+	return directory;
+
+}
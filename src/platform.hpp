@@ -0,0 +1,60 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Thin layer over the parts of the socket API that differ between Winsock and POSIX
+
+#ifdef _WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#define WINSOCK_VERSION MAKEWORD(2, 2)
+	extern "C" {
+		int inet_pton(int af, const char *src, char *dst);  // See inetPton.c, older MinGW headers don't declare it
+	}
+#else
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <sys/select.h>
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+	#include <netdb.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+	#define INVALID_SOCKET -1
+	#define SOCKET_ERROR -1
+	#define closesocket close
+	typedef int SOCKET;
+#endif
+
+#include <stdint.h>
+#include <string>
+
+// A pointer and length pair for scatter/gather sends, filled in with setIOBuffer()
+#ifdef _WIN32
+	typedef WSABUF ioBuffer;
+#else
+	typedef iovec ioBuffer;
+#endif
+#define MAX_IO_BUFFERS 64  // Most buffers passed to a single sendBuffers() call
+
+inline void setIOBuffer(ioBuffer &buffer, const char *data, unsigned int length){
+	#ifdef _WIN32
+		buffer.buf = (char *)data;
+		buffer.len = length;
+	#else
+		buffer.iov_base = (void *)data;
+		buffer.iov_len = length;
+	#endif
+}
+
+bool socketStartup();  // Must be called before any other socket function
+void socketCleanup();
+int lastSocketError();  // WSAGetLastError() on Windows, errno elsewhere
+bool socketWouldBlock(int errorCode);  // True if the error just means a non-blocking call had nothing to do
+bool setNonBlocking(SOCKET socket);
+int sendBuffers(SOCKET socket, ioBuffer *buffers, unsigned int bufferCount);  // Sends several buffers with one call (writev), returns the bytes sent or SOCKET_ERROR
+bool allowAddressReuse(SOCKET socket);  // Lets the server rebind its port straight after a restart (no-op on Windows, where it means something else)
+bool allowPortSharing(SOCKET socket);  // Lets several processes bind the same port, with the kernel sharing connections out between them (SO_REUSEPORT, Linux only)
+void abortConnection(SOCKET socket);  // Closes the socket with a reset instead of a normal shutdown, so nothing is left in TIME_WAIT
+std::string programDirectory(const char *prgPath);  // Everything up to and including the last path separator, or an empty string
+
+#endif
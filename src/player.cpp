@@ -1,9 +1,19 @@
 #include "player.hpp"
-#include <sstream>
+#include <algorithm>
+#include <charconv>
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 player::player(){
+	reset();
+}
+
+void player::reset(){
 
-	user = "undefined";
+	user.assign("undefined");
 	rank = 0.f;
 	headNum = 1;
 	bodyNum = 1;
@@ -18,47 +28,116 @@ player::player(){
 
 }
 
-bool player::infoIsValid(const char buffer[2048]){
+static bool isSpace(char c){
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Reads the number at the start of a field the way istringstream did: leading whitespace and a sign are allowed, anything
+// after the number is ignored, and a field that doesn't start with a number reads as 0. A field that's only whitespace
+// leaves the value as it was
+void parseUnsigned(std::string_view field, unsigned int &value){
+
+	const char *first = field.data();
+	const char *last = field.data() + field.length();
+	while(first != last && isSpace(*first)){
+		first++;
+	}
+	if(first == last){
+		return;
+	}
+
+	bool negative = false;
+	if(*first == '+' || *first == '-'){
+		negative = *first == '-';
+		first++;
+	}
+
+	unsigned int number = 0;
+	std::from_chars_result result = std::from_chars(first, last, number);
+	if(result.ec == std::errc::result_out_of_range){
+		value = UINT_MAX;
+	}else if(result.ec != std::errc()){
+		value = 0;
+	}else{
+		value = negative ? 0u - number : number;  // Negative numbers wrap around, like they did with istringstream
+	}
+
+}
+
+static void parseFloat(std::string_view field, float &value){
+
+	const char *first = field.data();
+	const char *last = field.data() + field.length();
+	while(first != last && isSpace(*first)){
+		first++;
+	}
+	if(first == last){
+		return;
+	}
+
+	const char *number = first;  // from_chars takes a minus sign but not a plus sign
+	if(*first == '+' || *first == '-'){
+		first++;
+		if(*number == '+'){
+			number = first;
+		}
+	}
+	if(first == last || !((*first >= '0' && *first <= '9') || *first == '.')){  // Don't let from_chars read "inf" or "nan"
+		value = 0.f;
+		return;
+	}
+
+	std::from_chars_result result = std::from_chars(number, last, value);
+	if(result.ec == std::errc::result_out_of_range){  // Too big or too small for a float, let strtof() decide which
+		char copy[64];
+		unsigned int length = std::min<size_t>(last - number, sizeof(copy) - 1);
+		memcpy(copy, number, length);
+		copy[length] = '\0';
+		value = strtof(copy, NULL);
+		if(value > FLT_MAX){
+			value = FLT_MAX;
+		}else if(value < -FLT_MAX){
+			value = -FLT_MAX;
+		}
+	}else if(result.ec != std::errc() || (result.ptr != last && (*result.ptr == 'e' || *result.ptr == 'E'))){  // istringstream rejected incomplete exponents
+		value = 0.f;
+	}
+
+}
+
+bool player::infoIsValid(std::string_view info){
 
 	// Player data is sent in the following format:
 	// nid`name`rank`head`body`foot`speed`jump`traction
 
-	// Parses the player data buffer backwards so we know exactly where
+	// Parses the player data backwards so we know exactly where
 	// the username starts and ends, even if it contains a grave accent
-	std::string playerInfo = buffer;
-	unsigned int lastGrave;
-	unsigned int grave = playerInfo.length();
-	for(unsigned int d = 0; d <= 7; d++){
-		lastGrave = grave - 1;
-		grave = playerInfo.rfind("`", lastGrave - 1);
-		switch(d){
-			case(0):
-				std::istringstream(playerInfo.substr(grave + 1)) >> tractionPoints;
-			break;
-			case(1):
-				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> jumpPoints;
-			break;
-			case(2):
-				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> speedPoints;
-			break;
-			case(3):
-				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> footNum;
-			break;
-			case(4):
-				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> bodyNum;
-			break;
-			case(5):
-				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> headNum;
-			break;
-			case(6):
-				std::istringstream(playerInfo.substr(grave + 1, lastGrave - grave)) >> rank;
-				user = playerInfo.substr(1, grave - 1);
-			break;
+	std::string_view fields[7];  // traction, jump, speed, foot, body, head, rank
+	std::string_view::size_type grave = info.length();
+	for(unsigned int d = 0; d < 7; d++){
+		if(grave < 2){
+			return false;
 		}
+		std::string_view::size_type previousGrave = grave;
+		grave = info.rfind('`', grave - 2);  // Every field is at least one character long, so the character before the last grave is skipped
+		if(grave == std::string_view::npos){
+			return false;
+		}
+		fields[d] = info.substr(grave + 1, previousGrave - grave - 1);
 	}
+	std::string_view name = info.substr(1, grave - 1);
+
+	parseUnsigned(fields[0], tractionPoints);
+	parseUnsigned(fields[1], jumpPoints);
+	parseUnsigned(fields[2], speedPoints);
+	parseUnsigned(fields[3], footNum);
+	parseUnsigned(fields[4], bodyNum);
+	parseUnsigned(fields[5], headNum);
+	parseFloat(fields[6], rank);
+	user.assign(name.data(), name.length());
 
 	// EXTREMELY convoluted if statement to validate the player data
-	if(user.length() > 0 && user.find("<") == std::string::npos && user.find("&#0;") == std::string::npos && user.find("`") == std::string::npos &&
+	if(name.length() > 0 && name.find("<") == std::string_view::npos && name.find("&#0;") == std::string_view::npos && name.find("`") == std::string_view::npos &&
 	headNum >= 1 && headNum <= 11 && bodyNum >= 1 && bodyNum <= 11 && footNum >= 1 && footNum <= 11 &&
 	speedPoints + jumpPoints + tractionPoints <= 150 && speedPoints <= 100 && jumpPoints <= 100 && tractionPoints <= 100){
 		return true;
@@ -67,3 +146,18 @@ bool player::infoIsValid(const char buffer[2048]){
 	return false;
 
 }
+
+void player::updateRecord(unsigned int playerID){
+
+	// Player records are sent in the following format:
+	// pid`name`rank`head`body`foot`speed`jump`traction
+	// Built in place, so the record keeps its capacity instead of being reallocated on every update (%g prints the rank
+	// the same way ostream did)
+	char fields[128];
+	int length = snprintf(fields, sizeof(fields), "p%u`", playerID);
+	record.assign(fields, length);
+	record.append(user);
+	length = snprintf(fields, sizeof(fields), "`%g`%u`%u`%u`%u`%u`%u", rank, headNum, bodyNum, footNum, speedPoints, jumpPoints, tractionPoints);
+	record.append(fields, length);
+
+}
@@ -2,6 +2,7 @@
 #define PLAYER_H
 
 #include <string>
+#include <string_view>
 
 struct player{
 
@@ -14,17 +15,23 @@ struct player{
 	unsigned int jumpPoints;
 	unsigned int tractionPoints;
 
-	unsigned int roomID;  // Stores the position + 1 of the race the player is doing in the currentRaces vector (0 = in the lobby)
+	unsigned int roomID;  // Stores the position + 1 of the race the player is doing in currentRaces (0 = in the lobby)
 	unsigned int raceMap;  // Stores which map the player is waiting to play or playing
 	unsigned int raceSlot;  // Stores which slot in the race / lobby the player is in
 
 	unsigned int x, y;
 	unsigned int item;
 
+	std::string record;  // Cached "p" message describing the player, sent to other clients. Regenerated by updateRecord() whenever the data above changes
+
 	player();
 
-	bool infoIsValid(const char buffer[2048]);
+	void reset();  // Back to the defaults, keeping the strings' capacity
+	bool infoIsValid(std::string_view info);  // Parses an 'n' message into the player's data and checks it's allowed
+	void updateRecord(unsigned int playerID);
 
 };
 
+void parseUnsigned(std::string_view field, unsigned int &value);  // Reads a number from the start of a field like istringstream would
+
 #endif
@@ -0,0 +1,555 @@
+#include "processCluster.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include <thread>
+
+#ifdef POLLER_HAS_EPOLL
+	#include <errno.h>
+	#include <signal.h>
+	#include <sys/eventfd.h>
+	#include <sys/mman.h>
+	#include <sys/prctl.h>
+	#include <sys/wait.h>
+
+	// The first process is woken up through its own inbox when one of the others exits
+	static int childWakeFD = -1;
+	static volatile sig_atomic_t childExited = 0;
+
+	static void onChildExit(int){
+		int savedErrno = errno;
+		childExited = 1;
+		uint64_t one = 1;
+		if(write(childWakeFD, &one, sizeof(one)) == -1){}  // Already woken up if the counter is full
+		errno = savedErrno;
+	}
+#endif
+
+sharedLobby::sharedLobby(){
+	lock.store(0);
+	sequence.store(0);
+	recordsVersion = 1;
+	slotsVersion = 1;
+	chatVersion = 1;
+	firstChat = 0;
+	chatCount = 0;
+	freeIDCount = CLUSTER_MAX_PLAYERS;
+	for(unsigned int d = 0; d < CLUSTER_MAX_PLAYERS; d++){
+		freeIDs[d] = CLUSTER_MAX_PLAYERS - d;  // ID 1 on top
+		records[d].length = 0;
+		records[d].owner = 0;
+		records[d].used = 0;
+	}
+}
+
+processCluster::processCluster(){
+	processCount = 1;
+	processIndex = 0;
+	shared = NULL;
+	rings = NULL;
+	segmentSize = 0;
+	pendingWakes = 0;
+	heldBack = 0;
+	lockDepth = 0;
+	lockID = 0;
+	goneProcesses = 0;
+}
+
+processCluster::~processCluster(){
+	#ifdef POLLER_HAS_EPOLL
+		if(shared != NULL){
+			munmap(shared, segmentSize);
+		}
+		for(unsigned int d = 0; d < wakeFDs.size(); d++){
+			close(wakeFDs[d]);
+		}
+		for(unsigned int d = 0; d < migrationFDs.size(); d++){
+			close(migrationFDs[d]);
+		}
+	#endif
+}
+
+bool processCluster::start(unsigned int count){
+
+	#ifdef POLLER_HAS_EPOLL
+
+		if(count > CLUSTER_MAX_PROCESSES){
+			printf("At most %i processes can share a lobby.\n", CLUSTER_MAX_PROCESSES);
+			count = CLUSTER_MAX_PROCESSES;
+		}
+
+		/* Everything shared is set up before forking, so every process inherits it */
+		size_t lobbySize = (sizeof(sharedLobby) + 63) & ~(size_t)63;
+		size_t size = lobbySize + sizeof(clusterRing) * count;
+		void *segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(segment == MAP_FAILED){
+			printf("mmap() has failed: %i\n", errno);
+			return false;
+		}
+		segmentSize = size;
+		shared = new(segment) sharedLobby();
+		rings = (clusterRing *)((char *)segment + lobbySize);
+
+		for(unsigned int p = 0; p < count; p++){
+			rings[p].head.store(0);
+			rings[p].tail = 0;
+			for(unsigned int d = 0; d < CLUSTER_RING_SIZE; d++){
+				rings[p].cells[d].sequence.store(d);
+			}
+
+			int wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			int pair[2];
+			if(wakeFD == -1 || socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) == -1){
+				printf("Unable to set up the cluster's inboxes: %i\n", errno);
+				return false;
+			}
+			wakeFDs.push_back(wakeFD);
+			migrationFDs.insert(migrationFDs.begin() + p, pair[0]);
+			migrationFDs.push_back(pair[1]);
+		}
+		processCount = count;
+		heldPosts.resize(count);
+
+		/* Fork the other processes. They stop when the first one does */
+		pid_t parent = getpid();
+		pids.assign(count, 0);
+		pids[0] = parent;
+		fflush(stdout);  // Anything still buffered would be printed by every process
+		for(unsigned int p = 1; p < count; p++){
+			pid_t child = fork();
+			if(child == -1){
+				printf("Unable to start server process %i: %i\n", p, errno);
+			}else if(child == 0){
+				processIndex = p;
+				pids.clear();
+				prctl(PR_SET_PDEATHSIG, SIGTERM);
+				if(getppid() != parent){  // The first process stopped before the line above
+					_exit(0);
+				}
+				break;
+			}else{
+				pids[p] = child;
+			}
+		}
+		lockID = getpid();
+
+		if(processIndex == 0){  // Clean up after the others if they exit
+			childWakeFD = wakeFDs[0];
+			struct sigaction action;
+			memset(&action, 0, sizeof(action));
+			action.sa_handler = onChildExit;
+			action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGCHLD, &action, NULL);
+			onChildExit(SIGCHLD);  // In case one exited before the handler was set up
+		}
+		return true;
+
+	#else
+		(void)count;
+		return false;
+	#endif
+
+}
+
+bool processCluster::watch(eventPoller &poller){
+	return poller.addSocket(wakeFDs[processIndex], CLUSTER_INBOX_KEY) && poller.addSocket(migrationFDs[processIndex], CLUSTER_MIGRATION_KEY);
+}
+
+void processCluster::lock(){
+
+	if(lockDepth++ > 0){
+		return;
+	}
+
+	// The lock holds its holder's pid, so a process that exits while holding it (and would leave everyone else waiting
+	// forever) can be spotted. Changes are short, so that's only checked every so often
+	uint32_t holder = 0;
+	unsigned int waits = 0;
+	bool takenOver = false;
+	while(!shared->lock.compare_exchange_weak(holder, lockID, std::memory_order_acquire, std::memory_order_relaxed)){
+		if(holder == 0){  // Spurious failure
+			continue;
+		}
+		if(++waits % CLUSTER_LOCK_CHECK == 0 && holderGone(holder)
+		   && shared->lock.compare_exchange_strong(holder, lockID, std::memory_order_acquire, std::memory_order_relaxed)){
+			printf("A server process exited while changing the lobby, carrying on without it.\n");
+			takenOver = true;
+			break;
+		}
+		std::this_thread::yield();
+		holder = 0;
+	}
+
+	// The sequence number is already odd if the lock was taken over from the middle of a change
+	uint32_t sequence = shared->sequence.load(std::memory_order_relaxed);
+	if((sequence & 1) == 0){
+		shared->sequence.store(sequence + 1, std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	if(takenOver){  // Whatever was being changed may be half done, so everyone copies the lobby out again
+		shared->recordsVersion++;
+		shared->slotsVersion++;
+		shared->chatVersion++;
+	}
+
+}
+
+void processCluster::unlock(){
+
+	if(--lockDepth > 0){
+		return;
+	}
+	shared->sequence.store(shared->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	shared->lock.store(0, std::memory_order_release);
+
+}
+
+bool processCluster::holderGone(uint32_t holder){
+
+	#ifdef POLLER_HAS_EPOLL
+		// An exited process is kept as a zombie until the first process reaps it, which it has to do itself if it's the one waiting
+		if(processIndex == 0){
+			for(unsigned int p = 1; p < pids.size(); p++){
+				int status;
+				if(pids[p] == holder && waitpid(holder, &status, WNOHANG) == (pid_t)holder){
+					pids[p] = 0;
+					exited.push_back(p);
+					pendingWakes |= 1;  // So it's cleaned up after on the next pass
+					return true;
+				}
+			}
+		}
+		return kill(holder, 0) == -1 && errno == ESRCH;
+	#else
+		(void)holder;
+		return false;
+	#endif
+
+}
+
+uint32_t processCluster::readBegin(){
+
+	if(lockDepth > 0){  // Nothing can change while this process holds the lock
+		return 0;
+	}
+	unsigned int waits = 0;
+	while(true){
+		uint32_t sequence = shared->sequence.load(std::memory_order_acquire);
+		if((sequence & 1) == 0){
+			return sequence;
+		}
+		uint32_t holder = shared->lock.load(std::memory_order_relaxed);
+		if(++waits % CLUSTER_LOCK_CHECK == 0 && holder != 0 && holderGone(holder)){  // The change will never be finished, so take the lock over to end it
+			lock();
+			unlock();
+		}
+		std::this_thread::yield();
+	}
+
+}
+
+bool processCluster::readRetry(uint32_t sequence) const{
+	if(lockDepth > 0){
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return shared->sequence.load(std::memory_order_relaxed) != sequence;
+}
+
+unsigned int processCluster::allocateID(){
+	if(shared->freeIDCount == 0){
+		return 0;
+	}
+	unsigned int playerID = shared->freeIDs[--shared->freeIDCount];
+	shared->records[playerID - 1].length = 0;  // Not shown in the lobby until they've registered
+	shared->records[playerID - 1].owner = processIndex;
+	shared->records[playerID - 1].used = 1;
+	return playerID;
+}
+
+void processCluster::releaseID(unsigned int playerID){
+	if(shared->records[playerID - 1].length != 0){
+		shared->records[playerID - 1].length = 0;
+		shared->recordsVersion++;
+	}
+	shared->records[playerID - 1].used = 0;
+	shared->freeIDs[shared->freeIDCount++] = playerID;
+}
+
+bool processCluster::publishRecord(unsigned int playerID, const std::string &record){
+
+	if(record.length() + 1 > CLUSTER_RECORD_SIZE){
+		return false;
+	}
+	sharedRecord &shareRecord = shared->records[playerID - 1];
+	memcpy(shareRecord.data, record.c_str(), record.length() + 1);
+	shareRecord.length = record.length() + 1;
+	shareRecord.owner = processIndex;
+	shared->recordsVersion++;
+	return true;
+
+}
+
+void processCluster::storeChat(std::string_view message){
+
+	// Once 20 messages are stored, the oldest is overwritten
+	unsigned int chatSlot;
+	if(shared->chatCount < 20){
+		chatSlot = (shared->firstChat + shared->chatCount) % 20;
+		shared->chatCount++;
+	}else{
+		chatSlot = shared->firstChat;
+		shared->firstChat = (shared->firstChat + 1) % 20;
+	}
+
+	unsigned int length = message.length() < CLUSTER_CHAT_SIZE ? message.length() : CLUSTER_CHAT_SIZE - 1;
+	memcpy(shared->chat[chatSlot].data, message.data(), length);
+	shared->chat[chatSlot].data[length] = '\0';
+	shared->chat[chatSlot].length = length + 1;
+	shared->chatVersion++;
+
+}
+
+unsigned int processCluster::owner(unsigned int playerID) const{
+	return shared->records[playerID - 1].owner;
+}
+
+bool processCluster::post(unsigned int process, uint32_t type, uint32_t playerID, const char *data, unsigned int length, uint32_t coalesceKey, uint32_t raceID, uint32_t raceMap){
+
+	if(length > CLUSTER_CHAT_SIZE){
+		return false;
+	}
+	if(goneProcesses & (1 << process)){  // No one will ever read it
+		return true;
+	}
+
+	// Losing a lobby change would leave the other process's lobby out of step for good, and losing a MIGRATE or
+	// MIGRATE_FAILED would leave a race waiting for someone who never arrives, so they wait for room instead
+	if(heldPosts[process].empty() && tryPost(process, type, playerID, data, length, coalesceKey, raceID, raceMap)){
+		return true;
+	}
+	heldPost held;
+	held.type = type;
+	held.playerID = playerID;
+	held.raceID = raceID;
+	held.raceMap = raceMap;
+	held.coalesceKey = coalesceKey;
+	held.data.assign(data != NULL ? data : "", length);
+	heldPosts[process].push_back(std::move(held));
+	heldBack++;
+	return true;
+
+}
+
+bool processCluster::tryPost(unsigned int process, uint32_t type, uint32_t playerID, const char *data, unsigned int length, uint32_t coalesceKey, uint32_t raceID, uint32_t raceMap){
+
+	// Claim the next free cell. A cell is free once its sequence number has caught up with the position being claimed
+	clusterRing &ring = rings[process];
+	clusterMessage *cell;
+	uint32_t position = ring.head.load(std::memory_order_relaxed);
+	while(true){
+		cell = &ring.cells[position & (CLUSTER_RING_SIZE - 1)];
+		int32_t ahead = (int32_t)(cell->sequence.load(std::memory_order_acquire) - position);
+		if(ahead == 0){
+			if(ring.head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+				break;
+			}
+		}else if(ahead < 0){  // The process hasn't read the message last written here yet, so the ring is full
+			return false;
+		}else{  // Another process claimed it first
+			position = ring.head.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->type = type;
+	cell->from = processIndex;
+	cell->playerID = playerID;
+	cell->raceID = raceID;
+	cell->raceMap = raceMap;
+	cell->coalesceKey = coalesceKey;
+	cell->length = length;
+	if(length > 0){
+		memcpy(cell->data, data, length);
+	}
+	cell->sequence.store(position + 1, std::memory_order_release);  // Hands the cell to the reader
+
+	pendingWakes |= 1 << process;
+	return true;
+
+}
+
+bool processCluster::postOthers(uint32_t type, uint32_t playerID, const char *data, unsigned int length, uint32_t coalesceKey){
+	bool posted = true;
+	for(unsigned int p = 0; p < processCount; p++){
+		if(p != processIndex && !post(p, type, playerID, data, length, coalesceKey)){
+			posted = false;
+		}
+	}
+	return posted;
+}
+
+void processCluster::wakeProcesses(){
+
+	for(unsigned int p = 0; p < heldPosts.size(); p++){
+		std::vector<heldPost> &held = heldPosts[p];
+		unsigned int posted = 0;
+		while(posted < held.size() && tryPost(p, held[posted].type, held[posted].playerID, held[posted].data.data(), held[posted].data.length(),
+											 held[posted].coalesceKey, held[posted].raceID, held[posted].raceMap)){
+			posted++;
+		}
+		held.erase(held.begin(), held.begin() + posted);
+	}
+
+	#ifdef POLLER_HAS_EPOLL
+		for(unsigned int p = 0; pendingWakes != 0; p++){
+			if(pendingWakes & (1 << p)){
+				uint64_t one = 1;
+				if(write(wakeFDs[p], &one, sizeof(one)) == -1 && errno != EAGAIN){
+					printf("Unable to wake up server process %i: %i\n", p, errno);
+				}
+				pendingWakes &= ~(1 << p);
+			}
+		}
+	#endif
+
+}
+
+int processCluster::retryTimeout() const{
+	for(unsigned int p = 0; p < heldPosts.size(); p++){
+		if(!heldPosts[p].empty()){
+			return CLUSTER_RETRY_TIMEOUT;
+		}
+	}
+	return -1;
+}
+
+void processCluster::forget(unsigned int process){
+	goneProcesses |= 1 << process;
+	heldPosts[process].clear();
+}
+
+bool processCluster::reapProcesses(){
+
+	#ifdef POLLER_HAS_EPOLL
+		if(childExited){
+			childExited = 0;
+			int status;
+			pid_t child;
+			while((child = waitpid(-1, &status, WNOHANG)) > 0){
+				for(unsigned int p = 1; p < pids.size(); p++){
+					if(pids[p] == (uint32_t)child){
+						pids[p] = 0;
+						exited.push_back(p);
+					}
+				}
+			}
+		}
+	#endif
+	return !exited.empty();
+
+}
+
+void processCluster::clearWakeup(){
+	#ifdef POLLER_HAS_EPOLL
+		uint64_t wakeups;
+		while(read(wakeFDs[processIndex], &wakeups, sizeof(wakeups)) > 0);
+	#endif
+}
+
+bool processCluster::next(clusterMessage *&message){
+
+	clusterRing &ring = rings[processIndex];
+	clusterMessage *cell = &ring.cells[ring.tail & (CLUSTER_RING_SIZE - 1)];
+	if(cell->sequence.load(std::memory_order_acquire) != ring.tail + 1){  // Nothing has been written here yet
+		return false;
+	}
+	message = cell;
+	return true;
+
+}
+
+void processCluster::pop(){
+	clusterRing &ring = rings[processIndex];
+	ring.cells[ring.tail & (CLUSTER_RING_SIZE - 1)].sequence.store(ring.tail + CLUSTER_RING_SIZE, std::memory_order_release);  // Free for the next lap
+	ring.tail++;
+}
+
+bool processCluster::sendConnection(unsigned int process, SOCKET socket, const std::string &data){
+
+	#ifdef POLLER_HAS_EPOLL
+
+		iovec buffer;
+		buffer.iov_base = (void *)data.data();
+		buffer.iov_len = data.length();
+
+		// The socket goes along as ancillary data, the kernel gives the other process its own descriptor for it
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &buffer;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr *rights = CMSG_FIRSTHDR(&message);
+		rights->cmsg_level = SOL_SOCKET;
+		rights->cmsg_type = SCM_RIGHTS;
+		rights->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(rights), &socket, sizeof(int));
+
+		if(sendmsg(migrationFDs[processCount + process], &message, MSG_NOSIGNAL) == -1){
+			printf("Unable to send socket #%i to server process %i: %i\n", socket, process, errno);
+			return false;
+		}
+		return true;
+
+	#else
+		(void)process; (void)socket; (void)data;
+		return false;
+	#endif
+
+}
+
+SOCKET processCluster::receiveConnection(){
+
+	#ifdef POLLER_HAS_EPOLL
+
+		while(true){
+
+			migration.resize(CLUSTER_MIGRATION_SIZE);
+			iovec buffer;
+			buffer.iov_base = &migration[0];
+			buffer.iov_len = migration.size();
+
+			char control[CMSG_SPACE(sizeof(int))];
+			msghdr message;
+			memset(&message, 0, sizeof(message));
+			message.msg_iov = &buffer;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+
+			ssize_t received = recvmsg(migrationFDs[processIndex], &message, MSG_CMSG_CLOEXEC);
+			if(received == -1){
+				if(errno != EAGAIN){
+					printf("recvmsg() has failed: %i\n", errno);
+				}
+				return INVALID_SOCKET;
+			}
+			migration.resize(received);
+
+			cmsghdr *rights = CMSG_FIRSTHDR(&message);
+			if(rights != NULL && rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS){
+				SOCKET socket;
+				memcpy(&socket, CMSG_DATA(rights), sizeof(int));
+				return socket;
+			}
+
+		}
+
+	#else
+		return INVALID_SOCKET;
+	#endif
+
+}
@@ -0,0 +1,198 @@
+#ifndef PROCESSCLUSTER_H
+#define PROCESSCLUSTER_H
+
+#include "platform.hpp"
+#include "eventPoller.hpp"
+#include "lobbySlotHandler.hpp"
+#include "receiveBuffer.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define CLUSTER_MAX_PROCESSES 16
+#define CLUSTER_MAX_PLAYERS 16384  // Player IDs are shared between the processes, so this is the most players the cluster can hold
+#define CLUSTER_RECORD_SIZE 192  // Longest 'p' record a player can have (including the terminator), records are under 100 bytes in practice
+#define CLUSTER_CHAT_SIZE (RECEIVE_BUFFER_SIZE + 64)  // A whole message plus the ID and name inserted in front of it
+#define CLUSTER_RING_SIZE 512  // Messages each process's inbox can hold, must be a power of 2
+#define CLUSTER_MIGRATION_SIZE 65536  // Largest migration datagram (player data plus their unread and unsent bytes)
+#define CLUSTER_RETRY_TIMEOUT 1  // Milliseconds to wait before posting again to an inbox that was full
+#define CLUSTER_LOCK_CHECK 1024  // Waits for the lock between checks on whether its holder is still running
+
+#define CLUSTER_INBOX_KEY 0xFFFFFFFFFFFFFFFCULL  // Poller key of this process's cluster inbox wakeup descriptor
+#define CLUSTER_MIGRATION_KEY 0xFFFFFFFFFFFFFFFBULL  // Poller key of the socket migrated connections arrive on
+
+// A player's 'p' message as the rest of the cluster sees it
+struct sharedRecord{
+	uint32_t length;  // Including the terminator, 0 if the ID isn't in use
+	uint8_t owner;  // Process the player is connected to
+	uint8_t used;  // Whether the ID has been given out
+	char data[CLUSTER_RECORD_SIZE];
+};
+
+struct sharedChat{
+	uint32_t length;  // Including the terminator
+	char data[CLUSTER_CHAT_SIZE];
+};
+
+// Everything the lobby shows, kept in memory shared by every process. Changes are made while holding the spinlock, and bump
+// the sequence number once before and once after, so the lobby snapshot can be copied out without taking the lock (a seqlock)
+struct sharedLobby{
+
+	std::atomic<uint32_t> lock;  // pid of the process holding it, 0 if it's free
+	std::atomic<uint32_t> sequence;  // Odd while a change is being made
+	uint32_t recordsVersion;  // Bumped by every change to each part, so processes know when to rebuild their snapshot
+	uint32_t slotsVersion;
+	uint32_t chatVersion;
+
+	lobbySlotHandler lobbyMaps[8];
+	sharedChat chat[20];  // Last 20 chat messages, oldest first starting at firstChat
+	uint32_t firstChat;
+	uint32_t chatCount;
+
+	uint32_t freeIDCount;
+	uint32_t freeIDs[CLUSTER_MAX_PLAYERS];  // Stack of unused player IDs, lowest on top
+	sharedRecord records[CLUSTER_MAX_PLAYERS];  // Indexed by player ID - 1
+
+	sharedLobby();
+
+};
+
+// Something one process asks another to do
+struct clusterMessage{
+
+	enum messageType{
+		LOBBY,           // Queue the data for everyone in the lobby
+		CHAT,            // Like LOBBY, but it's chat (see socketServer::queueChatMessage())
+		REGISTERED,      // Queue the data for every registered player except playerID
+		MIGRATE,         // A race has started on the sender with playerID in it, send them over
+		MIGRATE_FAILED,  // playerID couldn't be sent over, so the race has to go on without them
+		PROCESS_EXITED   // Process playerID has exited (and its players are gone), so races go on without them
+	};
+
+	std::atomic<uint32_t> sequence;  // Position in the ring the cell can next be written (or read) at
+	uint32_t type;
+	uint32_t from;  // Process that posted the message
+	uint32_t playerID;
+	uint32_t raceID;
+	uint32_t raceMap;
+	uint32_t coalesceKey;
+	uint32_t length;  // Including the terminator
+	char data[CLUSTER_CHAT_SIZE];
+
+};
+
+// A message for a process whose inbox was full, kept by the sender until there's room
+struct heldPost{
+	uint32_t type;
+	uint32_t playerID;
+	uint32_t raceID;
+	uint32_t raceMap;
+	uint32_t coalesceKey;
+	std::string data;
+};
+
+// A MIGRATE message, kept until the end of the pass
+struct migrationRequest{
+	uint32_t from;
+	uint32_t playerID;
+	uint32_t raceID;
+	uint32_t raceMap;
+};
+
+// Sent along with a migrated racer's socket, followed by their name, the bytes they'd sent that weren't a whole message yet
+// and the bytes that were still waiting to be sent to them
+struct migrationHeader{
+	uint32_t playerID;
+	uint32_t raceID;
+	uint32_t raceMap;
+	uint32_t raceSlot;
+	float rank;
+	uint32_t headNum;
+	uint32_t bodyNum;
+	uint32_t footNum;
+	uint32_t speedPoints;
+	uint32_t jumpPoints;
+	uint32_t tractionPoints;
+	uint32_t userLength;
+	uint32_t incomingLength;
+	uint32_t outgoingLength;
+};
+
+// Bounded many-producer, single-consumer queue of messages for one process (Vyukov's ring). Posting claims a cell by
+// bumping head, so processes never wait on each other, and a full ring is reported instead of waited on
+struct clusterRing{
+	std::atomic<uint32_t> head;
+	char headPadding[60];  // Keeps the consumer's tail off the cache line the producers fight over
+	uint32_t tail;
+	clusterMessage cells[CLUSTER_RING_SIZE];
+};
+
+// Several server processes sharing one port (SO_REUSEPORT) and one lobby. Each process accepts its own connections and
+// relays its own races, everything lobby players can see lives in a shared segment, and broadcasts reach the players on
+// the other processes through each process's ring. Races stay on the process that started them, so racers connected to
+// another process have their socket sent over (SCM_RIGHTS) along with their player data and buffers. Linux only
+struct processCluster{
+
+	unsigned int processCount;  // 1 if the server isn't clustered
+	unsigned int processIndex;  // 0 is the process that was started, the rest were forked from it
+	sharedLobby *shared;  // NULL if the server isn't clustered
+	clusterRing *rings;  // One for each process
+	size_t segmentSize;
+	std::vector<int> wakeFDs;  // eventfd for each process's ring
+	std::vector<int> migrationFDs;  // Receiving end of each process's migration socket, then the sending end
+	uint32_t pendingWakes;  // Processes that have been posted to since they were last woken up
+	std::vector<std::vector<heldPost> > heldPosts;  // For each process, what didn't fit in its inbox, oldest first
+	uint64_t heldBack;  // Messages that have had to wait for room, for the metrics
+	unsigned int lockDepth;  // The lock can be taken again by the process holding it
+	uint32_t lockID;  // This process's pid, which the lock holds while it's taken
+	std::vector<uint32_t> pids;  // Each process's pid, only known to the first process (which forked the rest)
+	std::vector<unsigned int> exited;  // Processes that have exited but haven't been cleaned up after yet, first process only
+	uint32_t goneProcesses;  // Processes known to have exited, which aren't posted to any more
+	std::string migration;  // Received datagram
+
+	processCluster();
+	~processCluster();
+
+	bool active() const{ return shared != NULL; }
+	bool start(unsigned int count);  // Sets up the shared segment and forks the other processes, returns false if it couldn't
+	bool watch(eventPoller &poller);  // Starts watching this process's ring and migration socket
+
+	void lock();  // Takes the lock over if the process holding it has exited
+	void unlock();
+	bool holderGone(uint32_t holder);
+	uint32_t readBegin();  // Copy what's needed between readBegin() and readRetry(), then try again if readRetry() is true
+	bool readRetry(uint32_t sequence) const;
+
+	// Must hold the lock
+	unsigned int allocateID();  // 0 if the cluster is full
+	void releaseID(unsigned int playerID);
+	bool publishRecord(unsigned int playerID, const std::string &record);  // Returns false if the record is too long to share
+	void storeChat(std::string_view message);
+	unsigned int owner(unsigned int playerID) const;
+
+	// Messages are never dropped: if a process's inbox is full, they're kept until it has made room (and so is anything
+	// posted to it after them, so they arrive in order). Only returns false if the data is too long to post at all
+	bool post(unsigned int process, uint32_t type, uint32_t playerID, const char *data = NULL, unsigned int length = 0, uint32_t coalesceKey = 0, uint32_t raceID = 0, uint32_t raceMap = 0);
+	bool postOthers(uint32_t type, uint32_t playerID, const char *data, unsigned int length, uint32_t coalesceKey = 0);  // Posts to every other process
+	bool tryPost(unsigned int process, uint32_t type, uint32_t playerID, const char *data, unsigned int length, uint32_t coalesceKey, uint32_t raceID, uint32_t raceMap);  // False if the inbox is full
+	void wakeProcesses();  // Posts what was held back if there's room now and wakes up everyone posted to, called once at the end of each pass
+	int retryTimeout() const;  // Poller timeout for posting held back messages again, -1 if there aren't any
+	void forget(unsigned int process);  // Drops what was held back for a process that has exited
+	bool reapProcesses();  // First process only: collects the processes that have exited into exited, returns true if there are any
+	void clearWakeup();  // Called before reading the ring, so anything posted afterwards wakes the process up again
+	bool next(clusterMessage *&message);  // The next message in this process's ring, which stays valid until pop()
+	void pop();
+
+	bool sendConnection(unsigned int process, SOCKET socket, const std::string &data);
+	SOCKET receiveConnection();  // Reads the data sent along with the socket into migration. INVALID_SOCKET once there's nothing left
+
+};
+
+// Holds the cluster's lock (if it's active) until it goes out of scope
+struct clusterLock{
+	processCluster &cluster;
+	clusterLock(processCluster &lockedCluster) : cluster(lockedCluster){ if(cluster.active()){ cluster.lock(); } }
+	~clusterLock(){ if(cluster.active()){ cluster.unlock(); } }
+};
+
+#endif
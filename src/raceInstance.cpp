@@ -8,6 +8,8 @@ raceInstance::raceInstance(){
 	playerIDs[3] = 0;
 	totalPlayers = 0;
 	playersFinished = 0;
+	worker = 0;
+	nextFree = 0;
 }
 
 float raceInstance::calculateRank(unsigned int racerID, unsigned int raceMap){
@@ -7,6 +7,8 @@ struct raceInstance{
 	unsigned int playerIDs[4];
 	unsigned int totalPlayers;
 	unsigned int playersFinished;
+	unsigned int worker;  // Race worker relaying the race's input (0 if it's relayed by the lobby thread)
+	unsigned int nextFree;  // ID of the next empty race in the racePool, while this one is empty
 
 	raceInstance();
 
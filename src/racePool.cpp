@@ -0,0 +1,58 @@
+#include "racePool.hpp"
+
+racePool::racePool(){
+	firstFree = NO_RACE;
+	activeRaces = 0;
+}
+
+void racePool::reserve(unsigned int capacity){
+
+	if(capacity <= races.size()){
+		return;
+	}
+
+	// Add the new races to the free list backwards, so the lowest IDs are handed out first
+	unsigned int oldSize = races.size();
+	races.resize(capacity);
+	for(unsigned int d = capacity; d > oldSize; d--){
+		races[d - 1].nextFree = firstFree;
+		firstFree = d;
+	}
+
+}
+
+unsigned int racePool::allocate(const raceInstance &newRace){
+
+	if(firstFree == NO_RACE){  // Every race is in use, so double the table
+		reserve(races.empty() ? DEFAULT_RACE_CAPACITY : races.size() * 2);
+	}
+
+	unsigned int raceID = firstFree;
+	firstFree = races[raceID - 1].nextFree;
+	races[raceID - 1] = newRace;
+	races[raceID - 1].raceEmpty = false;
+	activeRaces++;
+	return raceID;
+
+}
+
+void racePool::release(unsigned int raceID){
+
+	if(races.at(raceID - 1).raceEmpty){  // Already released
+		return;
+	}
+
+	races[raceID - 1] = raceInstance();
+	races[raceID - 1].nextFree = firstFree;
+	firstFree = raceID;
+	activeRaces--;
+
+}
+
+raceInstance &racePool::at(unsigned int raceID){
+	return races.at(raceID - 1);
+}
+
+unsigned int racePool::size() const{
+	return activeRaces;
+}
@@ -0,0 +1,29 @@
+#ifndef RACEPOOL_H
+#define RACEPOOL_H
+
+#include "raceInstance.hpp"
+#include <vector>
+
+#define DEFAULT_RACE_CAPACITY 64
+
+// Every race the server has used, indexed by roomID - 1. Empty races are kept in a free list threaded through the
+// races themselves, so starting and finishing a race are both O(1) and a race's ID stays the same for as long as it runs
+struct racePool{
+
+	static const unsigned int NO_RACE = 0;
+
+	std::vector<raceInstance> races;
+	unsigned int firstFree;  // ID of the most recently emptied race (NO_RACE if every race is in use)
+	unsigned int activeRaces;
+
+	racePool();
+
+	void reserve(unsigned int capacity);  // Makes sure at least this many races exist without growing the table
+	unsigned int allocate(const raceInstance &newRace);  // Returns the new race's ID, only grows the table if every race is in use
+	void release(unsigned int raceID);
+	raceInstance &at(unsigned int raceID);
+	unsigned int size() const;  // Races in use
+
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "raceTicker.hpp"
+
+raceTicker::raceTicker(){
+	interval = std::chrono::steady_clock::duration::zero();
+	epoch = std::chrono::steady_clock::now();
+	nextTick = epoch;
+}
+
+void raceTicker::setRate(unsigned int ticksPerSecond){
+	if(ticksPerSecond == 0){
+		interval = std::chrono::steady_clock::duration::zero();
+	}else{
+		interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / ticksPerSecond;
+	}
+}
+
+void raceTicker::schedule(unsigned int raceID){
+
+	if(raceID >= scheduled.size()){
+		scheduled.resize(raceID + 1, false);
+	}
+	if(scheduled[raceID]){
+		return;
+	}
+	scheduled[raceID] = true;
+
+	if(pendingRaces.empty()){  // Nothing was waiting, so work out which tick this is for
+		std::chrono::steady_clock::duration sinceEpoch = std::chrono::steady_clock::now() - epoch;
+		nextTick = epoch + (sinceEpoch / interval + 1) * interval;
+	}
+	pendingRaces.push_back(raceID);
+
+}
+
+int raceTicker::timeout() const{
+
+	if(pendingRaces.empty()){
+		return -1;
+	}
+	std::chrono::steady_clock::duration remaining = nextTick - std::chrono::steady_clock::now();
+	if(remaining <= std::chrono::steady_clock::duration::zero()){
+		return 0;
+	}
+	return (int)std::chrono::ceil<std::chrono::milliseconds>(remaining).count();  // Rounded up, so the poller never wakes up just before the tick
+
+}
+
+bool raceTicker::due() const{
+	return !pendingRaces.empty() && std::chrono::steady_clock::now() >= nextTick;
+}
+
+void raceTicker::take(std::vector<unsigned int> &races){
+	races.clear();
+	races.swap(pendingRaces);
+	for(unsigned int d = 0; d < races.size(); d++){
+		scheduled[races[d]] = false;
+	}
+}
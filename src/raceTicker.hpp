@@ -0,0 +1,29 @@
+#ifndef RACETICKER_H
+#define RACETICKER_H
+
+#include <chrono>
+#include <vector>
+
+// Tick mode for race relays. Batched race input is queued for each racer without flushing it, and the race is
+// scheduled here. Once per tick every scheduled race's queues are flushed together, so each racer gets one write
+// per tick instead of one per message. Ticks are on a fixed grid, so a message waits half a tick on average
+struct raceTicker{
+
+	std::chrono::steady_clock::duration interval;  // Zero if tick mode is off
+	std::chrono::steady_clock::time_point epoch;  // Ticks are at epoch + a multiple of interval
+	std::chrono::steady_clock::time_point nextTick;
+	std::vector<unsigned int> pendingRaces;  // Races with batched messages waiting for the next tick
+	std::vector<bool> scheduled;  // Indexed by raceID, so a race is only added to pendingRaces once
+
+	raceTicker();
+
+	void setRate(unsigned int ticksPerSecond);  // 0 turns tick mode off
+	bool enabled() const{ return interval.count() != 0; }
+	void schedule(unsigned int raceID);
+	int timeout() const;  // Milliseconds until the next tick, for the poller (-1 if nothing is waiting)
+	bool due() const;  // Whether there are races to flush and their tick has come
+	void take(std::vector<unsigned int> &races);  // Swaps the scheduled races into races
+
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include "raceWorker.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef POLLER_HAS_EPOLL
+	#include <sys/eventfd.h>
+	#include <errno.h>
+#endif
+
+workerCommand::workerCommand(){
+	type = SEND;
+	worker = 0;
+	handle.index = 0;
+	handle.generation = 0;
+	socket = INVALID_SOCKET;
+	raceID = 0;
+	playerID = 0;
+	coalesceKey = 0;
+}
+
+commandInbox::commandInbox(){
+	wakeFD = -1;
+}
+
+commandInbox::~commandInbox(){
+	#ifdef POLLER_HAS_EPOLL
+		if(wakeFD != -1){
+			close(wakeFD);
+		}
+	#endif
+}
+
+bool commandInbox::init(){
+	#ifdef POLLER_HAS_EPOLL
+		wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(wakeFD == -1){
+			printf("eventfd() has failed: %i\n", errno);
+			return false;
+		}
+		return true;
+	#else
+		return false;
+	#endif
+}
+
+void commandInbox::post(std::vector<workerCommand> &newCommands){
+
+	if(newCommands.empty()){
+		return;
+	}
+
+	bool wasEmpty;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		wasEmpty = commands.empty();
+		for(unsigned int d = 0; d < newCommands.size(); d++){
+			commands.push_back(std::move(newCommands[d]));
+		}
+	}
+	newCommands.clear();
+
+	// If the inbox already had commands in it, the thread hasn't taken them yet and has a wakeup pending
+	#ifdef POLLER_HAS_EPOLL
+		if(wasEmpty){
+			uint64_t one = 1;
+			if(write(wakeFD, &one, sizeof(one)) == -1 && errno != EAGAIN){
+				printf("Unable to wake up a thread: %i\n", errno);
+			}
+		}
+	#else
+		(void)wasEmpty;
+	#endif
+
+}
+
+void commandInbox::take(std::vector<workerCommand> &received){
+
+	#ifdef POLLER_HAS_EPOLL
+		uint64_t wakeups;
+		while(read(wakeFD, &wakeups, sizeof(wakeups)) > 0);  // Reset the eventfd before taking the commands, so later posts wake the thread up again
+	#endif
+
+	received.clear();
+	std::lock_guard<std::mutex> guard(lock);
+	received.swap(commands);
+
+}
+
+raceWorker::raceWorker(){
+	workerID = 0;
+	lobbyInbox = NULL;
+	metrics = NULL;
+	tickBypass = true;
+	idleTimeout = 0;
+	running = false;
+}
+
+raceWorker::~raceWorker(){
+	stop();
+}
+
+bool raceWorker::start(unsigned int id, commandInbox *lobby, serverMetrics *serverMetrics){
+
+	workerID = id;
+	lobbyInbox = lobby;
+	metrics = serverMetrics;
+	idleTimers.init(1000);
+
+	if(!inbox.init() || !poller.init(eventPoller::BACKEND_EPOLL) || !poller.edgeTriggered() || !poller.addSocket(inbox.wakeFD, INBOX_KEY)){
+		return false;
+	}
+
+	running = true;
+	thread = std::thread(&raceWorker::run, this);
+	return true;
+
+}
+
+void raceWorker::stop(){
+
+	if(!thread.joinable()){
+		return;
+	}
+
+	std::vector<workerCommand> shutdown(1);
+	shutdown[0].type = workerCommand::SHUTDOWN;
+	inbox.post(shutdown);
+	thread.join();
+
+	for(unsigned int d = 0; d < racers.size(); d++){
+		closesocket(racers.at(d).socket);
+	}
+
+}
+
+void raceWorker::run(){
+
+	while(running){
+
+		if(poller.wait(readySockets, earlierTimeout(ticker.timeout(), idleTimers.timeout())) == SOCKET_ERROR){
+			printf("epoll_wait() has failed on race worker %i: %i\n", workerID, lastSocketError());
+			continue;
+		}
+		if(idleTimeout != 0){
+			checkIdleTimers();
+		}
+
+		for(unsigned int d = 0; d < readySockets.size(); d++){
+
+			if(readySockets[d].key == INBOX_KEY){
+				handleCommands();
+				continue;
+			}
+
+			slotHandle racer = slotHandle::unpack(readySockets[d].key);
+			workerConnection *readyRacer = racers.get(racer);
+			if(readyRacer == NULL){  // Handed back or disconnected earlier in this pass
+				continue;
+			}
+
+			if(readySockets[d].writable && !readyRacer->buffers->outgoing.empty() && !readyRacer->buffers->outgoing.flushScheduled){
+				readyRacer->buffers->outgoing.flushScheduled = true;
+				pendingSends.push_back(racer);
+			}
+			if(readySockets[d].readable){
+				receiveData(racer);
+			}
+
+		}
+
+		if(ticker.due()){
+			flushRaceTicks();
+		}
+		flushSendQueues();
+		lobbyInbox->post(lobbyOutbox);
+
+	}
+
+}
+
+void raceWorker::handleCommands(){
+
+	inbox.take(receivedCommands);
+
+	for(unsigned int d = 0; d < receivedCommands.size(); d++){
+
+		workerCommand &command = receivedCommands[d];
+		switch(command.type){
+
+			case workerCommand::ADOPT:
+				adopt(command);
+			break;
+
+			case workerCommand::SEND:
+				queueMessage(command.handle, command.message, command.coalesceKey);
+			break;
+
+			case workerCommand::RACE_MEMBERS:
+				if(command.members.empty()){
+					raceMembers.erase(command.raceID);
+				}else{
+					raceMembers[command.raceID].swap(command.members);
+				}
+			break;
+
+			case workerCommand::DROP:{
+				std::unordered_map<uint64_t, slotHandle>::iterator found = racerHandles.find(command.handle.pack());
+				if(found != racerHandles.end()){
+					slotHandle racer = found->second;
+					poller.removeSocket(racers.get(racer)->socket);
+					closesocket(racers.get(racer)->socket);
+					racers.erase(racer);
+					racerHandles.erase(found);
+				}
+			}break;
+
+			case workerCommand::SHUTDOWN:
+				running = false;
+			break;
+
+			default:
+			break;
+
+		}
+
+	}
+
+}
+
+void raceWorker::adopt(workerCommand &command){
+
+	workerConnection newRacer;
+	newRacer.socket = command.socket;
+	newRacer.handle = command.handle;
+	newRacer.playerID = command.playerID;
+	newRacer.raceID = command.raceID;
+	newRacer.buffers = std::move(command.buffers);
+	newRacer.lastActive = idleTimers.currentTick;
+
+	slotHandle racer = racers.insert(std::move(newRacer));
+	if(idleTimeout != 0){
+		idleTimers.schedule(racer.pack(), idleTimers.currentTick + idleTimeout);
+	}
+	racerHandles[command.handle.pack()] = racer;
+	raceMembers[command.raceID].swap(command.members);
+
+	if(!poller.addSocket(command.socket, racer.pack())){
+		release(racer, workerCommand::RETURN);  // The lobby thread can keep handling them instead
+		return;
+	}
+
+	// Send anything the lobby thread didn't get to, and relay anything it received but didn't handle
+	workerConnection &adopted = *racers.get(racer);
+	if(!adopted.buffers->outgoing.empty()){
+		adopted.buffers->outgoing.flushScheduled = true;
+		pendingSends.push_back(racer);
+	}
+	handleMessages(racer);
+
+}
+
+void raceWorker::receiveData(slotHandle racer){
+
+	while(true){
+
+		workerConnection *receiver = racers.get(racer);
+		receiveBuffer &incoming = receiver->buffers->incoming;
+
+		unsigned int freeBytes = incoming.prepareWrite();
+		if(freeBytes == 0){  // Too long to be race input, so let the lobby thread deal with it
+			release(racer, workerCommand::RETURN);
+			return;
+		}
+
+		int recvBytes = recv(receiver->socket, incoming.writePointer(), freeBytes, 0);
+		if(recvBytes == -1){
+			if(socketWouldBlock(lastSocketError())){  // Everything has been read
+				return;
+			}
+			release(racer, workerCommand::DISCONNECTED);
+			return;
+		}else if(recvBytes == 0){
+			release(racer, workerCommand::DISCONNECTED);
+			return;
+		}
+
+		incoming.commitWrite(recvBytes);
+		receiver->lastActive = idleTimers.currentTick;
+		serverMetrics::add(metrics->bytesIn, recvBytes);
+		if(!handleMessages(racer)){
+			return;
+		}
+
+	}
+
+}
+
+bool raceWorker::handleMessages(slotHandle racer){
+
+	workerConnection &sender = *racers.get(racer);
+	std::string_view message;
+	while(sender.buffers->incoming.nextMessage(message)){
+
+		const char *lastBuffer = message.data();  // Null-terminated, so the second character can be checked even if the message is one character long
+		messageType type = serverMetrics::typeOf(lastBuffer);
+		if(type != MESSAGE_Q && type != MESSAGE_T && type != MESSAGE_K && type != MESSAGE_F && type != MESSAGE_A){  // Anything else is for the lobby thread (which counts it)
+			sender.buffers->incoming.putBack(message);
+			release(racer, workerCommand::RETURN);
+			return false;
+		}
+
+		metrics->messages[type].fetch_add(1, std::memory_order_relaxed);
+		uint64_t dispatchStart = metrics->timing ? metricsNow() : 0;
+		if(type != MESSAGE_A){  // Keepalives can just be dropped
+			bool batched = ticker.enabled() && (type == MESSAGE_Q || (!tickBypass && type != MESSAGE_F));
+			relay(sender, message.substr(1), type == MESSAGE_F, batched);
+		}
+		if(metrics->timing){
+			metrics->dispatchTime.record(metricsNow() - dispatchStart);
+		}
+
+	}
+	return true;
+
+}
+
+void raceWorker::relay(workerConnection &sender, std::string_view message, bool includeSender, bool batched){
+
+	std::unordered_map<unsigned int, std::vector<slotHandle> >::iterator race = raceMembers.find(sender.raceID);
+	if(race == raceMembers.end()){
+		return;
+	}
+
+	uint32_t coalesceKey = message[0] == 'q' ? sendQueue::coalesceKey('q', sender.playerID) : 0;  // Only a racer's latest position matters. Keyed by player ID, the same as the lobby's
+	const std::vector<slotHandle> &members = race->second;
+	for(unsigned int d = 0; d < members.size(); d++){
+		if(includeSender || members[d] != sender.handle){
+			queueMessage(members[d], message.data(), message.length() + 1, batched, coalesceKey);
+		}
+	}
+	if(batched){
+		ticker.schedule(sender.raceID);
+	}
+
+}
+
+void raceWorker::queueMessage(slotHandle recipient, const char *message, unsigned int length, bool batched, uint32_t coalesceKey){
+
+	std::unordered_map<uint64_t, slotHandle>::iterator found = racerHandles.find(recipient.pack());
+	if(found == racerHandles.end()){  // Not one of ours (anymore), so the lobby thread has to send it
+		workerCommand command;
+		command.type = workerCommand::SEND;
+		command.worker = workerID;
+		command.handle = recipient;
+		command.coalesceKey = coalesceKey;
+		command.message = sharedMessageRef::copy(message, length);
+		lobbyOutbox.push_back(std::move(command));
+		return;
+	}
+
+	workerConnection &racer = *racers.get(found->second);
+	racer.buffers->outgoing.push(message, length, coalesceKey);
+	if(!batched && !racer.buffers->outgoing.flushScheduled){
+		racer.buffers->outgoing.flushScheduled = true;
+		pendingSends.push_back(found->second);
+	}
+
+}
+
+void raceWorker::queueMessage(slotHandle recipient, const sharedMessageRef &message, uint32_t coalesceKey){
+
+	std::unordered_map<uint64_t, slotHandle>::iterator found = racerHandles.find(recipient.pack());
+	if(found == racerHandles.end()){  // Handed back since the lobby thread sent it, so it goes back the same way
+		workerCommand command;
+		command.type = workerCommand::SEND;
+		command.worker = workerID;
+		command.handle = recipient;
+		command.coalesceKey = coalesceKey;
+		command.message = message;
+		lobbyOutbox.push_back(std::move(command));
+		return;
+	}
+
+	workerConnection &racer = *racers.get(found->second);
+	racer.buffers->outgoing.push(message, coalesceKey);
+	if(!racer.buffers->outgoing.flushScheduled){
+		racer.buffers->outgoing.flushScheduled = true;
+		pendingSends.push_back(found->second);
+	}
+
+}
+
+void raceWorker::release(slotHandle racer, workerCommand::commandType reason){
+
+	workerConnection &released = *racers.get(racer);
+	poller.removeSocket(released.socket);
+
+	workerCommand command;
+	command.type = reason;
+	command.worker = workerID;
+	command.handle = released.handle;
+	command.socket = released.socket;
+	command.raceID = released.raceID;
+	if(reason == workerCommand::RETURN){
+		released.buffers->outgoing.flushScheduled = false;
+		command.buffers = std::move(released.buffers);
+	}
+	lobbyOutbox.push_back(std::move(command));
+
+	racerHandles.erase(released.handle.pack());
+	racers.erase(racer);
+
+}
+
+void raceWorker::flushSendQueues(){
+
+	// Releasing a racer only removes them, so nothing is added to pendingSends while it's looped through
+	for(unsigned int d = 0; d < pendingSends.size(); d++){
+
+		workerConnection *recipient = racers.get(pendingSends[d]);
+		if(recipient == NULL){
+			continue;
+		}
+
+		sendQueue &outgoing = recipient->buffers->outgoing;
+		outgoing.flushScheduled = false;
+		unsigned int queuedBytes = outgoing.queuedBytes;
+		bool sent = outgoing.flush(recipient->socket);
+		serverMetrics::add(metrics->bytesOut, queuedBytes - outgoing.queuedBytes);
+		if(!sent){
+			serverMetrics::add(metrics->sendFailures, 1);
+			release(pendingSends[d], workerCommand::DISCONNECTED);
+			continue;
+		}
+
+		sendQueue::backlogState backlog = outgoing.backlog(limits);
+		if(backlog != sendQueue::BACKLOG_OK){  // Fallen too far behind, the lobby thread closes the connection
+			serverMetrics::add(backlog == sendQueue::BACKLOG_TOO_BIG ? metrics->slowTooBig : metrics->slowTooOld, 1);
+			printf("Socket #%i has fallen too far behind in a race, closing connection.\n", recipient->socket);
+			release(pendingSends[d], workerCommand::DISCONNECTED);
+		}
+
+	}
+	pendingSends.clear();
+
+}
+
+void raceWorker::flushRaceTicks(){
+
+	ticker.take(tickedRaces);
+	for(unsigned int d = 0; d < tickedRaces.size(); d++){
+
+		std::unordered_map<unsigned int, std::vector<slotHandle> >::iterator race = raceMembers.find(tickedRaces[d]);
+		if(race == raceMembers.end()){  // The race has finished since
+			continue;
+		}
+
+		for(unsigned int r = 0; r < race->second.size(); r++){
+			std::unordered_map<uint64_t, slotHandle>::iterator found = racerHandles.find(race->second[r].pack());
+			if(found == racerHandles.end()){
+				continue;
+			}
+			sendQueue &outgoing = racers.get(found->second)->buffers->outgoing;
+			if(!outgoing.empty() && !outgoing.flushScheduled){
+				outgoing.flushScheduled = true;
+				pendingSends.push_back(found->second);
+			}
+		}
+
+	}
+
+}
+
+void raceWorker::checkIdleTimers(){
+
+	idleTimers.advance(expiredTimers);
+	for(unsigned int d = 0; d < expiredTimers.size(); d++){
+
+		slotHandle racer = slotHandle::unpack(expiredTimers[d]);
+		workerConnection *idleRacer = racers.get(racer);
+		if(idleRacer == NULL){  // Handed back or disconnected since the timer was set
+			continue;
+		}
+		if(idleRacer->lastActive + idleTimeout > idleTimers.currentTick){
+			idleTimers.schedule(expiredTimers[d], idleRacer->lastActive + idleTimeout);
+			continue;
+		}
+
+		serverMetrics::add(metrics->idleDisconnects, 1);
+		printf("Socket #%i hasn't sent anything in %u second(s) while racing, closing connection.\n", idleRacer->socket, idleTimeout);
+		release(racer, workerCommand::DISCONNECTED);
+
+	}
+
+}
@@ -0,0 +1,129 @@
+#ifndef RACEWORKER_H
+#define RACEWORKER_H
+
+#include "platform.hpp"
+#include "eventPoller.hpp"
+#include "slotMap.hpp"
+#include "receiveBuffer.hpp"
+#include "sendQueue.hpp"
+#include "metrics.hpp"
+#include "raceTicker.hpp"
+#include "timingWheel.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define INBOX_KEY 0xFFFFFFFFFFFFFFFEULL  // Poller key of an inbox's wakeup descriptor, which no packed slotHandle can match
+
+// A connection's buffers, handed over together with its socket when a worker takes it or gives it back
+struct connectionBuffers{
+	receiveBuffer incoming;
+	sendQueue outgoing;
+};
+
+// Something one thread asks another to do. Only the fields used by the command's type are filled in
+struct workerCommand{
+
+	enum commandType{
+		ADOPT,         // Lobby -> worker: start handling a racer's socket
+		SEND,          // Either way: queue data for a connection owned by the other thread
+		RACE_MEMBERS,  // Lobby -> worker: who is in a race now (an empty list means the race is over)
+		DROP,          // Lobby -> worker: the lobby has disconnected the racer, close their socket
+		SHUTDOWN,      // Lobby -> worker: stop the worker's loop
+		RETURN,        // Worker -> lobby: the racer sent something only the lobby can handle, so it gets their socket back
+		DISCONNECTED   // Worker -> lobby: the racer's connection has failed or closed
+	};
+
+	commandType type;
+	unsigned int worker;  // Worker that sent or should receive the command (1-based)
+	slotHandle handle;  // The connection's handle on the lobby thread
+	SOCKET socket;
+	unsigned int raceID;
+	unsigned int playerID;  // ADOPT
+	sharedMessageRef message;  // SEND, so a message for many recipients is only copied once
+	uint32_t coalesceKey;  // SEND
+	std::vector<slotHandle> members;  // ADOPT, RACE_MEMBERS
+	std::unique_ptr<connectionBuffers> buffers;  // ADOPT, RETURN
+
+	workerCommand();
+
+};
+
+// Commands waiting for a thread. Posting wakes the thread up through an eventfd, which it watches with its poller
+struct commandInbox{
+
+	std::mutex lock;
+	std::vector<workerCommand> commands;
+	int wakeFD;
+
+	commandInbox();
+	~commandInbox();
+
+	bool init();  // Only available on Linux
+	void post(std::vector<workerCommand> &newCommands);  // Moves the commands into the inbox and empties newCommands
+	void take(std::vector<workerCommand> &received);  // Swaps everything posted so far into received
+
+};
+
+// A racer's socket while a worker owns it
+struct workerConnection{
+	SOCKET socket;
+	slotHandle handle;  // Handle on the lobby thread
+	unsigned int playerID;  // What the lobby knows them by, which also keys their positions in everyone's send queues
+	unsigned int raceID;
+	uint64_t lastActive;  // Idle timer tick the racer last sent anything on
+	std::unique_ptr<connectionBuffers> buffers;
+};
+
+// Runs the relay for a share of the races on its own thread. Racers' sockets are moved here once their race starts, and
+// the worker relays race input ('#q', '#t', '#k' and '%f') between them. Anything else hands the socket back to the
+// lobby thread, which does the rest (rank updates, leaving the race, chat) like it would for any other player
+struct raceWorker{
+
+	unsigned int workerID;  // 1-based, 0 means the lobby thread
+	std::thread thread;
+	eventPoller poller;
+	commandInbox inbox;  // Commands from the lobby thread
+	commandInbox *lobbyInbox;
+	serverMetrics *metrics;  // The server's, shared with the other threads
+	std::vector<workerCommand> lobbyOutbox;  // Commands for the lobby thread, posted together at the end of each pass
+	std::vector<workerCommand> receivedCommands;
+	std::vector<pollerEvent> readySockets;
+	slotMap<workerConnection> racers;
+	std::unordered_map<uint64_t, slotHandle> racerHandles;  // Lobby handle (packed) -> handle in racers
+	std::unordered_map<unsigned int, std::vector<slotHandle> > raceMembers;  // Lobby handles of everyone in each race
+	std::vector<slotHandle> pendingSends;
+	raceTicker ticker;  // Set up before the worker starts
+	bool tickBypass;
+	sendLimits limits;
+	unsigned int idleTimeout;  // Seconds, 0 for never
+	timingWheel idleTimers;  // Keyed by packed handles in racers
+	std::vector<uint64_t> expiredTimers;
+	std::vector<unsigned int> tickedRaces;
+	bool running;
+
+	raceWorker();
+	~raceWorker();
+
+	bool start(unsigned int id, commandInbox *lobby, serverMetrics *serverMetrics);
+	void stop();  // Waits for the thread to finish
+
+	void run();
+	void handleCommands();
+	void adopt(workerCommand &command);
+	void receiveData(slotHandle racer);
+	bool handleMessages(slotHandle racer);  // Returns false once the racer has been handed back
+	void relay(workerConnection &sender, std::string_view message, bool includeSender, bool batched);
+	void queueMessage(slotHandle recipient, const char *message, unsigned int length, bool batched = false, uint32_t coalesceKey = 0);  // Takes a lobby handle. Batched messages aren't flushed until the tick
+	void queueMessage(slotHandle recipient, const sharedMessageRef &message, uint32_t coalesceKey);
+	void release(slotHandle racer, workerCommand::commandType reason);  // Gives the socket back to the lobby thread (RETURN or DISCONNECTED)
+	void flushSendQueues();
+	void flushRaceTicks();
+	void checkIdleTimers();
+
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "receiveBuffer.hpp"
+#include "slabPool.hpp"
+#include <string.h>
+#include <utility>
+
+receiveBuffer::receiveBuffer(){
+	buffer = (char*)slabPool::allocate(RECEIVE_BUFFER_SIZE);
+	readPos = 0;
+	scanPos = 0;
+	writePos = 0;
+}
+
+receiveBuffer::receiveBuffer(receiveBuffer &&other) noexcept{
+	buffer = other.buffer;
+	readPos = other.readPos;
+	scanPos = other.scanPos;
+	writePos = other.writePos;
+	other.buffer = NULL;  // Moved-from buffers are only ever destroyed or assigned to
+	other.readPos = 0;
+	other.scanPos = 0;
+	other.writePos = 0;
+}
+
+receiveBuffer &receiveBuffer::operator=(receiveBuffer &&other) noexcept{
+	std::swap(buffer, other.buffer);  // other frees this one's old buffer when it goes
+	std::swap(readPos, other.readPos);
+	std::swap(scanPos, other.scanPos);
+	std::swap(writePos, other.writePos);
+	return *this;
+}
+
+receiveBuffer::~receiveBuffer(){
+	slabPool::release(buffer);
+}
+
+char *receiveBuffer::writePointer(){
+	return &buffer[writePos];
+}
+
+unsigned int receiveBuffer::prepareWrite(){
+
+	if(writePos == RECEIVE_BUFFER_SIZE){  // Out of space at the end
+		compact();
+	}
+	return RECEIVE_BUFFER_SIZE - writePos;
+
+}
+
+void receiveBuffer::commitWrite(unsigned int bytes){
+	writePos += bytes;
+}
+
+bool receiveBuffer::append(const char *data, unsigned int length){
+
+	if(RECEIVE_BUFFER_SIZE - writePos < length){
+		compact();
+		if(RECEIVE_BUFFER_SIZE - writePos < length){
+			return false;
+		}
+	}
+	memcpy(&buffer[writePos], data, length);
+	writePos += length;
+	return true;
+
+}
+
+void receiveBuffer::compact(){
+
+	// Move the incomplete message at the back to the front of the buffer
+	if(readPos > 0){
+		unsigned int remaining = writePos - readPos;
+		memmove(&buffer[0], &buffer[readPos], remaining);
+		scanPos -= readPos;
+		writePos = remaining;
+		readPos = 0;
+	}
+
+}
+
+bool receiveBuffer::nextMessage(std::string_view &message){
+
+	while(scanPos < writePos){
+
+		const char *terminator = (const char *)memchr(&buffer[scanPos], '\0', writePos - scanPos);
+		if(terminator == NULL){  // The rest of the data is an incomplete message
+			scanPos = writePos;
+			return false;
+		}
+
+		unsigned int messageStart = readPos;
+		unsigned int messageEnd = terminator - &buffer[0];
+		readPos = messageEnd + 1;
+		scanPos = readPos;
+
+		if(messageEnd > messageStart){  // Skip empty messages
+			message = std::string_view(&buffer[messageStart], messageEnd - messageStart);
+			return true;
+		}
+
+	}
+
+	if(readPos == writePos){  // Everything has been handed out, so the next recv() can start at the front again
+		readPos = 0;
+		scanPos = 0;
+		writePos = 0;
+	}
+	return false;
+
+}
+
+void receiveBuffer::putBack(std::string_view message){
+	readPos = message.data() - &buffer[0];
+	scanPos = readPos;
+}
@@ -0,0 +1,38 @@
+#ifndef RECEIVEBUFFER_H
+#define RECEIVEBUFFER_H
+
+#include <string_view>
+
+#define RECEIVE_BUFFER_SIZE 4096  // Must hold at least one whole message. Messages are capped at 2,048 bytes (which is way more then you'll need here)
+
+// Per-connection buffer that reassembles the null-terminated messages sent by a client.
+// TCP may merge several messages into one recv() or split one across several, so incomplete messages
+// are kept until the rest arrives. Framed messages are returned as views into the buffer and remain
+// null-terminated, so they can still be used as C strings. The buffer is a block from the slab pool, so connecting
+// clients reuse the buffers of the ones that have left
+struct receiveBuffer{
+
+	char *buffer;
+	unsigned int readPos;   // Start of the first message that hasn't been handed out yet
+	unsigned int scanPos;   // Everything between readPos and scanPos is known to contain no terminator
+	unsigned int writePos;  // End of the received data
+
+	receiveBuffer();
+	receiveBuffer(receiveBuffer &&other) noexcept;
+	receiveBuffer &operator=(receiveBuffer &&other) noexcept;
+	~receiveBuffer();
+	receiveBuffer(const receiveBuffer&) = delete;
+	receiveBuffer &operator=(const receiveBuffer&) = delete;
+
+	char *writePointer();
+	unsigned int prepareWrite();  // Makes room for the next recv(), returns how many bytes can be written (0 if a single message fills the whole buffer)
+	void commitWrite(unsigned int bytes);
+	bool append(const char *data, unsigned int length);  // Copies in data received some other way, returns false if it doesn't fit
+	void compact();
+	bool nextMessage(std::string_view &message);  // Returns false once only an incomplete message (or nothing) is left
+	void putBack(std::string_view message);  // Hands the message last returned by nextMessage() out again next time
+	std::string_view unread() const{ return std::string_view(&buffer[readPos], writePos - readPos); }  // Everything not handed out yet
+
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "roomIndex.hpp"
+
+roomIndex::roomIndex(){
+	rooms.resize(1);  // The lobby always exists
+}
+
+void roomIndex::reserveRooms(unsigned int roomCount){
+	if(roomCount + 1 > rooms.size()){
+		rooms.resize(roomCount + 1);
+	}
+	for(unsigned int d = 1; d < rooms.size(); d++){
+		rooms[d].reserve(4);  // Races have at most 4 players
+	}
+}
+
+void roomIndex::join(connectionHandle member, unsigned int roomID){
+
+	leave(member);
+
+	if(roomID >= rooms.size()){
+		rooms.resize(roomID + 1);
+	}
+	if(member.index >= memberRooms.size()){
+		memberRooms.resize(member.index + 1, 0);
+		memberPositions.resize(member.index + 1, 0);
+	}
+
+	memberRooms[member.index] = roomID + 1;
+	memberPositions[member.index] = rooms[roomID].size();
+	rooms[roomID].push_back(member);
+
+}
+
+void roomIndex::leave(connectionHandle member){
+
+	if(!inRoom(member)){
+		return;
+	}
+
+	// Move the room's last member into the leaving member's position
+	std::vector<connectionHandle> &room = rooms[memberRooms[member.index] - 1];
+	unsigned int position = memberPositions[member.index];
+	room[position] = room.back();
+	memberPositions[room[position].index] = position;
+	room.pop_back();
+
+	memberRooms[member.index] = 0;
+
+}
+
+bool roomIndex::inRoom(connectionHandle member) const{
+	return member.index < memberRooms.size() && memberRooms[member.index] != 0;
+}
+
+const std::vector<connectionHandle> &roomIndex::members(unsigned int roomID) const{
+	static const std::vector<connectionHandle> noMembers;
+	if(roomID >= rooms.size()){
+		return noMembers;
+	}
+	return rooms[roomID];
+}
@@ -0,0 +1,28 @@
+#ifndef ROOMINDEX_H
+#define ROOMINDEX_H
+
+#include "connection.hpp"
+#include <vector>
+
+#define LOBBY_ROOM 0  // Rooms are numbered like player::roomID: 0 is the lobby and every other room is a race
+
+// Keeps a list of the connections in each room, so messages meant for one room only visit the players in it.
+// Joining and leaving are O(1), and each room's members can be looped through by any part of the server
+struct roomIndex{
+
+	std::vector<std::vector<connectionHandle> > rooms;  // Members of each room
+	std::vector<unsigned int> memberRooms;  // Room + 1 of the connection in each slot (0 if it isn't in a room)
+	std::vector<unsigned int> memberPositions;  // Position of the connection in each slot within its room's member list
+
+	roomIndex();
+
+	void reserveRooms(unsigned int roomCount);  // Preallocates the member lists of rooms 1 to roomCount
+
+	void join(connectionHandle member, unsigned int roomID);  // Leaves the member's current room first, if they're in one
+	void leave(connectionHandle member);
+	bool inRoom(connectionHandle member) const;
+	const std::vector<connectionHandle> &members(unsigned int roomID) const;
+
+};
+
+#endif
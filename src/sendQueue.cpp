@@ -0,0 +1,346 @@
+#include "sendQueue.hpp"
+#include <string.h>
+#include <algorithm>
+
+#define COMPACT_THRESHOLD 256  // Sent messages are only removed from the front of a queue that never empties once there are this many
+#define COMPACT_BYTES 65536  // Replaced messages are only removed from a queue once they (and anything sent) take up this much more than what's queued
+#define MIN_KEY_SLOTS 16
+
+sendLimits::sendLimits(){
+	chatBytes = DEFAULT_CHAT_QUEUE_LIMIT;
+	maxBytes = DEFAULT_SEND_QUEUE_LIMIT;
+	maxAge = DEFAULT_SEND_QUEUE_MAX_AGE;
+}
+
+sendQueue::sendQueue(){
+	firstMessage = 0;
+	sentBytes = 0;
+	queuedBytes = 0;
+	flushScheduled = false;
+	backlogged = false;
+	keyCount = 0;
+	keyGeneration = 1;
+}
+
+bool sendQueue::empty() const{
+	return firstMessage == messages.size();
+}
+
+unsigned int sendQueue::size() const{
+	return messages.size() - firstMessage;
+}
+
+void sendQueue::push(const char *message, unsigned int length, uint32_t key){
+
+	if(key != 0){
+		coalesce(key);
+	}
+
+	queuedMessage newMessage;
+	newMessage.offset = bytes.size();
+	newMessage.length = length;
+	newMessage.key = key;
+	messages.push_back(std::move(newMessage));
+
+	bytes.insert(bytes.end(), message, message + length);
+	queuedBytes += length;
+
+	if(bytes.size() >= 2 * queuedBytes + COMPACT_BYTES){  // Mostly replaced messages, e.g. from a client that has stopped reading
+		compact();
+	}
+
+}
+
+void sendQueue::push(const sharedMessageRef &message, uint32_t key){
+
+	if(message->length < SHARED_MESSAGE_MIN_LENGTH){
+		push(message->data(), message->length, key);
+		return;
+	}
+
+	if(key != 0){
+		coalesce(key);
+	}
+
+	queuedMessage newMessage;
+	newMessage.offset = bytes.size();
+	newMessage.length = message->length;
+	newMessage.shared = message;
+	newMessage.key = key;
+	messages.push_back(std::move(newMessage));
+	queuedBytes += message->length;
+
+}
+
+void sendQueue::coalesce(uint32_t key){
+
+	if(keyCount == 0){
+		setKey(key, messages.size());
+		return;
+	}
+
+	coalescedMessage &slot = findKey(key);
+	if(slot.generation != keyGeneration){
+		setKey(key, messages.size());
+		return;
+	}
+
+	queuedMessage &older = messages[slot.message];
+	// Only replace it if none of it has gone out yet (it may have been sent since, or partly sent)
+	if(slot.message > firstMessage || (slot.message == firstMessage && sentBytes == 0)){
+
+		// Drop it and queue the new one at the back. Overwriting it where it is would move the new one in front of
+		// anything queued since (e.g. a 'd' for the player whose ID is now someone else's). The first message is never a dropped one
+		queuedBytes -= older.length;
+		older.length = 0;
+		older.shared.reset();
+		while(firstMessage < messages.size() && messages[firstMessage].length == 0){
+			firstMessage++;
+		}
+
+	}
+	slot.message = messages.size();
+
+}
+
+coalescedMessage &sendQueue::findKey(uint32_t key){
+
+	// Linear probing from a multiplicative hash. Keys are never removed one at a time (the whole table is emptied
+	// instead), so the first empty slot ends the search
+	unsigned int mask = coalesced.size() - 1;
+	unsigned int slot = ((key * 2654435761u) >> 16) & mask;
+	while(coalesced[slot].generation == keyGeneration && coalesced[slot].key != key){
+		slot = (slot + 1) & mask;
+	}
+	return coalesced[slot];
+
+}
+
+void sendQueue::setKey(uint32_t key, unsigned int message){
+
+	if((keyCount + 1) * 2 > coalesced.size()){  // Keep the table at most half full, so probes stay short
+
+		std::vector<coalescedMessage, slabAllocator<coalescedMessage> > oldSlots(std::max<size_t>(MIN_KEY_SLOTS, coalesced.size() * 2));
+		oldSlots.swap(coalesced);
+		unsigned int oldGeneration = keyGeneration;
+		keyGeneration = 1;
+		keyCount = 0;
+		for(unsigned int d = 0; d < oldSlots.size(); d++){
+			if(oldSlots[d].generation == oldGeneration){
+				setKey(oldSlots[d].key, oldSlots[d].message);
+			}
+		}
+
+	}
+
+	coalescedMessage &slot = findKey(key);
+	if(slot.generation != keyGeneration){
+		slot.key = key;
+		slot.generation = keyGeneration;
+		keyCount++;
+	}
+	slot.message = message;
+
+}
+
+void sendQueue::clearKeys(){
+
+	if(keyCount == 0){
+		return;
+	}
+	keyCount = 0;
+	keyGeneration++;
+	if(keyGeneration == 0){  // Wrapped around, so slots from long ago could look current again
+		for(unsigned int d = 0; d < coalesced.size(); d++){
+			coalesced[d].generation = 0;
+		}
+		keyGeneration = 1;
+	}
+
+}
+
+bool sendQueue::flush(SOCKET socket){
+
+	ioBuffer buffers[MAX_IO_BUFFERS];
+
+	while(!empty()){
+
+		unsigned int gatheredBytes;
+		unsigned int bufferCount = gather(buffers, gatheredBytes);
+		int sent = sendBuffers(socket, buffers, bufferCount);
+		if(sent == SOCKET_ERROR){
+			if(!socketWouldBlock(lastSocketError())){
+				return false;
+			}
+			break;  // The socket's send buffer is full, try again once it's writable
+		}
+
+		advance(sent);
+		if((unsigned int)sent < gatheredBytes){  // Partial write, the socket's send buffer is full
+			break;
+		}
+
+	}
+
+	noteBacklog();
+	return true;
+
+}
+
+unsigned int sendQueue::gather(ioBuffer *buffers, unsigned int &gatheredBytes) const{
+
+	// Gather as many queued messages as possible, skipping whatever was already sent of the first one.
+	// Messages that are next to each other in bytes are sent as a single buffer, shared messages as one of their own
+	unsigned int bufferCount = 0;
+	gatheredBytes = 0;
+	const char *spanStart = NULL;
+	unsigned int spanLength = 0;
+	bool spanShared = false;
+	for(unsigned int d = firstMessage; d < messages.size(); d++){
+
+		const queuedMessage &queued = messages[d];
+		if(queued.length == 0){  // Replaced by a newer message
+			continue;
+		}
+		unsigned int skip = d == firstMessage ? sentBytes : 0;
+		const char *start = queued.shared ? queued.shared->data() + skip : &bytes[queued.offset + skip];
+
+		if(spanStart != NULL){
+			if(!spanShared && !queued.shared && start == spanStart + spanLength){
+				spanLength += queued.length;
+				continue;
+			}
+			if(bufferCount == MAX_IO_BUFFERS - 1){
+				break;
+			}
+			setIOBuffer(buffers[bufferCount++], spanStart, spanLength);
+			gatheredBytes += spanLength;
+		}
+		spanStart = start;
+		spanLength = queued.length - skip;
+		spanShared = (bool)queued.shared;
+
+	}
+	setIOBuffer(buffers[bufferCount++], spanStart, spanLength);
+	gatheredBytes += spanLength;
+	return bufferCount;
+
+}
+
+void sendQueue::advance(unsigned int sent){
+
+	// Remove everything that was sent. The last message may have only been partially sent
+	queuedBytes -= sent;
+	unsigned int remaining = sent;
+	while(remaining > 0){
+		unsigned int messageRemaining = messages[firstMessage].length - sentBytes;
+		if(remaining >= messageRemaining){
+			remaining -= messageRemaining;
+			messages[firstMessage].shared.reset();
+			firstMessage++;
+			sentBytes = 0;
+			while(firstMessage < messages.size() && messages[firstMessage].length == 0){
+				firstMessage++;
+			}
+		}else{
+			sentBytes += remaining;
+			remaining = 0;
+		}
+	}
+	discardSent();
+
+}
+
+void sendQueue::noteBacklog(){
+	if(!empty() && !backlogged){  // Some of it has to wait for the socket to become writable
+		backlogged = true;
+		backlogSince = std::chrono::steady_clock::now();
+	}
+}
+
+sendQueue::backlogState sendQueue::backlog(const sendLimits &limits) const{
+
+	if(!backlogged){
+		return BACKLOG_OK;
+	}
+	if(limits.maxBytes != 0 && queuedBytes > limits.maxBytes){
+		return BACKLOG_TOO_BIG;
+	}
+	if(limits.maxAge != 0 && std::chrono::steady_clock::now() - backlogSince > std::chrono::seconds(limits.maxAge)){
+		return BACKLOG_TOO_OLD;
+	}
+	return BACKLOG_OK;
+
+}
+
+void sendQueue::discardSent(){
+
+	if(empty()){  // Everything has been sent, so start again from the front (clear() keeps the capacity)
+		backlogged = false;
+		bytes.clear();
+		messages.clear();
+		clearKeys();
+		firstMessage = 0;
+		return;
+	}
+
+	if(firstMessage >= COMPACT_THRESHOLD && firstMessage * 2 >= messages.size()){  // Mostly sent, so move what's left to the front
+		compact();
+	}
+
+}
+
+void sendQueue::compact(){
+
+	unsigned int keptMessages = 0;
+	unsigned int keptBytes = 0;
+	for(unsigned int d = firstMessage; d < messages.size(); d++){
+
+		queuedMessage &kept = messages[d];
+		if(kept.length == 0){
+			continue;
+		}
+
+		if(!kept.shared){
+			memmove(&bytes[keptBytes], &bytes[kept.offset], kept.length);  // The first message is moved whole, so sentBytes still applies
+			kept.offset = keptBytes;
+			keptBytes += kept.length;
+		}else{
+			kept.offset = keptBytes;
+		}
+		if(keptMessages != d){
+			messages[keptMessages] = std::move(kept);
+		}
+		keptMessages++;
+
+	}
+
+	bytes.resize(keptBytes);
+	messages.resize(keptMessages);
+	firstMessage = 0;
+
+	// Every message has moved, so key the ones that are left again. Going in order leaves each key with its newest message
+	clearKeys();
+	for(unsigned int d = 0; d < messages.size(); d++){
+		if(messages[d].key != 0){
+			setKey(messages[d].key, d);
+		}
+	}
+
+}
+
+void sendQueue::clear(){
+	firstMessage = messages.size();
+	sentBytes = 0;
+	queuedBytes = 0;
+	discardSent();
+}
+
+void sendQueue::copyUnsent(std::string &out) const{
+	for(unsigned int d = firstMessage; d < messages.size(); d++){
+		unsigned int skip = d == firstMessage ? sentBytes : 0;
+		if(messages[d].length > skip){  // Replaced messages have a length of 0
+			out.append((messages[d].shared ? messages[d].shared->data() : &bytes[messages[d].offset]) + skip, messages[d].length - skip);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+
+#include "platform.hpp"
+#include "sharedMessage.hpp"
+#include "slabPool.hpp"
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define DEFAULT_CHAT_QUEUE_LIMIT 65536
+#define DEFAULT_SEND_QUEUE_LIMIT 1048576
+#define DEFAULT_SEND_QUEUE_MAX_AGE 30  // Seconds
+
+// How far behind a client can fall before the server gives up on them. 0 means no limit
+struct sendLimits{
+	unsigned int chatBytes;  // Chat isn't queued for clients with more than this waiting
+	unsigned int maxBytes;  // Clients with more than this waiting are disconnected
+	unsigned int maxAge;  // Clients whose queue hasn't emptied for this many seconds are disconnected
+	sendLimits();
+};
+
+struct queuedMessage{
+	unsigned int offset;  // Position of the message in the queue's bytes, unless it's shared
+	unsigned int length;  // Includes the null terminator, 0 if a newer message has replaced it
+	sharedMessageRef shared;  // Set if the message is sent from a shared buffer instead of the queue's bytes
+	uint32_t key;  // The coalescing key it was pushed with, 0 if none
+};
+
+// The newest queued message with a coalescing key, as a slot in the queue's hash table
+struct coalescedMessage{
+	uint32_t key;
+	unsigned int message;  // Index into messages
+	unsigned int generation;  // The slot is empty unless this is the queue's keyGeneration
+};
+
+// Messages waiting to be sent to a single client. Messages are queued while handling incoming data and
+// flushed together with one sendBuffers() call, so a slow client never blocks the rest of the server.
+// Queued messages are copied into a buffer that keeps its capacity, so queueing doesn't allocate once the queue has warmed up.
+// The buffers come from the slab pool, so a new connection's queue starts out with the blocks of one that has closed.
+// Long shared messages (chat, the lobby snapshot) aren't copied at all: the queue keeps a reference and sends straight from it.
+// Messages that only carry the latest state of something (a player's record, a racer's position) can be pushed with a
+// coalescing key. If an older message with the same key hasn't been sent yet it's replaced, so a client that can't keep
+// up gets the latest state instead of a growing backlog of stale ones
+struct sendQueue{
+
+	std::vector<char, slabAllocator<char> > bytes;
+	std::vector<queuedMessage, slabAllocator<queuedMessage> > messages;
+	unsigned int firstMessage;  // Messages before this one have been sent
+	unsigned int sentBytes;  // How much of the first message has already been sent
+	unsigned int queuedBytes;  // Total bytes waiting to be sent
+	std::vector<coalescedMessage, slabAllocator<coalescedMessage> > coalesced;  // Open-addressed table of the keys queued since the queue last emptied, a power of two in size
+	unsigned int keyCount;  // Keys in the table
+	unsigned int keyGeneration;  // Bumped to empty the table without touching its slots
+	bool flushScheduled;  // Whether the socket is already in the server's list of queues to flush
+	bool backlogged;  // Whether a flush has left anything behind since the queue last emptied
+	std::chrono::steady_clock::time_point backlogSince;
+
+	enum backlogState{
+		BACKLOG_OK,
+		BACKLOG_TOO_BIG,
+		BACKLOG_TOO_OLD
+	};
+
+	sendQueue();
+
+	bool empty() const;
+	unsigned int size() const;  // Number of messages waiting to be sent
+	void push(const char *message, unsigned int length, uint32_t key = 0);  // Messages with a key of 0 are never replaced
+	void push(const sharedMessageRef &message, uint32_t key = 0);
+	void coalesce(uint32_t key);  // Drops the unsent message the key was last queued with, and records that it's about to be queued again
+	bool flush(SOCKET socket);  // Sends as much as the socket will take, returns false if the connection has failed
+	unsigned int gather(ioBuffer *buffers, unsigned int &gatheredBytes) const;  // Fills in up to MAX_IO_BUFFERS buffers with what's queued (which mustn't be empty), returns how many
+	void advance(unsigned int sent);  // Removes what a send of the gathered buffers has sent
+	void noteBacklog();  // Called after flushing, in case something was left behind
+	backlogState backlog(const sendLimits &limits) const;  // Whether the client has fallen too far behind, checked after a flush
+	void discardSent();
+	void compact();  // Moves what's left to the front of the buffers, leaving out sent and replaced messages
+	void clear();  // Drops everything queued as if it had been sent
+	void copyUnsent(std::string &out) const;  // Appends the bytes still waiting to be sent
+	coalescedMessage &findKey(uint32_t key);  // The key's slot, or the empty slot it would go in
+	void setKey(uint32_t key, unsigned int message);
+	void clearKeys();
+
+	static uint32_t coalesceKey(char kind, unsigned int subjectID){ return ((uint32_t)(unsigned char)kind << 24) | (subjectID & 0xFFFFFF); }
+
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "sharedMessage.hpp"
+#include "slabPool.hpp"
+#include <string.h>
+#include <new>
+
+sharedMessage *sharedMessage::allocate(unsigned int length){
+	sharedMessage *message = (sharedMessage*)slabPool::allocate(sizeof(sharedMessage) + length);  // One block for the header and the message
+	new(&message->references) std::atomic<uint32_t>(1);
+	message->length = length;
+	return message;
+}
+
+void sharedMessage::release(){
+	if(references.fetch_sub(1, std::memory_order_acq_rel) == 1){  // The last reference, so nothing else can see it now
+		slabPool::release(this);  // Back to the pool of the thread that allocated it
+	}
+}
+
+sharedMessageRef::sharedMessageRef(const sharedMessageRef &other){
+	message = other.message;
+	if(message != NULL){
+		message->references.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+sharedMessageRef &sharedMessageRef::operator=(const sharedMessageRef &other){
+	if(other.message != NULL){  // Taken first, in case both refer to the same message
+		other.message->references.fetch_add(1, std::memory_order_relaxed);
+	}
+	reset();
+	message = other.message;
+	return *this;
+}
+
+sharedMessageRef &sharedMessageRef::operator=(sharedMessageRef &&other) noexcept{
+	if(this != &other){
+		reset();
+		message = other.message;
+		other.message = NULL;
+	}
+	return *this;
+}
+
+void sharedMessageRef::reset(){
+	if(message != NULL){
+		message->release();
+		message = NULL;
+	}
+}
+
+sharedMessageRef sharedMessageRef::allocate(unsigned int length){
+	sharedMessageRef allocated;
+	allocated.message = sharedMessage::allocate(length);
+	return allocated;
+}
+
+sharedMessageRef sharedMessageRef::copy(const char *data, unsigned int length){
+	sharedMessageRef copied = allocate(length);
+	memcpy(copied->data(), data, length);
+	return copied;
+}
+
+sharedMessageRef sharedMessageRef::copy(const std::string &text){
+	return copy(text.c_str(), text.length() + 1);
+}
@@ -0,0 +1,47 @@
+#ifndef SHAREDMESSAGE_H
+#define SHAREDMESSAGE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#define SHARED_MESSAGE_MIN_LENGTH 256  // Shorter messages are copied into send queues, as that's cheaper than sending them from a buffer of their own
+
+// A message built once and queued for any number of recipients, each of them holding a reference rather than a copy.
+// It isn't changed once it has been queued, and it's freed along with the last reference, which can be on any thread
+struct sharedMessage{
+
+	std::atomic<uint32_t> references;
+	uint32_t length;  // Including the terminator
+
+	char *data(){ return (char*)(this + 1); }  // The message is stored straight after the header
+	const char *data() const{ return (const char*)(this + 1); }
+
+	static sharedMessage *allocate(unsigned int length);  // With one reference, and the message left to be filled in
+	void release();
+
+};
+
+// A reference to a shared message (or to nothing)
+struct sharedMessageRef{
+
+	sharedMessage *message;
+
+	sharedMessageRef(){ message = NULL; }
+	sharedMessageRef(const sharedMessageRef &other);
+	sharedMessageRef(sharedMessageRef &&other) noexcept{ message = other.message; other.message = NULL; }
+	~sharedMessageRef(){ reset(); }
+	sharedMessageRef &operator=(const sharedMessageRef &other);
+	sharedMessageRef &operator=(sharedMessageRef &&other) noexcept;
+
+	explicit operator bool() const{ return message != NULL; }
+	sharedMessage *operator->() const{ return message; }
+	void reset();
+
+	static sharedMessageRef allocate(unsigned int length);
+	static sharedMessageRef copy(const char *data, unsigned int length);
+	static sharedMessageRef copy(const std::string &text);  // Along with its terminator
+
+};
+
+#endif
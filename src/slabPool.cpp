@@ -0,0 +1,122 @@
+#include "slabPool.hpp"
+#include <new>
+
+static unsigned int blockSize(unsigned int sizeClass){
+	return SLAB_MIN_SIZE << sizeClass;
+}
+
+// Owns the calling thread's pool. The pool itself is never deleted, as other threads may still be releasing blocks into
+// it after the thread has finished; only the blocks it was keeping for reuse are freed
+struct localSlabPool{
+	slabPool *pool;
+	localSlabPool(){ pool = new slabPool(); }
+	~localSlabPool(){ pool->trim(); }
+};
+
+slabPool::slabPool(){
+	for(unsigned int d = 0; d < SLAB_CLASSES; d++){
+		freeBlocks[d] = NULL;
+		freeCount[d] = 0;
+		remoteBlocks[d].store(NULL, std::memory_order_relaxed);
+	}
+}
+
+slabPool &slabPool::local(){
+	thread_local localSlabPool owner;
+	return *owner.pool;
+}
+
+void *slabPool::allocate(size_t size){
+
+	if(size > SLAB_MAX_SIZE){  // Too big to be worth keeping (a huge lobby snapshot), so it comes straight from the heap
+		slabBlock *block = (slabBlock*)::operator new(sizeof(slabBlock) + size);
+		block->owner = NULL;
+		block->sizeClass = SLAB_CLASSES;
+		return block + 1;
+	}
+
+	unsigned int sizeClass = 0;
+	while(blockSize(sizeClass) < size){
+		sizeClass++;
+	}
+	return local().take(sizeClass);
+
+}
+
+void slabPool::release(void *memory){
+
+	if(memory == NULL){
+		return;
+	}
+
+	slabBlock *block = (slabBlock*)memory - 1;
+	if(block->sizeClass == SLAB_CLASSES){
+		::operator delete(block);
+		return;
+	}
+
+	slabPool *owner = block->owner;
+	if(owner == &local()){
+		owner->give(block);
+	}else{
+		owner->giveRemote(block);
+	}
+
+}
+
+void *slabPool::take(unsigned int sizeClass){
+
+	if(freeBlocks[sizeClass] == NULL){  // Take back whatever other threads have released before going to the heap
+		slabBlock *remote = remoteBlocks[sizeClass].exchange(NULL, std::memory_order_acquire);
+		while(remote != NULL){
+			slabBlock *next = remote->next;
+			give(remote);
+			remote = next;
+		}
+	}
+
+	slabBlock *block = freeBlocks[sizeClass];
+	if(block != NULL){
+		freeBlocks[sizeClass] = block->next;
+		freeCount[sizeClass]--;
+	}else{
+		block = (slabBlock*)::operator new(sizeof(slabBlock) + blockSize(sizeClass));
+		block->sizeClass = sizeClass;
+	}
+	block->owner = this;
+	return block + 1;
+
+}
+
+void slabPool::give(slabBlock *block){
+
+	unsigned int sizeClass = block->sizeClass;
+	if((freeCount[sizeClass] + 1) * blockSize(sizeClass) > SLAB_CACHE_BYTES){  // Left over from a burst, no need to keep it
+		::operator delete(block);
+		return;
+	}
+	block->next = freeBlocks[sizeClass];
+	freeBlocks[sizeClass] = block;
+	freeCount[sizeClass]++;
+
+}
+
+void slabPool::giveRemote(slabBlock *block){
+
+	// Pushing is safe from any number of threads, as the owner only ever takes the whole list at once
+	std::atomic<slabBlock*> &remote = remoteBlocks[block->sizeClass];
+	block->next = remote.load(std::memory_order_relaxed);
+	while(!remote.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed));
+
+}
+
+void slabPool::trim(){
+	for(unsigned int d = 0; d < SLAB_CLASSES; d++){
+		while(freeBlocks[d] != NULL){
+			slabBlock *next = freeBlocks[d]->next;
+			::operator delete(freeBlocks[d]);
+			freeBlocks[d] = next;
+		}
+		freeCount[d] = 0;
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef SLABPOOL_H
+#define SLABPOOL_H
+
+#include <atomic>
+#include <stddef.h>
+
+#define SLAB_CLASSES 8  // Block sizes of 64 bytes to 8 KiB, doubling each time
+#define SLAB_MIN_SIZE 64
+#define SLAB_MAX_SIZE (SLAB_MIN_SIZE << (SLAB_CLASSES - 1))
+#define SLAB_CACHE_BYTES 1048576  // How much of each block size a thread keeps for reuse, anything over that goes back to the heap
+
+struct slabPool;
+
+// Stored in front of every block, so a block can be released without knowing its size or the thread it came from
+struct slabBlock{
+	union{
+		slabBlock *next;  // While the block is free
+		slabPool *owner;  // While it's in use
+	};
+	unsigned int sizeClass;  // SLAB_CLASSES if the block is too big for the pool and came straight from the heap
+	unsigned int padding;  // Keeps what follows 16-byte aligned
+};
+
+// Fixed-size blocks for the buffers the server allocates over and over: receive buffers and shared messages. Each thread
+// has its own pool, so taking a block is just popping a free list. A block released on another thread (a message queued
+// by the lobby and sent by a race worker, a receive buffer that moved with its socket) is pushed onto a list the owner
+// takes back the next time it runs out, so a block always returns to the thread that allocated it.
+// Once a pool has warmed up to the server's load, neither allocating nor releasing touches the heap
+struct slabPool{
+
+	slabBlock *freeBlocks[SLAB_CLASSES];
+	unsigned int freeCount[SLAB_CLASSES];
+	std::atomic<slabBlock*> remoteBlocks[SLAB_CLASSES];  // Released by other threads, waiting to be taken back
+
+	slabPool();
+
+	static void *allocate(size_t size);
+	static void release(void *memory);
+	static slabPool &local();  // The calling thread's pool
+
+	void *take(unsigned int sizeClass);
+	void give(slabBlock *block);  // From the owning thread
+	void giveRemote(slabBlock *block);  // From any other thread
+	void trim();  // Frees the cached blocks, when the thread finishes
+
+};
+
+// Lets containers that are created and destroyed with connections (like the send queues' buffers) keep their storage in
+// the slab pool, so a new connection reuses the buffers of one that has gone
+template<typename T>
+struct slabAllocator{
+
+	typedef T value_type;
+
+	slabAllocator(){}
+	template<typename U> slabAllocator(const slabAllocator<U>&){}
+
+	T *allocate(size_t count){ return (T*)slabPool::allocate(count * sizeof(T)); }
+	void deallocate(T *memory, size_t){ slabPool::release(memory); }
+
+	template<typename U> bool operator==(const slabAllocator<U>&) const{ return true; }
+	template<typename U> bool operator!=(const slabAllocator<U>&) const{ return false; }
+
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+// Refers to a value in a slotMap. The generation is bumped every time a slot is reused,
+// so a handle to a value that has since been erased will never find its slot's new value
+struct slotHandle{
+
+	uint32_t index;
+	uint32_t generation;
+
+	bool operator==(const slotHandle &other) const{ return index == other.index && generation == other.generation; }
+	bool operator!=(const slotHandle &other) const{ return !(*this == other); }
+
+	uint64_t pack() const{ return ((uint64_t)generation << 32) | index; }  // For storing the handle somewhere that only takes an integer (e.g. epoll's user data)
+	static slotHandle unpack(uint64_t packed){ slotHandle handle; handle.index = (uint32_t)packed; handle.generation = (uint32_t)(packed >> 32); return handle; }
+
+};
+
+// Stores values densely (so iterating through them is fast) while giving each one a handle that stays valid until it's erased.
+// Inserting and erasing are both O(1): erasing moves the last value into the erased value's place, so values don't keep their order
+template<typename T>
+struct slotMap{
+
+	static const uint32_t NO_SLOT = 0xFFFFFFFF;
+
+	struct slot{
+		uint32_t valueIndex;  // Position of the value in values, or the next free slot if this one is free
+		uint32_t generation;
+		bool used;
+	};
+
+	std::vector<T> values;
+	std::vector<uint32_t> valueSlots;  // Which slot each value belongs to
+	std::vector<slot> slots;
+	uint32_t freeSlot;  // First slot in the free list
+
+	slotMap(){
+		freeSlot = NO_SLOT;
+	}
+
+	slotHandle insert(T value){
+
+		uint32_t slotIndex;
+		if(freeSlot != NO_SLOT){  // Reuse the most recently freed slot
+			slotIndex = freeSlot;
+			freeSlot = slots[slotIndex].valueIndex;
+		}else{
+			slotIndex = slots.size();
+			slot newSlot;
+			newSlot.generation = 0;
+			slots.push_back(newSlot);
+		}
+
+		slots[slotIndex].valueIndex = values.size();
+		slots[slotIndex].used = true;
+		values.push_back(std::move(value));
+		valueSlots.push_back(slotIndex);
+
+		slotHandle handle;
+		handle.index = slotIndex;
+		handle.generation = slots[slotIndex].generation;
+		return handle;
+
+	}
+
+	bool erase(slotHandle handle){
+
+		if(get(handle) == NULL){
+			return false;
+		}
+
+		// Move the last value into the erased value's position
+		uint32_t valueIndex = slots[handle.index].valueIndex;
+		uint32_t lastIndex = values.size() - 1;
+		if(valueIndex != lastIndex){
+			values[valueIndex] = std::move(values[lastIndex]);
+			valueSlots[valueIndex] = valueSlots[lastIndex];
+			slots[valueSlots[valueIndex]].valueIndex = valueIndex;
+		}
+		values.pop_back();
+		valueSlots.pop_back();
+
+		// Add the slot to the free list
+		slots[handle.index].used = false;
+		slots[handle.index].generation++;
+		slots[handle.index].valueIndex = freeSlot;
+		freeSlot = handle.index;
+		return true;
+
+	}
+
+	T *get(slotHandle handle){
+		if(handle.index >= slots.size() || !slots[handle.index].used || slots[handle.index].generation != handle.generation){
+			return NULL;
+		}
+		return &values[slots[handle.index].valueIndex];
+	}
+
+	T *find(uint32_t slotIndex){  // Looks a value up by its slot alone, for when the generation isn't known
+		if(slotIndex >= slots.size() || !slots[slotIndex].used){
+			return NULL;
+		}
+		return &values[slots[slotIndex].valueIndex];
+	}
+
+	slotHandle handleAt(uint32_t valueIndex) const{  // Handle of the value at a position in values
+		slotHandle handle;
+		handle.index = valueSlots[valueIndex];
+		handle.generation = slots[handle.index].generation;
+		return handle;
+	}
+
+	uint32_t size() const{ return values.size(); }
+	T &at(uint32_t valueIndex){ return values[valueIndex]; }
+
+};
+
+#endif
@@ -1,45 +1,60 @@
 #include "socketServer.hpp"
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
-extern "C" {
-	int inet_pton(int af, const char *src, char *dst);
-}
-bool playerInfoIsValid(const char buffer[2048]);
-
 socketServer::socketServer(){
 	ip[0] = '\0';
 	port = DEFAULT_PORT;
+	pollerBackend = eventPoller::BACKEND_EPOLL;
+	raceWorkerCount = 0;
+	nextWorker = 0;
+	raceCapacity = DEFAULT_RACE_CAPACITY;
+	metricsPort = 0;
+	raceTickRate = 0;
+	raceTickBypass = true;
+	idleTimeout = DEFAULT_IDLE_TIMEOUT;
+	metricsSocket = INVALID_SOCKET;
+	processCount = 1;
+	lobbyMaps = localMaps;
 }
 
 socketServer::~socketServer(){
 
-	for(unsigned int d = 0; d < connectedSockets.size(); d++){
-		closesocket(connectedSockets.at(d));
+	raceWorkers.clear();  // Stops the workers, which close the sockets they own
+
+	for(unsigned int d = 0; d < connections.size(); d++){
+		if(connections.at(d).worker == 0){
+			closesocket(connections.at(d).socket);
+		}
+	}
+
+	if(metricsSocket != INVALID_SOCKET){
+		closesocket(metricsSocket);
 	}
-	FD_ZERO(&socketSet);
 
-	#ifdef _WIN32
-		WSACleanup();
-	#endif
+	socketCleanup();
 
 }
 
 void socketServer::reportError(const char *failedFunction, int errorCode){
 
-	printf("\nSocket function %s has failed: %i\nSee here for more information:\nhttps://msdn.microsoft.com/en-us/library/windows/desktop/ms740668%%28v=vs.85%%29.aspx\n",
-		   failedFunction, errorCode);
+	#ifdef _WIN32
+		printf("\nSocket function %s has failed: %i\nSee here for more information:\nhttps://msdn.microsoft.com/en-us/library/windows/desktop/ms740668%%28v=vs.85%%29.aspx\n",
+			   failedFunction, errorCode);
+	#else
+		printf("\nSocket function %s has failed: %i (%s)\n", failedFunction, errorCode, strerror(errorCode));
+	#endif
 
 }
 
 bool socketServer::loadConfig(const char *prgPath){
 
-	char *cfgPath = (char*)prgPath;
-	cfgPath[strrchr(cfgPath, '\\') - cfgPath + 1] = '\0';  // Removes program name (everything after the last backslash) from the path
-	strcpy(cfgPath + strlen(cfgPath), "config.txt");  // Append "config.txt" to the end
+	std::string cfgPath = programDirectory(prgPath) + "config.txt";  // The config is stored next to the executable
 
-	std::ifstream serverConfig(cfgPath);
+	std::ifstream serverConfig(cfgPath.c_str());
 	std::string line;
 
 	if(serverConfig.is_open()){
@@ -48,13 +63,14 @@ bool socketServer::loadConfig(const char *prgPath){
 			getline(serverConfig, line);
 
 			// Remove any comments from the line
-			unsigned int commentPos = line.find("//");
+			std::string::size_type commentPos = line.find("//");
 			if(commentPos != std::string::npos){
 				line.erase(commentPos);
 			}
 
 			if(line.length() >= 12 && line.substr(0, 5) == "ip = "){
-				strcpy(ip, line.substr(5).c_str());
+				strncpy(ip, line.substr(5).c_str(), sizeof(ip) - 1);
+				ip[sizeof(ip) - 1] = '\0';
 
 			}else if(line.length() >= 8 && line.substr(0, 7) == "port = "){
 				std::istringstream(line.substr(7)) >> port;
@@ -62,6 +78,51 @@ bool socketServer::loadConfig(const char *prgPath){
 			}else if(line.length() >= 8 && line.substr(0, 7) == "motd = "){
 				motd = "^0`&#0;`" + line.substr(7) + "\n";
 
+			}else if(line.length() >= 15 && line.substr(0, 9) == "poller = "){
+				if(line.substr(9, 6) == "select"){
+					pollerBackend = eventPoller::BACKEND_SELECT;
+				}else if(line.substr(9, 8) == "io_uring"){
+					pollerBackend = eventPoller::BACKEND_URING;
+				}else{
+					pollerBackend = eventPoller::BACKEND_EPOLL;
+				}
+
+			}else if(line.length() >= 16 && line.substr(0, 15) == "raceCapacity = "){
+				std::istringstream(line.substr(15)) >> raceCapacity;
+
+			}else if(line.length() >= 15 && line.substr(0, 14) == "raceWorkers = "){
+				std::istringstream(line.substr(14)) >> raceWorkerCount;
+
+			}else if(line.length() >= 16 && line.substr(0, 15) == "raceTickRate = "){
+				std::istringstream(line.substr(15)) >> raceTickRate;
+
+			}else if(line.length() >= 18 && line.substr(0, 17) == "raceTickBypass = "){
+				raceTickBypass = line[17] != '0';
+
+			}else if(line.length() >= 22 && line.substr(0, 21) == "sendQueueChatLimit = "){
+				std::istringstream(line.substr(21)) >> limits.chatBytes;
+
+			}else if(line.length() >= 18 && line.substr(0, 17) == "sendQueueLimit = "){
+				std::istringstream(line.substr(17)) >> limits.maxBytes;
+
+			}else if(line.length() >= 19 && line.substr(0, 18) == "sendQueueMaxAge = "){
+				std::istringstream(line.substr(18)) >> limits.maxAge;
+
+			}else if(line.length() >= 9 && line.substr(0, 8) == "xlist = "){
+				xlist.whitelist = line[8] == '1';
+
+			}else if(line.length() >= 18 && line.substr(0, 17) == "connectionRate = "){
+				std::istringstream(line.substr(17)) >> xlist.connectionRate;
+
+			}else if(line.length() >= 15 && line.substr(0, 14) == "idleTimeout = "){
+				std::istringstream(line.substr(14)) >> idleTimeout;
+
+			}else if(line.length() >= 13 && line.substr(0, 12) == "processes = "){
+				std::istringstream(line.substr(12)) >> processCount;
+
+			}else if(line.length() >= 15 && line.substr(0, 14) == "metricsPort = "){
+				std::istringstream(line.substr(14)) >> metricsPort;
+
 			}
 
 		}
@@ -84,65 +145,123 @@ bool socketServer::initServer(const int argc, const char *argv[]){
 	/* Load server config */
 	if(argc > 0){
 		loadConfig(argv[0]);
+		if(xlist.load(programDirectory(argv[0]) + "xlist.txt")){
+			printf("Loaded %u xlist entries (%s).\n", xlist.size(), xlist.whitelist ? "whitelist" : "blacklist");
+			if(xlist.whitelist && xlist.size() == 0){
+				printf("The xlist is an empty whitelist, so no one will be able to connect!\n");
+			}
+		}
 	}
 
 
-	/* Specify the version of Winsock to use and initialize it */
-	#ifdef _WIN32
-		WSADATA wsaData;
-		int initError = WSAStartup(WINSOCK_VERSION, &wsaData);
+	/* Set up the race table up front, so starting a race doesn't have to allocate */
+	currentRaces.reserve(raceCapacity);
+	rooms.reserveRooms(raceCapacity);
 
-		if(initError != 0){  // If Winsock did not initialize correctly, abort
-			reportError("WSAStartup()", initError);
-			return 0;
+
+	/* Initialize the platform's socket library (Winsock on Windows) */
+	if(!socketStartup()){
+		return 0;
+	}
+
+
+	/* Fork the other server processes, which share the port and the lobby. Everything after this happens in each of them */
+	if(processCount > 1){
+		if(cluster.start(processCount)){
+			lobbyMaps = cluster.shared->lobbyMaps;
+			connectionHandle noConnection;
+			noConnection.index = slotMap<connection>::NO_SLOT;
+			noConnection.generation = 0;
+			clusterPlayers.assign(CLUSTER_MAX_PLAYERS, noConnection);
+			metricsPort = metricsPort != 0 ? metricsPort + cluster.processIndex : 0;  // One metrics port for each process
+		}else{
+			printf("Server processes can't share a lobby on this platform, running just the one.\n");
 		}
-	#endif
+	}
 
 
 	/* Create a socket prototype for the master socket */
 	/*
 	   socket(address family, type, protocol)
-	   address family = AF_UNSPEC, which can be either IPv4 or IPv6
+	   address family = AF_INET, as the server binds to an IPv4 address (sockaddr_in)
 	   type = SOCK_STREAM, which uses TCP
 	   protocol = IPPROTO_TCP, specifies to use TCP
 	*/
-	masterSocket = socket(AF_UNSPEC, SOCK_STREAM, IPPROTO_TCP);
+	masterSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 
 	if(masterSocket == INVALID_SOCKET){  // If socket() failed, abort
-		reportError("socket()", WSAGetLastError());
-		WSACleanup();
+		reportError("socket()", lastSocketError());
+		socketCleanup();
 		return 0;
 	}
 
 
 	/* Bind the master socket to the host address */
-	WSAPROTOCOL_INFO protocolInfo;
-	WSADuplicateSocket(masterSocket, GetCurrentProcessId(), &protocolInfo);  // Retrieve details about the master socket (we want the address family being used)
+	allowAddressReuse(masterSocket);
+	if(cluster.active() && !allowPortSharing(masterSocket)){  // Every process listens on the same port, and the kernel shares the connections out
+		reportError("setsockopt()", lastSocketError());
+		socketCleanup();
+		return 0;
+	}
 
 	sockaddr_in serverAddress;
-	serverAddress.sin_family = protocolInfo.iAddressFamily;
+	memset(&serverAddress, 0, sizeof(serverAddress));
+	serverAddress.sin_family = AF_INET;
 	if(strlen(ip) > 0){  // If the IP has been specified, convert it from a string to the in_addr format for sockaddr_in
-		inet_pton(protocolInfo.iAddressFamily, ip, (char*)&(serverAddress.sin_addr));
+		inet_pton(AF_INET, ip, (char*)&(serverAddress.sin_addr));
 	}else{	  // Otherwise use all available addresses
 		serverAddress.sin_addr.s_addr = INADDR_ANY;
 	}
 	serverAddress.sin_port = htons(port);  // htons() converts the port from big-endian to little-endian for sockaddr_in
 
 	if(bind(masterSocket, (sockaddr*)&serverAddress, sizeof(serverAddress)) == SOCKET_ERROR){  // If bind() failed, abort
-		reportError("bind()", WSAGetLastError());
-		WSACleanup();
+		reportError("bind()", lastSocketError());
+		socketCleanup();
 		return 0;
 	}
 
 
 	/* Change the master socket's state to "listen" so it will start listening for incoming connections from sockets */
 	if(listen(masterSocket, SOMAXCONN) == SOCKET_ERROR){  // SOMAXCONN = automatically choose maximum number of pending connections, different across systems
-		reportError("listen()", WSAGetLastError());
-		WSACleanup();
+		reportError("listen()", lastSocketError());
+		socketCleanup();
 		return 0;
 	}
 
 
+	/* Start watching the master socket for incoming connections */
+	poller.init(pollerBackend);
+	if(!setNonBlocking(masterSocket)){  // accept() is called until it would block, so it mustn't actually block
+		reportError("setNonBlocking()", lastSocketError());
+		socketCleanup();
+		return 0;
+	}
+	if(!poller.addListener(masterSocket, MASTER_SOCKET_KEY)){
+		socketCleanup();
+		return 0;
+	}
+	printf("Using the %s event backend.\n", eventPoller::backendName(poller.backend));
+	if(cluster.active()){
+		if(!cluster.watch(poller)){
+			socketCleanup();
+			return 0;
+		}
+		printf("Server process %i of %i.\n", cluster.processIndex + 1, cluster.processCount);
+	}
+
+	if(metricsPort != 0 && startMetrics()){  // Before the workers start, as they read metrics.timing
+		printf("Serving metrics on 127.0.0.1:%i.\n", metricsPort);
+	}
+	idleTimers.init(1000);  // Timed in whole seconds
+	ticker.setRate(raceTickRate);
+	if(ticker.enabled()){
+		printf("Relaying race input %i times a second%s.\n", raceTickRate, raceTickBypass ? " ('#t' and '#k' straight away)" : "");
+	}
+	if(raceWorkerCount > 0){
+		startRaceWorkers();
+	}
+
+
 	printf("Server is up!\n\n");
 	return 1;
 
@@ -150,579 +269,1608 @@ bool socketServer::initServer(const int argc, const char *argv[]){
 
 void socketServer::handleConnections(){
 
-	/* Empties and refills socketSet, as select() may have modified it */
-	FD_ZERO(&socketSet);
-	FD_SET(masterSocket, &socketSet);
-	for(unsigned int d = 0; d < connectedSockets.size(); d++){
-		FD_SET(connectedSockets.at(d), &socketSet);
-	}
+	// Waits until at least one socket has changed state (or the next race tick or idle timer) and stores the ones that have in readySockets
+	int changedSockets = poller.wait(readySockets, earlierTimeout(earlierTimeout(ticker.timeout(), idleTimers.timeout()), cluster.retryTimeout()));
 
+	if(changedSockets != SOCKET_ERROR){  // If the poller did not return SOCKET_ERROR (-1), all is fine
 
-	// Checks which sockets have changed state, and removes the ones that haven't from socketSet
-	int changedSockets = select(0, &socketSet, NULL, NULL, NULL);
+		uint64_t passStart = metrics.timing ? metricsNow() : 0;
+		if(idleTimeout != 0){
+			checkIdleTimers();  // Also brings idleTimers.currentTick up to date for marking clients as active
+		}
 
-	if(changedSockets != SOCKET_ERROR){  // If select() did not return SOCKET_ERROR (-1), all is fine
+		for(unsigned int d = 0; d < readySockets.size(); d++){
 
-		if(changedSockets > 0){  // Only continue if there are sockets that have changed state
+			/* If the master socket has changed state, there are incoming connections */
+			if(readySockets.at(d).key == MASTER_SOCKET_KEY){
+				if(readySockets.at(d).accepted != INVALID_SOCKET){  // io_uring has already accepted it
+					sockaddr_in clientAddress;
+					socklen_t addressLength = sizeof(clientAddress);
+					if(getpeername(readySockets.at(d).accepted, (sockaddr*)&clientAddress, &addressLength) == 0){
+						admitConnection(readySockets.at(d).accepted, clientAddress, currentSecond());
+					}else{
+						closesocket(readySockets.at(d).accepted);  // Already gone again
+					}
+				}else{
+					acceptConnections();
+				}
+				continue;
+			}
 
-			/* If the master socket has changed state, there is an incoming connection. Accept the connection if the socket is valid */
-			if(FD_ISSET(masterSocket, &socketSet)){
+			/* If the inbox has been woken up, the race workers have sent something */
+			if(readySockets.at(d).key == INBOX_KEY){
+				handleWorkerCommands();
+				continue;
+			}
 
-				SOCKET clientSocket = accept(masterSocket, NULL, NULL);
+			/* Another server process has sent something */
+			if(readySockets.at(d).key == CLUSTER_INBOX_KEY){
+				handleClusterMessages();
+				continue;
+			}
+			if(readySockets.at(d).key == CLUSTER_MIGRATION_KEY){
+				adoptMigrants();
+				continue;
+			}
 
-				if(clientSocket != INVALID_SOCKET){
-					FD_SET(clientSocket, &socketSet);
-					connectedSockets.push_back(clientSocket);
-					printf("Accepted connection from socket #%i.\n", clientSocket);
-				}else{
-					reportError("accept()", WSAGetLastError());
-				}
+			/* Someone is asking for the metrics */
+			if(readySockets.at(d).key == METRICS_SOCKET_KEY){
+				acceptMetricsClients();
+				continue;
+			}
+			if((readySockets.at(d).key & 0xFFFFFFFF00000000ULL) == METRICS_CLIENT_KEY){
+				serveMetrics((SOCKET)(readySockets.at(d).key & 0xFFFFFFFF));
+				continue;
+			}
+
+			connectionHandle client = connectionHandle::unpack(readySockets.at(d).key);
+			connection *readyClient = connections.get(client);
+			if(readyClient == NULL){  // The client disconnected earlier in this pass
+				continue;
+			}
 
+			if(readySockets.at(d).writable && !readyClient->outgoing.empty() && !readyClient->outgoing.flushScheduled){  // There is room to send more of the client's queued messages
+				readyClient->outgoing.flushScheduled = true;
+				pendingSends.push_back(client);
 			}
+			if(readySockets.at(d).data != NULL){
+				receivedData(client, readySockets.at(d).data, readySockets.at(d).length);  // io_uring has already received it
+			}else if(readySockets.at(d).readable){
+				receiveData(client);  // Receive data from the connected socket and queue any replies
+			}
+
+		}
 
-			/* Receive data from and send data to connected sockets */
-			for(unsigned int d = 0; d < connectedSockets.size(); d++){  // Loop through each connected socket
+		if(ticker.due()){
+			flushRaceTicks();
+		}
+		migrateRacers();
+		flushSendQueues();  // Send everything queued while handling this batch of sockets
+		handOffRacers();
+		postWorkerCommands();
+		if(cluster.active()){
+			cluster.wakeProcesses();
+		}
 
-				if(FD_ISSET(connectedSockets.at(d), &socketSet)){  // Check if the socket actually has changed state
+		if(metrics.timing){
+			metrics.loopTime.record(metricsNow() - passStart);
+		}
 
-					// Receives up to 2,048 bytes of data from a client socket and stores it in lastBuffer
-					recvBytes = recv(connectedSockets.at(d), lastBuffer, 2048, 0);
+	}else{
 
-					if(recvBytes == -1){  // Error encountered, disconnect problematic socket
+		reportError(poller.waitFunction(), lastSocketError());
 
-						reportError("recv()", WSAGetLastError());
-						printf("Closing connection with socket #%i.\n\n", connectedSockets.at(d));
-						disconnectSocket(d);
-						d--;
+	}
 
-					}else if(recvBytes == 0){  // If the buffer is empty, the connection has closed
+}
 
-						printf("Socket #%i has disconnected, closing connection.\n", connectedSockets.at(d));
-						disconnectSocket(d);
-						d--;
+void socketServer::acceptConnections(){
 
-					}else{
+	uint64_t second = currentSecond();
 
-						handleBuffer(d);  // Do something with the received data
+	/* Accept the connections if the sockets are valid. Keep accepting until the backlog is empty */
+	while(true){
 
-					}
+		sockaddr_in clientAddress;
+		socklen_t addressLength = sizeof(clientAddress);
+		SOCKET clientSocket = accept(masterSocket, (sockaddr*)&clientAddress, &addressLength);
 
-				}
+		if(clientSocket != INVALID_SOCKET){
 
+			admitConnection(clientSocket, clientAddress, second);
+
+		}else{
+
+			int acceptError = lastSocketError();
+			if(!socketWouldBlock(acceptError)){  // Otherwise there are no more pending connections
+				reportError("accept()", acceptError);
 			}
+			return;
 
 		}
 
-	}else{
+	}
 
-		reportError("select()", WSAGetLastError());
+}
+
+void socketServer::admitConnection(SOCKET clientSocket, const sockaddr_in &clientAddress, uint64_t second){
 
+	// Turn away blocked addresses before anything is set up for them. They aren't logged, so a flood costs as little as possible
+	uint32_t clientIP = ntohl(clientAddress.sin_addr.s_addr);
+	if(!xlist.admits(clientIP)){
+		serverMetrics::add(metrics.rejectedByXlist, 1);
+		abortConnection(clientSocket);
+		return;
+	}
+	if(xlist.rateLimited(clientIP, second)){
+		serverMetrics::add(metrics.rejectedByRate, 1);
+		abortConnection(clientSocket);
+		return;
 	}
 
+	if(addConnection(clientSocket) != NULL){
+		serverMetrics::add(metrics.connectionsAccepted, 1);
+		printf("Accepted connection from socket #%i.\n", clientSocket);
+	}else{
+		printf("Unable to watch socket #%i, closing connection.\n", clientSocket);
+		closesocket(clientSocket);
+	}
+
+}
+
+uint64_t socketServer::currentSecond(){
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-void socketServer::handleBuffer(unsigned int senderNum){
+connection *socketServer::addConnection(SOCKET clientSocket, unsigned int playerID){
+
+	connectionHandle client = connections.insert(connection());
+
+	// IDs are the connection's slot + 1, unless they're shared out between the server processes
+	bool newID = playerID == 0;
+	if(!cluster.active()){
+		playerID = client.index + 1;
+	}else if(newID){
+		clusterLock guard(cluster);
+		playerID = cluster.allocateID();
+		if(playerID == 0){
+			printf("Every player ID is in use.\n");
+		}
+	}
+
+	if(playerID == 0 || !setNonBlocking(clientSocket) || !poller.addStream(clientSocket, client.pack())){
+		if(cluster.active() && newID && playerID != 0){
+			clusterLock guard(cluster);
+			cluster.releaseID(playerID);
+		}
+		connections.erase(client);
+		return NULL;
+	}
 
-	if(lastBuffer[0] == 'n'){  // Client connected or changed player data
+	connection &newClient = *connections.get(client);
+	newClient.socket = clientSocket;
+	newClient.handle = client;
+	newClient.id = playerID;
+	if(cluster.active()){
+		clusterPlayers[playerID - 1] = client;
+	}
+	if(idleTimeout != 0){
+		newClient.lastActive = idleTimers.currentTick;
+		idleTimers.schedule(client.pack(), idleTimers.currentTick + idleTimeout);
+	}
+	return &newClient;
 
-		player newPlayer;
-		if(newPlayer.infoIsValid(lastBuffer)){  // Validate player data
+}
 
-			if(senderNum == playerData.size()){  // If the player is new, add them to the playerData vector
+void socketServer::receiveData(connectionHandle client){
 
-				playerData.push_back(newPlayer);
+	do{
 
-				std::ostringstream ss; ss << "i" << connectedSockets.at(senderNum);
-				if(send(connectedSockets.at(senderNum), ss.str().c_str(), ss.str().length() + 1, 0) < 0){  // Acknowledge connection and return player ID
-					reportError("send()", WSAGetLastError());
-				}
+		// The client may have been disconnected while handling a previous message
+		connection *receiver = connections.get(client);
+		if(receiver == NULL){
+			return;
+		}
 
-			}else{
-				if(playerData.at(senderNum).rank == newPlayer.rank){  // Make sure the player's rank has not changed
-
-					playerData.at(senderNum) = newPlayer;  // If all is good, update the player's information
-
-					// Generate a player data buffer using the new information provided
-					std::ostringstream ss;
-					ss << "p" << connectedSockets.at(senderNum) << "`" << playerData.at(senderNum).user << "`" << playerData.at(senderNum).rank
-					   << "`" << playerData.at(senderNum).headNum << "`" << playerData.at(senderNum).bodyNum << "`" << playerData.at(senderNum).footNum
-					   << "`" << playerData.at(senderNum).speedPoints << "`" << playerData.at(senderNum).jumpPoints << "`" << playerData.at(senderNum).tractionPoints;
-
-					// Send the new player data to all clients who aren't racing
-					for(unsigned int d = 0; d < playerData.size(); d++){
-						if(playerData.at(d).roomID == 0){
-							if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-								reportError("send()", WSAGetLastError());
-							}
-						}
-					}
+		unsigned int freeBytes = receiver->incoming.prepareWrite();
+		if(freeBytes == 0){  // A single message has filled the whole buffer without being terminated
+			printf("Socket #%i has sent a message longer than %i bytes, closing connection.\n", receiver->socket, RECEIVE_BUFFER_SIZE);
+			disconnectSocket(*receiver);
+			return;
+		}
 
-				}else{  // If it has changed without the server's knowledge, disconnect them (not really a good solution)
+		// Receives as much data as will fit in the client's receive buffer
+		int recvBytes = recv(receiver->socket, receiver->incoming.writePointer(), freeBytes, 0);
 
-					printf("Socket #%i has sent suspicious player data, closing connection.\n", connectedSockets.at(senderNum));
-					disconnectSocket(senderNum);
+		if(recvBytes == -1){  // Error encountered, disconnect problematic socket
 
-				}
+			int recvError = lastSocketError();
+			if(socketWouldBlock(recvError)){  // Everything has been read
+				return;
 			}
+			reportError("recv()", recvError);
+			printf("Closing connection with socket #%i.\n\n", receiver->socket);
+			disconnectSocket(*receiver);
+			return;
 
-		}else{  // If the player data isn't valid, disconnect them
+		}else if(recvBytes == 0){  // If the buffer is empty, the connection has closed
 
-			printf("Socket #%i has sent suspicious player data, closing connection.\n", connectedSockets.at(senderNum));
-			disconnectSocket(senderNum);
+			printf("Socket #%i has disconnected, closing connection.\n", receiver->socket);
+			disconnectSocket(*receiver);
+			return;
 
 		}
 
-	}else if(senderNum < playerData.size()){  // Make sure the socket has registered valid player data
+		receiver->incoming.commitWrite(recvBytes);
+		receiver->lastActive = idleTimers.currentTick;
+		serverMetrics::add(metrics.bytesIn, recvBytes);
+		if(!handleMessages(client)){
+			return;
+		}
 
-		if(lastBuffer[0] == 'o'){  // Someone has joined the lobby
+	}while(poller.edgeTriggered());  // When edge-triggered, keep reading until the socket has been drained
 
-			if(playerData.at(senderNum).roomID != 0){  // If the player has finished a singleplayer race, call leaveRace()
-				leaveRace(senderNum);
-			}
+}
 
-			// Generate the sender's player data buffer
-			std::ostringstream ss;
-			ss << "p" << connectedSockets.at(senderNum) << "`" << playerData.at(senderNum).user << "`" << playerData.at(senderNum).rank
-			   << "`" << playerData.at(senderNum).headNum << "`" << playerData.at(senderNum).bodyNum << "`" << playerData.at(senderNum).footNum
-			   << "`" << playerData.at(senderNum).speedPoints << "`" << playerData.at(senderNum).jumpPoints << "`" << playerData.at(senderNum).tractionPoints;
-			std::string senderData = ss.str();
+void socketServer::receivedData(connectionHandle client, const char *data, unsigned int length){
 
-			/* Sends the requestor's information to the other clients and the other clients' information to the requestor */
-			for(unsigned int d = 0; d < playerData.size(); d++){
+	// Copies it into the client's receive buffer a bufferful at a time, handling the messages as they're completed
+	while(length > 0){
 
-				/* Send the requestor's information to player d */
-				if(send(connectedSockets.at(d), senderData.c_str(), senderData.length() + 1, 0) < 0){
-					reportError("send()", WSAGetLastError());
-				}
+		connection *receiver = connections.get(client);
+		if(receiver == NULL){
+			return;
+		}
 
-				if(d != senderNum){
+		unsigned int freeBytes = receiver->incoming.prepareWrite();
+		if(freeBytes == 0){
+			printf("Socket #%i has sent a message longer than %i bytes, closing connection.\n", receiver->socket, RECEIVE_BUFFER_SIZE);
+			disconnectSocket(*receiver);
+			return;
+		}
+		unsigned int copied = length < freeBytes ? length : freeBytes;
+		memcpy(receiver->incoming.writePointer(), data, copied);
+		receiver->incoming.commitWrite(copied);
+		receiver->lastActive = idleTimers.currentTick;
+		serverMetrics::add(metrics.bytesIn, copied);
+		if(!handleMessages(client)){
+			return;
+		}
+		data += copied;
+		length -= copied;
 
-					/* Send player d's information to the requestor */
-					// Generate player d's player data buffer
-					ss.str(std::string());  // Clear stringstream for next usage
-					ss << "p" << connectedSockets.at(d) << "`" << playerData.at(d).user << "`" << playerData.at(d).rank
-					   << "`" << playerData.at(d).headNum << "`" << playerData.at(d).bodyNum << "`" << playerData.at(d).footNum
-					   << "`" << playerData.at(d).speedPoints << "`" << playerData.at(d).jumpPoints << "`" << playerData.at(d).tractionPoints;
+	}
 
-					// Send it to the requestor
-					if(send(connectedSockets.at(senderNum), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-						reportError("send()", WSAGetLastError());
-					}
+}
 
-					// Check if player d is waiting for a race to start
-					if(playerData.at(d).roomID == 0 && playerData.at(d).raceMap != 0 && playerData.at(d).raceSlot != 0){
-
-						/* Tell the requestor which slot of which race player d is in */
-						ss.str(std::string());  // Clear stringstream for next usage
-						ss << "j" << playerData.at(d).raceMap << "`" << playerData.at(d).raceSlot << "`" << connectedSockets.at(d);
-						if(send(connectedSockets.at(senderNum), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-							reportError("send()", WSAGetLastError());
-						}
-
-						/* If player d is ready, tell the requestor that too */
-						if(lobbyMaps[playerData.at(d).raceMap - 1].playerStates[playerData.at(d).raceSlot - 1] == 2){
-							ss.str(std::string());  // Clear stringstream for next usage
-							ss << "r" << connectedSockets.at(d);
-							if(send(connectedSockets.at(senderNum), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-								reportError("send()", WSAGetLastError());
-							}
-						}
+bool socketServer::handleMessages(connectionHandle client){
 
-					}
+	/* Handle every complete message received so far. Anything incomplete is kept until the rest arrives */
+	connection *receiver = connections.get(client);
+	std::string_view message;
+	while(receiver->incoming.nextMessage(message)){
 
-				}
+		metrics.countMessage(message.data());
+		if(metrics.timing){
+			uint64_t dispatchStart = metricsNow();
+			handleBuffer(*receiver, message);  // Do something with the received message
+			metrics.dispatchTime.record(metricsNow() - dispatchStart);
+		}else{
+			handleBuffer(*receiver, message);
+		}
 
-			}
+		// Handling the message may have disconnected the client
+		receiver = connections.get(client);
+		if(receiver == NULL){
+			return false;
+		}
 
-			// Send the player the current MotD
-			if(send(connectedSockets.at(senderNum), motd.c_str(), motd.length() + 1, 0) < 0){
-				reportError("send()", WSAGetLastError());
-			}
+	}
+	return true;
 
-			// Send the player the last 20 chat messages
-			for(unsigned int d = 0; d < lastMessages.size(); d++){
-				if(send(connectedSockets.at(senderNum), lastMessages.at(d).c_str(), lastMessages.at(d).length() + 1, 0) < 0){
-					reportError("send()", WSAGetLastError());
-				}
-			}
+}
 
-		}else if(lastBuffer[0] == '^'){  // Chat message
+connection *socketServer::findPlayer(unsigned int playerID){
+	if(playerID == 0){
+		return NULL;
+	}
+	if(cluster.active()){
+		return playerID <= clusterPlayers.size() ? connections.get(clusterPlayers[playerID - 1]) : NULL;
+	}
+	return connections.find(playerID - 1);  // IDs are the connection's slot + 1
+}
 
-			// Generate a chat message buffer to send to the other players
-			std::string chatMessageBuffer = lastBuffer;
-			std::ostringstream ss; ss << connectedSockets.at(senderNum);
-			chatMessageBuffer.insert(1, ss.str() + "`" + playerData.at(senderNum).user + "`");
+void socketServer::queueMessage(connection &recipient, const char *message, unsigned int length, uint32_t coalesceKey){
 
-			if(lastMessages.size() == 20){
-				lastMessages.erase(lastMessages.begin());  // If 20 chat messages are being stored, discard the first
-			}
-			lastMessages.push_back(chatMessageBuffer);  // Store chat message (max 20)
+	if(recipient.worker != 0){  // The recipient is racing, so their race's worker has to send it
+		workerCommand command;
+		command.type = workerCommand::SEND;
+		command.handle = recipient.handle;
+		command.coalesceKey = coalesceKey;
+		command.message = sharedMessageRef::copy(message, length);
+		workerOutboxes.at(recipient.worker - 1).push_back(std::move(command));
+		return;
+	}
 
-			for(unsigned int d = 0; d < playerData.size(); d++){  // Send the chat message to all clients who aren't racing
-				if(playerData.at(d).roomID == playerData.at(senderNum).roomID){  // Make sure the client is in the same "room" as the player
-					if(send(connectedSockets.at(d), chatMessageBuffer.c_str(), chatMessageBuffer.length() + 1, 0) < 0){
-						reportError("send()", WSAGetLastError());
-					}
-				}
+	recipient.outgoing.push(message, length, coalesceKey);
+	if(!recipient.outgoing.flushScheduled){
+		recipient.outgoing.flushScheduled = true;
+		pendingSends.push_back(recipient.handle);
+	}
+
+}
+
+void socketServer::queueMessage(connection &recipient, const sharedMessageRef &message, uint32_t coalesceKey){
+
+	if(recipient.worker != 0){
+		workerCommand command;
+		command.type = workerCommand::SEND;
+		command.handle = recipient.handle;
+		command.coalesceKey = coalesceKey;
+		command.message = message;
+		workerOutboxes.at(recipient.worker - 1).push_back(std::move(command));
+		return;
+	}
+
+	recipient.outgoing.push(message, coalesceKey);
+	if(!recipient.outgoing.flushScheduled){
+		recipient.outgoing.flushScheduled = true;
+		pendingSends.push_back(recipient.handle);
+	}
+
+}
+
+void socketServer::queueMessage(unsigned int playerID, const char *message, unsigned int length){
+
+	connection *recipient = findPlayer(playerID);
+	if(recipient != NULL){
+		queueMessage(*recipient, message, length);
+	}
+
+}
+
+void socketServer::queueRoomMessage(unsigned int roomID, const sharedMessageRef &message, uint32_t coalesceKey){
+
+	const std::vector<connectionHandle> &members = rooms.members(roomID);
+	for(unsigned int d = 0; d < members.size(); d++){
+		queueMessage(*connections.get(members.at(d)), message, coalesceKey);
+	}
+
+}
+
+void socketServer::queueChatMessage(unsigned int roomID, const sharedMessageRef &message){
+
+	// Chat is the first thing to go when a client can't keep up, so what's queued for them is mostly game state
+	const std::vector<connectionHandle> &members = rooms.members(roomID);
+	for(unsigned int d = 0; d < members.size(); d++){
+		connection &recipient = *connections.get(members.at(d));
+		if(limits.chatBytes != 0 && recipient.worker == 0 && recipient.outgoing.queuedBytes > limits.chatBytes){
+			serverMetrics::add(metrics.slowChatDropped, 1);
+			continue;
+		}
+		queueMessage(recipient, message);
+	}
+
+}
+
+void socketServer::queueRegisteredMessage(const sharedMessageRef &message, unsigned int exceptID, uint32_t coalesceKey){
+
+	for(unsigned int d = 0; d < connections.size(); d++){
+		if(connections.at(d).registered && connections.at(d).id != exceptID){
+			queueMessage(connections.at(d), message, coalesceKey);
+		}
+	}
+
+}
+
+void socketServer::broadcastLobby(const sharedMessageRef &message, uint32_t coalesceKey, bool chat){
+
+	if(chat){
+		queueChatMessage(LOBBY_ROOM, message);
+	}else{
+		queueRoomMessage(LOBBY_ROOM, message, coalesceKey);
+	}
+	if(cluster.active() && !cluster.postOthers(chat ? clusterMessage::CHAT : clusterMessage::LOBBY, 0, message->data(), message->length, coalesceKey)){
+		serverMetrics::add(metrics.clusterDropped, 1);
+	}
+
+}
+
+void socketServer::broadcastRegistered(const sharedMessageRef &message, unsigned int exceptID, uint32_t coalesceKey){
+
+	queueRegisteredMessage(message, exceptID, coalesceKey);
+	if(cluster.active() && !cluster.postOthers(clusterMessage::REGISTERED, exceptID, message->data(), message->length, coalesceKey)){
+		serverMetrics::add(metrics.clusterDropped, 1);
+	}
+
+}
+
+void socketServer::relayRaceMessage(connection &sender, std::string_view message, bool includeSender, bool batched){
+
+	if(sender.playerData.roomID == LOBBY_ROOM){  // Race messages from players who aren't racing have nowhere to go
+		return;
+	}
+
+	// The message is a view into the sender's receive buffer, so it can be queued for each racer without copying it first.
+	// Only the latest position matters, so a racer that hasn't been sent the sender's last one yet gets this one instead
+	uint32_t coalesceKey = message[0] == 'q' ? sendQueue::coalesceKey('q', sender.id) : 0;
+	const std::vector<connectionHandle> &racers = rooms.members(sender.playerData.roomID);
+	for(unsigned int d = 0; d < racers.size(); d++){
+		if(includeSender || racers[d] != sender.handle){
+			connection &racer = *connections.get(racers[d]);
+			if(batched && racer.worker == 0){  // Queued behind anything already waiting, but only sent on the tick (or with the next unbatched message)
+				racer.outgoing.push(message.data(), message.length() + 1, coalesceKey);
+			}else{
+				queueMessage(racer, message.data(), message.length() + 1, coalesceKey);
 			}
+		}
+	}
+	if(batched){
+		ticker.schedule(sender.playerData.roomID);
+	}
 
-			/* Print chat message in terminal */
-			ss.str(std::string());  // Clear stringstream for next usage
-			ss << playerData.at(senderNum).user << "(#" << connectedSockets.at(senderNum) << "): " << (lastBuffer + 1);
-			printf("%s\n", ss.str().c_str());
-
-		}else if(lastBuffer[0] == 'j'){  // Joining or leaving a race slot
-
-			unsigned int grave = strchr(lastBuffer, '`') - lastBuffer;
-			std::string raceMapStr = lastBuffer;
-			std::string raceSlotStr = raceMapStr.substr(grave + 1, raceMapStr.length());
-			raceMapStr = raceMapStr.substr(1, raceMapStr.length() - grave);
-
-			unsigned int raceMap = 0;
-			std::istringstream(raceMapStr) >> raceMap;
-			unsigned int raceSlot = 0;
-			std::istringstream(raceSlotStr) >> raceSlot;
-			int raceStart = 0;
-
-			if(raceMap > 0 && raceMap < 9 && raceSlot > 0 && raceSlot < 5){  // The player is joining or switching a race slot
-
-				if(lobbyMaps[raceMap - 1].playerIDs[raceSlot - 1] == 0){
-
-					float minRank = 300.f;
-					switch(raceMap){
-						case 1:
-							minRank = 0.f;	// Newbieland (0)
-						break;
-						case 2:
-							minRank = 0.1f;   // Buto (0.1)
-						break;
-						case 3:
-							minRank = 3.f;	// Pyramids (3)
-						break;
-						case 4:
-							minRank = 10.f;   // Robocity (10)
-						break;
-						case 5:
-							minRank = 20.f;   // Assembly (20)
-						break;
-						case 6:
-							minRank = 50.f;   // Infernal Hop (50)
-						break;
-						case 7:
-							minRank = 150.f;  // Going down (150)
-						break;
-						case 8:
-							minRank = 300.f;  // Slip (300)
-						break;
-					}
+}
 
-					if(playerData.at(senderNum).rank >= minRank){  // Make sure the player is on a high enough rank to join
+void socketServer::flushSendQueues(){
 
-						// If raceMap and raceSlot are greater than 0, the player is switching to another a race slot
-						if(playerData.at(senderNum).raceMap > 0 && playerData.at(senderNum).raceSlot > 0){
+	#ifdef POLLER_HAS_URING
+		if(poller.batchesSends()){
+			submitSendQueues();
+			return;
+		}
+	#endif
 
-							lobbyMaps[playerData.at(senderNum).raceMap - 1].playerIDs[playerData.at(senderNum).raceSlot - 1] = 0;
-							lobbyMaps[playerData.at(senderNum).raceMap - 1].playerStates[playerData.at(senderNum).raceSlot - 1] = 0;
-							if(lobbyMaps[playerData.at(senderNum).raceMap - 1].raceReady()){
-								raceStart = playerData.at(senderNum).raceMap;
-							}
+	// Disconnecting a client may queue more messages, so pendingSends can grow while it's being looped through
+	for(unsigned int d = 0; d < pendingSends.size(); d++){
 
-						}
+		connection *recipient = connections.get(pendingSends.at(d));
+		if(recipient == NULL){  // The client has disconnected since its messages were queued
+			continue;
+		}
 
-						playerData.at(senderNum).raceMap = raceMap;
-						playerData.at(senderNum).raceSlot = raceSlot;
-						lobbyMaps[raceMap - 1].playerIDs[raceSlot - 1] = connectedSockets.at(senderNum);
-						lobbyMaps[raceMap - 1].playerStates[raceSlot - 1] = 1;
+		recipient->outgoing.flushScheduled = false;
+		unsigned int queuedBytes = recipient->outgoing.queuedBytes;
+		bool sent = recipient->outgoing.flush(recipient->socket);
+		serverMetrics::add(metrics.bytesOut, queuedBytes - recipient->outgoing.queuedBytes);
+		if(!sent){
+			serverMetrics::add(metrics.sendFailures, 1);
+			reportError("send()", lastSocketError());
+			printf("Closing connection with socket #%i.\n\n", recipient->socket);
+			disconnectSocket(*recipient);
+			continue;
+		}
+		if(!checkBacklog(*recipient)){
+			continue;
+		}
+		poller.setWriteInterest(recipient->socket, !recipient->outgoing.empty());  // If anything is left, send it once the socket is writable
 
-						// Notify all clients who aren't racing that the player is joining or switching a race slot
-						std::ostringstream ss; ss << lastBuffer << "`" << connectedSockets.at(senderNum);
-						for(unsigned int d = 0; d < playerData.size(); d++){
-							if(playerData.at(d).roomID == 0){
-								if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-									reportError("send()", WSAGetLastError());
-								}
-							}
-						}
+	}
+	pendingSends.clear();
 
-					}
+}
 
-				}
+#ifdef POLLER_HAS_URING
+void socketServer::submitSendQueues(){
 
-			}else{  // The player is leaving a race slot or is not in one
+	// Each round gives every queue one sendmsg(), all submitted to io_uring together. Queues with more than one sendmsg()'s
+	// worth go again in the next round, along with any queued for by disconnecting someone
+	while(!pendingSends.empty()){
 
-				if(lobbyMaps[playerData.at(senderNum).raceMap - 1].playerIDs[playerData.at(senderNum).raceSlot - 1] == connectedSockets.at(senderNum)){
+		sendBatch.swap(pendingSends);
+		if(batchedSends.size() < sendBatch.size()){
+			batchedSends.resize(sendBatch.size());
+			sendResults.resize(sendBatch.size());
+		}
+		for(unsigned int d = 0; d < sendBatch.size(); d++){
+			connection *recipient = connections.get(sendBatch.at(d));
+			batchedSend &batched = batchedSends.at(d);
+			batched.gatheredBytes = 0;
+			if(recipient == NULL || recipient->outgoing.empty()){
+				continue;
+			}
+			recipient->outgoing.flushScheduled = false;
+			memset(&batched.message, 0, sizeof(batched.message));
+			batched.message.msg_iov = batched.buffers;
+			batched.message.msg_iovlen = recipient->outgoing.gather(batched.buffers, batched.gatheredBytes);
+			poller.queueSend(recipient->socket, &batched.message, d);
+		}
+		if(!poller.submitSends(sendResults)){  // The sends it couldn't finish have failed with the error, so those clients are disconnected below
+			reportError("io_uring_enter()", lastSocketError());
+		}
 
-					lobbyMaps[playerData.at(senderNum).raceMap - 1].playerIDs[playerData.at(senderNum).raceSlot - 1] = 0;
-					lobbyMaps[playerData.at(senderNum).raceMap - 1].playerStates[playerData.at(senderNum).raceSlot - 1] = 0;
-					if(lobbyMaps[playerData.at(senderNum).raceMap - 1].raceReady()){
-						raceStart = playerData.at(senderNum).raceMap;
-					}
+		for(unsigned int d = 0; d < sendBatch.size(); d++){
 
-					playerData.at(senderNum).raceMap = 0;
-					playerData.at(senderNum).raceSlot = 0;
-
-					// Notify all clients who aren't racing that the player is leaving a race slot
-					std::ostringstream ss; ss << "jnone`none`" << connectedSockets.at(senderNum);
-					for(unsigned int d = 0; d < playerData.size(); d++){
-						if(playerData.at(d).roomID == 0){
-							if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-								reportError("send()", WSAGetLastError());
-							}
-						}
-					}
+			connection *recipient = connections.get(sendBatch.at(d));
+			if(recipient == NULL){  // The client has disconnected since its messages were queued (or earlier in this round)
+				continue;
+			}
+			if(batchedSends.at(d).gatheredBytes == 0){
+				continue;
+			}
 
+			int sent = sendResults.at(d);
+			if(sent < 0 && sent != -EAGAIN && sent != -EWOULDBLOCK){
+				serverMetrics::add(metrics.sendFailures, 1);
+				reportError("sendmsg()", -sent);
+				printf("Closing connection with socket #%i.\n\n", recipient->socket);
+				disconnectSocket(*recipient);
+				continue;
+			}
+			if(sent > 0){
+				recipient->outgoing.advance(sent);
+				serverMetrics::add(metrics.bytesOut, sent);
+			}
+			if((unsigned int)sent == batchedSends.at(d).gatheredBytes && !recipient->outgoing.empty()){  // Everything gathered went, so there may be room for the rest
+				if(!recipient->outgoing.flushScheduled){  // Unless more was queued for them earlier in this round
+					recipient->outgoing.flushScheduled = true;
+					pendingSends.push_back(sendBatch.at(d));
 				}
-
+				continue;
 			}
 
-			if(raceStart > 0){
-				startRace(raceStart);
+			recipient->outgoing.noteBacklog();
+			if(!checkBacklog(*recipient)){
+				continue;
 			}
+			poller.setWriteInterest(recipient->socket, !recipient->outgoing.empty());
 
-		}else if(lastBuffer[0] == 'r'){  // Player has readied up
+		}
+		sendBatch.clear();
 
-			// If the player is waiting to race
-			if(playerData.at(senderNum).roomID == 0 && playerData.at(senderNum).raceMap != 0 && playerData.at(senderNum).raceSlot != 0){
+	}
 
-				lobbyMaps[playerData.at(senderNum).raceMap - 1].playerStates[playerData.at(senderNum).raceSlot - 1] = 2;  // Set the player's state to ready
+}
+#endif
 
-				std::ostringstream ss; ss << "r" << connectedSockets.at(senderNum);
-				for(unsigned int d = 0; d < playerData.size(); d++){  // Notify all clients who aren't racing that the player has readied themselves
-					if(playerData.at(d).roomID == 0){
-						if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-							reportError("send()", WSAGetLastError());
-						}
-					}
-				}
+bool socketServer::checkBacklog(connection &recipient){
 
-				if(lobbyMaps[playerData.at(senderNum).raceMap - 1].raceReady()){  // If everyone is ready, start the race
-					startRace(playerData.at(senderNum).raceMap);
-				}
+	sendQueue::backlogState backlog = recipient.outgoing.backlog(limits);
+	if(backlog == sendQueue::BACKLOG_OK){
+		return true;
+	}
+
+	if(backlog == sendQueue::BACKLOG_TOO_BIG){
+		serverMetrics::add(metrics.slowTooBig, 1);
+		printf("Socket #%i has more than %u bytes waiting to be sent, closing connection.\n", recipient.socket, limits.maxBytes);
+	}else{
+		serverMetrics::add(metrics.slowTooOld, 1);
+		printf("Socket #%i hasn't caught up on what it's been sent for %u second(s), closing connection.\n", recipient.socket, limits.maxAge);
+	}
+	disconnectSocket(recipient);
+	return false;
 
+}
+
+void socketServer::flushRaceTicks(){
+
+	ticker.take(tickedRaces);
+	for(unsigned int d = 0; d < tickedRaces.size(); d++){
+		const std::vector<connectionHandle> &racers = rooms.members(tickedRaces[d]);  // Empty if the race has finished since
+		for(unsigned int r = 0; r < racers.size(); r++){
+			connection &racer = *connections.get(racers[r]);
+			if(racer.worker == 0 && !racer.outgoing.empty() && !racer.outgoing.flushScheduled){
+				racer.outgoing.flushScheduled = true;
+				pendingSends.push_back(racer.handle);
 			}
+		}
+	}
 
-		}else if(lastBuffer[0] == '#'){  // Race information has been sent
+}
 
-			if(lastBuffer[1] == 'q'){  // Sent once every second
+void socketServer::checkIdleTimers(){
 
-				std::string newMessage = lastBuffer;
-				newMessage.erase(newMessage.begin());  // Remove the hash from the beginning of the buffer before relaying it
+	idleTimers.advance(expiredTimers);
+	for(unsigned int d = 0; d < expiredTimers.size(); d++){
 
-				for(unsigned int d = 0; d < 4; d++){  // Relay the buffer to every other player in the race
-					if(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != connectedSockets.at(senderNum) &&
-					   currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != 0){
+		connectionHandle client = connectionHandle::unpack(expiredTimers[d]);
+		connection *idleClient = connections.get(client);
+		if(idleClient == NULL){  // Disconnected since the timer was set
+			continue;
+		}
 
-						if(send(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d], newMessage.c_str(), newMessage.length() + 1, 0) < 0){
-							reportError("send()", WSAGetLastError());
-						}
+		// Racers on a worker are timed out there. Otherwise, sending anything since the timer was set pushes it back
+		uint64_t expiry = idleClient->lastActive + idleTimeout;
+		if(idleClient->worker != 0){
+			expiry = idleTimers.currentTick + idleTimeout;
+		}
+		if(expiry > idleTimers.currentTick){
+			idleTimers.schedule(expiredTimers[d], expiry);
+			continue;
+		}
 
-					}
-				}
+		serverMetrics::add(metrics.idleDisconnects, 1);
+		printf("Socket #%i hasn't sent anything in %u second(s), closing connection.\n", idleClient->socket, idleTimeout);
+		disconnectSocket(*idleClient);
 
-			}else if(lastBuffer[1] == 't'){  // Player has pressed or released a valid input key (up, down, left, right and spacebar)
+	}
 
-				std::string newMessage = lastBuffer;
-				newMessage.erase(newMessage.begin());  // Remove the hash from the beginning of the buffer before relaying it
+}
 
-				for(unsigned int d = 0; d < 4; d++){  // Relay the buffer to every other player in the race
-					if(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != connectedSockets.at(senderNum) &&
-					   currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != 0){
+// Every message is routed by its first character, and '#' and '%' messages by their second character as well, so finding a
+// message's handler is one or two lookups however many opcodes there are. Characters without a handler of their own go
+// to handleUnknown()
+struct messageRoutes{
+	messageRoute routes[256];
+};
+
+static constexpr messageRoutes unknownRoutes(){
+	messageRoutes table = {};
+	for(unsigned int d = 0; d < 256; d++){
+		table.routes[d] = messageRoute{&socketServer::handleUnknown, NULL, MESSAGE_OTHER};
+	}
+	return table;
+}
 
-						if(send(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d], newMessage.c_str(), newMessage.length() + 1, 0) < 0){
-							reportError("send()", WSAGetLastError());
-						}
+static constexpr messageRoutes raceRoutes = [](){  // Second characters of '#' messages
+	messageRoutes table = unknownRoutes();
+	table.routes['q'] = messageRoute{&socketServer::handleRaceInput, NULL, MESSAGE_Q};
+	table.routes['t'] = messageRoute{&socketServer::handleRaceInput, NULL, MESSAGE_T};
+	table.routes['k'] = messageRoute{&socketServer::handleRaceInput, NULL, MESSAGE_K};
+	table.routes['s'] = messageRoute{&socketServer::handleLeaveRace, NULL, MESSAGE_S};
+	return table;
+}();
+
+static constexpr messageRoutes resultRoutes = [](){  // Second characters of '%' messages
+	messageRoutes table = unknownRoutes();
+	table.routes['f'] = messageRoute{&socketServer::handleFinishTime, NULL, MESSAGE_F};
+	return table;
+}();
+
+static constexpr messageRoutes messageHandlers = [](){
+	messageRoutes table = unknownRoutes();
+	table.routes['n'] = messageRoute{&socketServer::handlePlayerData, NULL, MESSAGE_N};
+	table.routes['o'] = messageRoute{&socketServer::handleJoinLobby, NULL, MESSAGE_O};
+	table.routes['^'] = messageRoute{&socketServer::handleChat, NULL, MESSAGE_CHAT};
+	table.routes['j'] = messageRoute{&socketServer::handleRaceSlot, NULL, MESSAGE_J};
+	table.routes['r'] = messageRoute{&socketServer::handleReady, NULL, MESSAGE_R};
+	table.routes['#'] = messageRoute{&socketServer::handleUnknown, raceRoutes.routes, MESSAGE_OTHER};
+	table.routes['%'] = messageRoute{&socketServer::handleUnknown, resultRoutes.routes, MESSAGE_OTHER};
+	table.routes['b'] = messageRoute{&socketServer::handleRankUpdate, NULL, MESSAGE_B};
+	table.routes['a'] = messageRoute{&socketServer::handleKeepAlive, NULL, MESSAGE_A};
+	return table;
+}();
+
+static const messageRoute &routeOf(const char *message){  // Messages are null-terminated, so a one character message still has a second character to look up
+	const messageRoute &route = messageHandlers.routes[(unsigned char)message[0]];
+	return route.subcodes == NULL ? route : route.subcodes[(unsigned char)message[1]];
+}
 
-					}
-				}
+void socketServer::handleBuffer(connection &sender, std::string_view message){
+
+	arenaScope scope(scratch);  // Whatever is built in scratch is freed when the message has been handled
+
+	if(!sender.registered && message[0] != 'n'){  // Make sure the socket has registered valid player data
+		handleUnregistered(sender, message);
+		return;
+	}
 
-			}else if(lastBuffer[1] == 'k'){  // Player has obtained an item
+	const messageRoute &route = routeOf(message.data());
+	#ifdef PR1SERVER_HANDLER_TIMING
+		uint64_t startCycles = cycleCount();
+		(this->*route.handler)(sender, message);
+		metrics.handlerCycles[route.type].record(cycleCount() - startCycles);
+	#else
+		(this->*route.handler)(sender, message);
+	#endif
 
-				std::string newMessage = lastBuffer;
-				newMessage.erase(newMessage.begin());  // Remove the hash from the beginning of the buffer before relaying it
+}
 
-				for(unsigned int d = 0; d < 4; d++){  // Relay the buffer to every other player in the race
-					if(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != connectedSockets.at(senderNum) &&
-					   currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != 0){
+void socketServer::handlePlayerData(connection &sender, std::string_view message){
 
-						if(send(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d], newMessage.c_str(), newMessage.length() + 1, 0) < 0){
-							reportError("send()", WSAGetLastError());
-						}
+	player &newPlayer = parsedPlayer;
+	newPlayer.reset();  // Fields that are only whitespace keep their old value, so start from the defaults
+	if(newPlayer.infoIsValid(message)){  // Validate player data
 
-					}
+		if(!sender.registered){  // If the player is new, register their player data
+
+			sender.playerData = newPlayer;
+			sender.playerData.updateRecord(sender.id);
+			if(!publishRecord(sender)){
+				printf("Socket #%i has sent suspicious player data, closing connection.\n", sender.socket);
+				disconnectSocket(sender);
+				return;
+			}
+			sender.registered = true;
+			rooms.join(sender.handle, LOBBY_ROOM);
+			lobby.recordAdded(sender.playerData.record);
+
+			std::string_view acknowledgement = scratch.format("i%u", sender.id);
+			queueMessage(sender, acknowledgement.data(), acknowledgement.length() + 1);  // Acknowledge connection and return player ID
+
+		}else{
+			if(sender.playerData.rank == newPlayer.rank){  // Make sure the player's rank has not changed
+
+				sender.playerData = newPlayer;  // If all is good, update the player's information
+				sender.playerData.updateRecord(sender.id);  // Regenerate the player data buffer using the new information provided
+				if(!publishRecord(sender)){
+					printf("Socket #%i has sent suspicious player data, closing connection.\n", sender.socket);
+					disconnectSocket(sender);
+					return;
 				}
+				lobby.recordsChanged();
+				rooms.join(sender.handle, LOBBY_ROOM);  // The new information puts the player back in the lobby
 
-			}else if(lastBuffer[1] == 's'){  // Player has left the race
+				// Send the new player data to all clients who aren't racing
+				broadcastLobby(sharedMessageRef::copy(sender.playerData.record), sendQueue::coalesceKey('p', sender.id));
 
-				leaveRace(senderNum);
+			}else{  // If it has changed without the server's knowledge, disconnect them (not really a good solution)
+
+				printf("Socket #%i has sent suspicious player data, closing connection.\n", sender.socket);
+				disconnectSocket(sender);
 
-			}else{
-				printf("Unable to interpret data sent by socket #%i: %s\n", connectedSockets.at(senderNum), lastBuffer);
 			}
+		}
 
-		}else if(lastBuffer[0] == '%' && lastBuffer[1] == 'f'){  // Player has finished a race and is sending their time
+	}else{  // If the player data isn't valid, disconnect them
 
-			std::string newMessage = lastBuffer;
-			newMessage.erase(newMessage.begin());  // Remove the percent sign from the beginning of the buffer before relaying it
+		printf("Socket #%i has sent suspicious player data, closing connection.\n", sender.socket);
+		disconnectSocket(sender);
 
-			for(unsigned int d = 0; d < 4; d++){  // Relay the buffer to all players in the race
-				if(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d] != 0){
+	}
 
-					if(send(currentRaces.at(playerData.at(senderNum).roomID - 1).playerIDs[d], newMessage.c_str(), newMessage.length() + 1, 0) < 0){
-						reportError("send()", WSAGetLastError());
-					}
+}
 
-				}
-			}
+void socketServer::handleJoinLobby(connection &sender, std::string_view){
+
+	if(sender.playerData.roomID != 0){  // If the player has finished a singleplayer race, call leaveRace()
+		leaveRace(sender);
+	}
+
+	/* Send the requestor's information to the other clients */
+	const std::string &senderData = sender.playerData.record;  // The sender's player data buffer
+	broadcastRegistered(sharedMessageRef::copy(senderData), sender.id, sendQueue::coalesceKey('p', sender.id));
+
+	/* Send the requestor everyone's information (their own included), the race slots, the MotD and the last 20 chat messages in one go */
+	const sharedMessageRef &snapshot = cluster.active() ? lobby.get(cluster, motd) : lobby.get(connections, lobbyMaps, motd, lastMessages);
+	queueMessage(sender, snapshot);  // Only a reference, as everyone joining is sent the same snapshot until something changes
+
+}
+
+void socketServer::handleChat(connection &sender, std::string_view message){
+
+	const char *lastBuffer = message.data();  // Messages are still null-terminated inside the receive buffer
+	// Generate a chat message buffer to send to the other players
+	std::string_view chatMessageBuffer = scratch.format("^%u`%s`%s", sender.id, sender.playerData.user.c_str(), lastBuffer + 1);
+
+	if(cluster.active()){  // The other processes' lobbies show it too
+		clusterLock guard(cluster);
+		cluster.storeChat(chatMessageBuffer);
+	}else if(lastMessages.size() == 20){  // If 20 chat messages are being stored, the first is overwritten by the new one
+		std::rotate(lastMessages.begin(), lastMessages.begin() + 1, lastMessages.end());
+		lastMessages.back().assign(chatMessageBuffer);  // Rotating keeps each string's capacity, so this doesn't allocate once they're long enough
+	}else{
+		lastMessages.emplace_back(chatMessageBuffer);  // Store chat message (max 20)
+	}
+	lobby.chatChanged();
+
+	// Send the chat message to all clients in the same "room" as the player
+	sharedMessageRef chatMessage = sharedMessageRef::copy(chatMessageBuffer.data(), chatMessageBuffer.length() + 1);
+	if(sender.playerData.roomID == LOBBY_ROOM){
+		broadcastLobby(chatMessage, 0, true);
+	}else{
+		queueChatMessage(sender.playerData.roomID, chatMessage);
+	}
+
+	/* Print chat message in terminal */
+	printf("%s(#%u): %s\n", sender.playerData.user.c_str(), sender.id, lastBuffer + 1);
+
+}
 
-		}else if(lastBuffer[0] == 'b'){  // Player has finished a race and is requesting a rank update
+void socketServer::handleRaceSlot(connection &sender, std::string_view message){
 
-			if(playerData.at(senderNum).roomID != 0){
+	const char *lastBuffer = message.data();
+	// j<map>`<slot>, where anything that isn't a number (like "jnone`none") means the player is leaving their slot
+	std::string_view::size_type grave = message.find('`');
+	unsigned int raceMap = 0;
+	parseUnsigned(message.substr(1), raceMap);
+	unsigned int raceSlot = 0;
+	if(grave != std::string_view::npos){
+		parseUnsigned(message.substr(grave + 1), raceSlot);
+	}
+	int raceStart = 0;
+	clusterLock guard(cluster);  // Other processes' players may be after the same slots
+
+	if(raceMap > 0 && raceMap < 9 && raceSlot > 0 && raceSlot < 5){  // The player is joining or switching a race slot
+
+		if(lobbyMaps[raceMap - 1].playerIDs[raceSlot - 1] == 0){
+
+			float minRank = 300.f;
+			switch(raceMap){
+				case 1:
+					minRank = 0.f;	// Newbieland (0)
+				break;
+				case 2:
+					minRank = 0.1f;   // Buto (0.1)
+				break;
+				case 3:
+					minRank = 3.f;	// Pyramids (3)
+				break;
+				case 4:
+					minRank = 10.f;   // Robocity (10)
+				break;
+				case 5:
+					minRank = 20.f;   // Assembly (20)
+				break;
+				case 6:
+					minRank = 50.f;   // Infernal Hop (50)
+				break;
+				case 7:
+					minRank = 150.f;  // Going down (150)
+				break;
+				case 8:
+					minRank = 300.f;  // Slip (300)
+				break;
+			}
 
-				// A VERY long line that just calculates the player's new rank
-				playerData.at(senderNum).rank += currentRaces.at(playerData.at(senderNum).roomID - 1).calculateRank(connectedSockets.at(senderNum), playerData.at(senderNum).raceMap);
+			if(sender.playerData.rank >= minRank){  // Make sure the player is on a high enough rank to join
 
-				// Send the updated player data to all connected clients who aren't racing
-				std::ostringstream ss;
-				ss << "p" << connectedSockets.at(senderNum) << "`" << playerData.at(senderNum).user << "`" << playerData.at(senderNum).rank
-				   << "`" << playerData.at(senderNum).headNum << "`" << playerData.at(senderNum).bodyNum << "`" << playerData.at(senderNum).footNum
-				   << "`" << playerData.at(senderNum).speedPoints << "`" << playerData.at(senderNum).jumpPoints << "`" << playerData.at(senderNum).tractionPoints;
-				for(unsigned int d = 0; d < playerData.size(); d++){
-					if(playerData.at(d).roomID == 0 || connectedSockets.at(d) == connectedSockets.at(senderNum)){
-						if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-							reportError("send()", WSAGetLastError());
-						}
+				// If raceMap and raceSlot are greater than 0, the player is switching to another a race slot
+				if(sender.playerData.raceMap > 0 && sender.playerData.raceSlot > 0 && lobbyMaps[sender.playerData.raceMap - 1].playerIDs[sender.playerData.raceSlot - 1] == sender.id){
+
+					lobbyMaps[sender.playerData.raceMap - 1].playerIDs[sender.playerData.raceSlot - 1] = 0;
+					lobbyMaps[sender.playerData.raceMap - 1].playerStates[sender.playerData.raceSlot - 1] = 0;
+					if(lobbyMaps[sender.playerData.raceMap - 1].raceReady()){
+						raceStart = sender.playerData.raceMap;
 					}
+
 				}
 
+				sender.playerData.raceMap = raceMap;
+				sender.playerData.raceSlot = raceSlot;
+				lobbyMaps[raceMap - 1].playerIDs[raceSlot - 1] = sender.id;
+				lobbyMaps[raceMap - 1].playerStates[raceSlot - 1] = 1;
+
+				// Notify all clients who aren't racing that the player is joining or switching a race slot
+				std::string_view slotMessage = scratch.format("%s`%u", lastBuffer, sender.id);
+				broadcastLobby(sharedMessageRef::copy(slotMessage.data(), slotMessage.length() + 1));
+
 			}
 
-		}else if(lastBuffer[0] != 'a'){  // (a is sent every second, presumably to keep the connection alive)
-			printf("Unable to interpret data sent by socket #%i: %s\n", connectedSockets.at(senderNum), lastBuffer);
 		}
 
-	}else if(strncmp(lastBuffer, "<policy-file-request/>\0", 23) == 0){  // Check if the client is requesting a policy file
+	}else{  // The player is leaving a race slot or is not in one
+
+		if(sender.playerData.raceMap > 0 && sender.playerData.raceSlot > 0 && lobbyMaps[sender.playerData.raceMap - 1].playerIDs[sender.playerData.raceSlot - 1] == sender.id){
+
+			lobbyMaps[sender.playerData.raceMap - 1].playerIDs[sender.playerData.raceSlot - 1] = 0;
+			lobbyMaps[sender.playerData.raceMap - 1].playerStates[sender.playerData.raceSlot - 1] = 0;
+			if(lobbyMaps[sender.playerData.raceMap - 1].raceReady()){
+				raceStart = sender.playerData.raceMap;
+			}
+
+			sender.playerData.raceMap = 0;
+			sender.playerData.raceSlot = 0;
+
+			// Notify all clients who aren't racing that the player is leaving a race slot
+			std::string_view slotMessage = scratch.format("jnone`none`%u", sender.id);
+			broadcastLobby(sharedMessageRef::copy(slotMessage.data(), slotMessage.length() + 1));
 
-		if(send(connectedSockets.at(senderNum), "<?xml version=\"1.0\"?><cross-domain-policy><allow-access-from domain=\"*\" to-ports=\"*\"/></cross-domain-policy>\0", 109, 0) < 0){
-			reportError("send()", WSAGetLastError());
 		}
 
+	}
+
+	slotsChanged();
+	if(raceStart > 0){
+		startRace(raceStart);
+	}
+
+}
+
+void socketServer::handleReady(connection &sender, std::string_view){
+
+	// If the player is waiting to race (a race started by another process may have taken them out of their slot already)
+	clusterLock guard(cluster);
+	if(sender.playerData.roomID == 0 && sender.playerData.raceMap != 0 && sender.playerData.raceSlot != 0
+	   && lobbyMaps[sender.playerData.raceMap - 1].playerIDs[sender.playerData.raceSlot - 1] == sender.id){
+
+		lobbyMaps[sender.playerData.raceMap - 1].playerStates[sender.playerData.raceSlot - 1] = 2;  // Set the player's state to ready
+		slotsChanged();
+
+		std::string_view readyMessage = scratch.format("r%u", sender.id);
+		broadcastLobby(sharedMessageRef::copy(readyMessage.data(), readyMessage.length() + 1));  // Notify all clients who aren't racing that the player has readied themselves
+
+		if(lobbyMaps[sender.playerData.raceMap - 1].raceReady()){  // If everyone is ready, start the race
+			startRace(sender.playerData.raceMap);
+		}
+
+	}
+
+}
+
+void socketServer::handleRaceInput(connection &sender, std::string_view message){
+
+	// q is sent once every second, t when the player presses or releases a valid input key (up, down, left, right and spacebar), and k when they obtain an item
+	// Remove the hash from the beginning of the buffer before relaying it to every other player in the race. In tick mode positions wait for the tick
+	bool batched = ticker.enabled() && (message[1] == 'q' || !raceTickBypass);
+	relayRaceMessage(sender, message.substr(1), false, batched);
+
+}
+
+void socketServer::handleLeaveRace(connection &sender, std::string_view){
+	leaveRace(sender);
+}
+
+void socketServer::handleFinishTime(connection &sender, std::string_view message){
+	relayRaceMessage(sender, message.substr(1), true);  // Remove the percent sign from the beginning of the buffer before relaying it to all players in the race
+}
+
+void socketServer::handleRankUpdate(connection &sender, std::string_view){
+
+	if(sender.playerData.roomID != 0){
+
+		// A VERY long line that just calculates the player's new rank
+		sender.playerData.rank += currentRaces.at(sender.playerData.roomID).calculateRank(sender.id, sender.playerData.raceMap);
+		sender.playerData.updateRecord(sender.id);
+		publishRecord(sender);  // Ranks are short enough that the record always fits
+		lobby.recordsChanged();
+
+		// Send the updated player data to all connected clients who aren't racing
+		const std::string &senderData = sender.playerData.record;
+		broadcastLobby(sharedMessageRef::copy(senderData), sendQueue::coalesceKey('p', sender.id));
+		queueMessage(sender, senderData.c_str(), senderData.length() + 1, sendQueue::coalesceKey('p', sender.id));
+
+	}
+
+}
+
+void socketServer::handleKeepAlive(connection&, std::string_view){
+	// a is sent every second, presumably to keep the connection alive, so there's nothing to do
+}
+
+void socketServer::handleUnknown(connection &sender, std::string_view message){
+	printf("Unable to interpret data sent by socket #%i: %s\n", sender.socket, message.data());
+}
+
+void socketServer::handleUnregistered(connection &sender, std::string_view message){
+
+	if(strncmp(message.data(), "<policy-file-request/>\0", 23) == 0){  // Check if the client is requesting a policy file
+
+		queueMessage(sender, "<?xml version=\"1.0\"?><cross-domain-policy><allow-access-from domain=\"*\" to-ports=\"*\"/></cross-domain-policy>\0", 109);
+
 	}else{
-		printf("Socket #%i is trying to make requests before sending player data, closing connection.\n", connectedSockets.at(senderNum));
-		disconnectSocket(senderNum);
+		printf("Socket #%i is trying to make requests before sending player data, closing connection.\n", sender.socket);
+		disconnectSocket(sender);
+	}
+
+}
+
+bool socketServer::publishRecord(connection &client){
+	if(!cluster.active()){
+		return true;
 	}
+	clusterLock guard(cluster);
+	return cluster.publishRecord(client.id, client.playerData.record);
+}
 
+void socketServer::slotsChanged(){
+	lobby.slotsChanged();
+	if(cluster.active()){  // Only called while holding the lock
+		cluster.shared->slotsVersion++;
+	}
 }
 
 void socketServer::startRace(unsigned int raceMap){
 
-	unsigned int raceCreated = 0;
-	for(unsigned int d = 0; d < currentRaces.size(); d++){  // Find a race that is empty and replace it
-		if(currentRaces.at(d).raceEmpty){
-			currentRaces.at(d) = lobbyMaps[raceMap - 1].generateRace();  // Generate a new raceInstance in the place of an old one
-			raceCreated = d + 1;
-			d = currentRaces.size();  // Exit loop
+	clusterLock guard(cluster);
+	unsigned int raceCreated = currentRaces.allocate(lobbyMaps[raceMap - 1].generateRace());  // Reuses the most recently emptied race
+	slotsChanged();  // generateRace() clears the race's slots
+
+
+	arenaScope scope(scratch);
+	std::string_view startMessage = scratch.format("m%u", raceMap);  // Message for new racers
+	std::string_view clearMessage = scratch.format("z%u", raceMap);  // Message for players in the lobby (tells them to clear the slots for this race)
+
+	/* Move the players joining the race from the lobby into the race's room */
+	for(unsigned int d = 0; d < 4; d++){
+		unsigned int playerID = currentRaces.at(raceCreated).playerIDs[d];
+		connection *racer = findPlayer(playerID);
+		if(racer != NULL){
+			racer->playerData.roomID = raceCreated;
+			rooms.join(racer->handle, raceCreated);
+			queueMessage(*racer, startMessage.data(), startMessage.length() + 1);
+			pendingHandoffs.push_back(racer->handle);  // Only does anything if the race is given to a worker
+		}else if(playerID != 0 && cluster.active()){  // Connected to another process, which is asked to send them here
+			cluster.post(cluster.owner(playerID), clusterMessage::MIGRATE, playerID, NULL, 0, 0, raceCreated, raceMap);
 		}
 	}
-	if(raceCreated == 0){  // If there are no empty races, generate a new one
-		currentRaces.push_back(lobbyMaps[raceMap - 1].generateRace());
-		raceCreated = currentRaces.size();
+
+	if(!raceWorkers.empty()){  // Relay the race's input on the next worker
+		currentRaces.at(raceCreated).worker = nextWorker % raceWorkers.size() + 1;
+		nextWorker++;
 	}
 
+	broadcastLobby(sharedMessageRef::copy(clearMessage.data(), clearMessage.length() + 1));  // Tell the players left in the lobby to clear the slots for race raceMap
 
-	std::ostringstream ss; ss << "m" << raceMap;  // Message for new racers
-	std::ostringstream ss2; ss2 << "z" << raceMap;  // Message for players in the lobby (tells them to clear the slots for this race)
+}
 
-	for(unsigned int d = 0; d < playerData.size(); d++){
-		if(playerData.at(d).roomID == 0){  // Make sure the player is not racing
-			if(playerData.at(d).raceMap == raceMap){  // Check if the player is joining a race
-				playerData.at(d).roomID = raceCreated;
-				if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-					reportError("send()", WSAGetLastError());
-				}
-			}else{  // If the player is not racing, tell them to clear the slots for race raceMap
-				if(send(connectedSockets.at(d), ss2.str().c_str(), ss2.str().length() + 1, 0) < 0){
-					reportError("send()", WSAGetLastError());
-				}
-			}
-		}
+void socketServer::leaveRace(connection &racer){
+
+	unsigned int raceID = racer.playerData.roomID;
+	if(raceID == LOBBY_ROOM){  // Not racing (e.g. '#s' sent from the lobby)
+		return;
 	}
+	racer.playerData.roomID = 0;
+	racer.playerData.raceMap = 0;
+	racer.playerData.raceSlot = 0;
+	rooms.join(racer.handle, LOBBY_ROOM);
+	raceMembersChanged(raceID);
+	removeFromRace(raceID, racer.id);
 
 }
 
-void socketServer::leaveRace(unsigned int socketNum){
+void socketServer::removeFromRace(unsigned int raceID, unsigned int playerID){
 
-	unsigned int raceID = playerData.at(socketNum).roomID;
-	playerData.at(socketNum).roomID = 0;
-	playerData.at(socketNum).raceMap = 0;
-	playerData.at(socketNum).raceSlot = 0;
+	bool inRace = false;
+	for(unsigned int d = 0; d < 4; d++){
+		if(currentRaces.at(raceID).playerIDs[d] == playerID){
+			inRace = true;
+		}
+	}
+	if(!inRace){  // Already gone (the race may even have finished and been released)
+		return;
+	}
 
-	std::ostringstream ss; ss << "s" << connectedSockets.at(socketNum);
+	arenaScope scope(scratch);
+	std::string_view leftMessage = scratch.format("s%u", playerID);
 	bool nowEmpty = true;
 	for(unsigned int d = 0; d < 4; d++){  // Loop through each player in the race
-		if(currentRaces.at(raceID - 1).playerIDs[d] == connectedSockets.at(socketNum)){  // If this is the slot the player was in, clear it
+		if(currentRaces.at(raceID).playerIDs[d] == playerID){  // If this is the slot the player was in, clear it
 
-			currentRaces.at(raceID - 1).playerIDs[d] = 0;
+			currentRaces.at(raceID).playerIDs[d] = 0;
 
-		}else if(currentRaces.at(raceID - 1).playerIDs[d] != 0){  // If someone else is still racing, tell them the player left
+		}else if(currentRaces.at(raceID).playerIDs[d] != 0){  // If someone else is still racing, tell them the player left
 
 			nowEmpty = false;
-			if(send(currentRaces.at(raceID - 1).playerIDs[d], ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-				reportError("send()", WSAGetLastError());
+			queueMessage(currentRaces.at(raceID).playerIDs[d], leftMessage.data(), leftMessage.length() + 1);
+
+		}
+	}
+
+	if(nowEmpty){  // If the race is empty, its ID can be reused by the next race
+		currentRaces.release(raceID);
+	}
+
+}
+
+void socketServer::disconnectSocket(connection &client){
+
+	if(client.worker != 0){  // The worker is still watching the socket, so let it close it
+		workerCommand command;
+		command.type = workerCommand::DROP;
+		command.handle = client.handle;
+		workerOutboxes.at(client.worker - 1).push_back(std::move(command));
+	}else{
+		poller.removeSocket(client.socket);
+		closesocket(client.socket);
+	}
+
+	if(client.registered){  // If the socket had registered player data, clean up and tell the other clients they disconnected
+
+		if(client.playerData.raceMap != 0 && client.playerData.raceSlot != 0){
+
+			if(client.playerData.roomID == 0){  // If the player was in a race slot, remove them from it
+
+				clusterLock guard(cluster);
+				if(lobbyMaps[client.playerData.raceMap - 1].playerIDs[client.playerData.raceSlot - 1] == client.id){  // Unless a race has taken them out of it
+					lobbyMaps[client.playerData.raceMap - 1].playerIDs[client.playerData.raceSlot - 1] = 0;
+					lobbyMaps[client.playerData.raceMap - 1].playerStates[client.playerData.raceSlot - 1] = 0;
+					slotsChanged();
+					if(lobbyMaps[client.playerData.raceMap - 1].raceReady()){
+						startRace(client.playerData.raceMap);
+					}
+				}
+
+			}else{  // If the player was in a race, notify the other racers
+
+				leaveRace(client);
+
 			}
 
 		}
+
+		lobby.recordsChanged();  // Checked again when the lobby snapshot is next needed, by which time the client has been erased
+		arenaScope scope(scratch);
+		std::string_view leftMessage = scratch.format("d%u", client.id);
+		broadcastRegistered(sharedMessageRef::copy(leftMessage.data(), leftMessage.length() + 1), client.id);  // Notify all other clients that the player has disconnected
+
 	}
-	currentRaces.at(raceID - 1).raceEmpty = nowEmpty;
 
-	if(nowEmpty){  // If the race is empty, check for other empty races at the end of the currentRaces vector and destroy them
+	if(cluster.active()){  // The ID can be given to someone else now
+		clusterLock guard(cluster);
+		cluster.releaseID(client.id);
+		clusterPlayers[client.id - 1].index = slotMap<connection>::NO_SLOT;
+	}
 
-		for(unsigned int d = currentRaces.size(); d > 0; d--){
-			if(currentRaces.back().raceEmpty){
-				currentRaces.pop_back();
-			}else{
-				d = 0;
+	rooms.leave(client.handle);
+	connections.erase(client.handle);
+	serverMetrics::add(metrics.connectionsClosed, 1);  // Removing a connection is O(1), the last connection is moved into its place
+
+}
+
+void socketServer::startRaceWorkers(){
+
+	if(!lobbyInbox.init() || !poller.addSocket(lobbyInbox.wakeFD, INBOX_KEY)){
+		printf("Race workers are unavailable on this platform, relaying every race on the main thread.\n");
+		return;
+	}
+
+	for(unsigned int d = 0; d < raceWorkerCount; d++){
+		std::unique_ptr<raceWorker> worker(new raceWorker());
+		worker->ticker.setRate(raceTickRate);
+		worker->tickBypass = raceTickBypass;
+		worker->limits = limits;
+		worker->idleTimeout = idleTimeout;
+		if(!worker->start(d + 1, &lobbyInbox, &metrics)){
+			printf("Unable to start race worker %i.\n", d + 1);
+			break;
+		}
+		raceWorkers.push_back(std::move(worker));
+	}
+	workerOutboxes.resize(raceWorkers.size());
+
+	printf("Relaying races on %i worker thread(s).\n", (int)raceWorkers.size());
+
+}
+
+void socketServer::handleWorkerCommands(){
+
+	lobbyInbox.take(receivedCommands);
+
+	for(unsigned int d = 0; d < receivedCommands.size(); d++){
+
+		workerCommand &command = receivedCommands.at(d);
+		connection *client = connections.get(command.handle);
+
+		if(command.type == workerCommand::SEND){  // A racer sent something to someone the worker doesn't own
+
+			if(client != NULL){
+				queueMessage(*client, command.message, command.coalesceKey);
+			}
+
+		}else if(client == NULL){  // The lobby thread disconnected the racer while the worker was giving them back
+
+			closesocket(command.socket);
+
+		}else if(command.type == workerCommand::RETURN){  // The racer sent something only this thread can handle
+
+			client->worker = 0;
+			client->lastActive = idleTimers.currentTick;  // They've just sent something
+			std::swap(client->incoming, command.buffers->incoming);
+			std::swap(client->outgoing, command.buffers->outgoing);
+			if(!poller.addStream(client->socket, command.handle.pack())){
+				printf("Unable to watch socket #%i, closing connection.\n", client->socket);
+				disconnectSocket(*client);
+				continue;
 			}
+			if(!client->outgoing.empty() && !client->outgoing.flushScheduled){
+				client->outgoing.flushScheduled = true;
+				pendingSends.push_back(command.handle);
+			}
+
+			// Handle the messages the worker left in the buffer. If the player is still racing afterwards (e.g. after 'b'), they go back to the worker
+			if(handleMessages(command.handle) && connections.get(command.handle)->playerData.roomID != LOBBY_ROOM){
+				pendingHandoffs.push_back(command.handle);
+			}
+
+		}else if(command.type == workerCommand::DISCONNECTED){
+
+			client->worker = 0;  // The worker has stopped watching the socket, so it can be closed here
+			printf("Socket #%i has disconnected, closing connection.\n", client->socket);
+			disconnectSocket(*client);
+
+		}
+
+	}
+
+}
+
+void socketServer::raceMembersChanged(unsigned int raceID){
+
+	unsigned int worker = currentRaces.at(raceID).worker;
+	if(worker == 0){
+		return;
+	}
+
+	workerCommand command;
+	command.type = workerCommand::RACE_MEMBERS;
+	command.raceID = raceID;
+	command.members = rooms.members(raceID);
+	workerOutboxes.at(worker - 1).push_back(std::move(command));
+
+}
+
+void socketServer::handOffRacers(){
+
+	for(unsigned int d = 0; d < pendingHandoffs.size(); d++){
+
+		connection *racer = connections.get(pendingHandoffs.at(d));
+		if(racer == NULL || racer->worker != 0 || racer->playerData.roomID == LOBBY_ROOM){  // Disconnected, already handed off or no longer racing
+			continue;
+		}
+		unsigned int raceID = racer->playerData.roomID;
+		unsigned int worker = currentRaces.at(raceID).worker;
+		if(worker == 0){
+			continue;
+		}
+
+		// The socket and buffers move to the worker together, so nothing received or queued so far is lost. That includes
+		// anything io_uring had received that hadn't been handed out yet
+		unreadData.clear();
+		poller.removeSocket(racer->socket, &unreadData);
+		if(!racer->incoming.append(unreadData.data(), unreadData.length())){
+			printf("Socket #%i has sent a message longer than %i bytes, closing connection.\n", racer->socket, RECEIVE_BUFFER_SIZE);
+			disconnectSocket(*racer);
+			continue;
 		}
+		workerCommand command;
+		command.type = workerCommand::ADOPT;
+		command.handle = racer->handle;
+		command.socket = racer->socket;
+		command.raceID = raceID;
+		command.playerID = racer->id;
+		command.members = rooms.members(raceID);
+		command.buffers.reset(new connectionBuffers());
+		std::swap(command.buffers->incoming, racer->incoming);
+		std::swap(command.buffers->outgoing, racer->outgoing);
+		workerOutboxes.at(worker - 1).push_back(std::move(command));
+		racer->worker = worker;
 
 	}
+	pendingHandoffs.clear();
 
 }
 
-void socketServer::disconnectSocket(unsigned int socketNum){
-	closesocket(connectedSockets.at(socketNum));
-	FD_CLR(connectedSockets.at(socketNum), &socketSet);
+void socketServer::postWorkerCommands(){
+	for(unsigned int d = 0; d < raceWorkers.size(); d++){
+		raceWorkers.at(d)->inbox.post(workerOutboxes.at(d));
+	}
+}
+
+void socketServer::handleClusterMessages(){
+
+	cluster.clearWakeup();
+	if(cluster.processIndex == 0 && cluster.reapProcesses()){
+		for(unsigned int d = 0; d < cluster.exited.size(); d++){
+			forgetProcess(cluster.exited.at(d));
+		}
+		cluster.exited.clear();
+	}
+
+	clusterMessage *message;
+	while(cluster.next(message)){
+
+		if(message->type == clusterMessage::LOBBY){
+
+			queueRoomMessage(LOBBY_ROOM, sharedMessageRef::copy(message->data, message->length), message->coalesceKey);
+
+		}else if(message->type == clusterMessage::CHAT){
+
+			queueChatMessage(LOBBY_ROOM, sharedMessageRef::copy(message->data, message->length));
+
+		}else if(message->type == clusterMessage::REGISTERED){
+
+			queueRegisteredMessage(sharedMessageRef::copy(message->data, message->length), message->playerID, message->coalesceKey);
+
+		}else if(message->type == clusterMessage::MIGRATE){
+
+			migrationRequest request;  // Sent at the end of the pass, once everything received from them has been handled
+			request.from = message->from;
+			request.playerID = message->playerID;
+			request.raceID = message->raceID;
+			request.raceMap = message->raceMap;
+			pendingMigrations.push_back(request);
+
+		}else if(message->type == clusterMessage::MIGRATE_FAILED){  // The race carries on without them
 
-	if(socketNum < playerData.size()){  // If the socket had registered player data, clean up and tell the other clients they disconnected
+			serverMetrics::add(metrics.migrationsFailed, 1);
+			removeFromRace(message->raceID, message->playerID);
 
-		if(playerData.at(socketNum).raceMap != 0 && playerData.at(socketNum).raceSlot != 0){
+		}else if(message->type == clusterMessage::PROCESS_EXITED){
 
-			if(playerData.at(socketNum).roomID == 0){  // If the player was in a race slot, remove them from it
+			cluster.forget(message->playerID);
+			dropExitedRacers(message->playerID);
 
-				lobbyMaps[playerData.at(socketNum).raceMap - 1].playerIDs[playerData.at(socketNum).raceSlot - 1] = 0;
-				lobbyMaps[playerData.at(socketNum).raceMap - 1].playerStates[playerData.at(socketNum).raceSlot - 1] = 0;
-				if(lobbyMaps[playerData.at(socketNum).raceMap - 1].raceReady()){
-					startRace(playerData.at(socketNum).raceMap);
+		}
+		cluster.pop();
+
+	}
+
+}
+
+void socketServer::forgetProcess(unsigned int process){
+
+	printf("Server process %i has exited, removing its players.\n", process + 1);
+	cluster.forget(process);
+
+	// Its players never got to leave, so they're taken out of the lobby here as if they'd each disconnected
+	clusterLock guard(cluster);
+	bool slotsFreed[8] = {false};
+	for(unsigned int playerID = 1; playerID <= CLUSTER_MAX_PLAYERS; playerID++){
+
+		const sharedRecord &record = cluster.shared->records[playerID - 1];
+		if(!record.used || record.owner != process){
+			continue;
+		}
+		bool registered = record.length != 0;
+
+		for(unsigned int m = 0; m < 8; m++){
+			for(unsigned int d = 0; d < 4; d++){
+				if(lobbyMaps[m].playerIDs[d] == playerID){
+					lobbyMaps[m].playerIDs[d] = 0;
+					lobbyMaps[m].playerStates[d] = 0;
+					slotsFreed[m] = true;
+					slotsChanged();
 				}
+			}
+		}
+		cluster.releaseID(playerID);
 
-			}else{  // If the player was in a race, notify the other racers
+		if(registered){
+			arenaScope scope(scratch);
+			std::string_view leftMessage = scratch.format("d%u", playerID);
+			broadcastRegistered(sharedMessageRef::copy(leftMessage.data(), leftMessage.length() + 1), playerID);
+		}
+
+	}
+	lobby.recordsChanged();
+
+	for(unsigned int m = 0; m < 8; m++){
+		if(slotsFreed[m] && lobbyMaps[m].raceReady()){
+			startRace(m + 1);
+		}
+	}
 
-				leaveRace(socketNum);
+	// Races on any process may have been waiting for some of them to be moved over
+	cluster.postOthers(clusterMessage::PROCESS_EXITED, process, NULL, 0);
+	dropExitedRacers(process);
 
+}
+
+void socketServer::dropExitedRacers(unsigned int process){
+
+	clusterLock guard(cluster);
+	for(unsigned int raceID = 1; raceID <= currentRaces.races.size(); raceID++){
+		for(unsigned int d = 0; d < 4 && !currentRaces.at(raceID).raceEmpty; d++){
+			unsigned int playerID = currentRaces.at(raceID).playerIDs[d];
+			if(playerID == 0 || findPlayer(playerID) != NULL){
+				continue;
+			}
+			const sharedRecord &record = cluster.shared->records[playerID - 1];
+			if(!record.used || record.owner == process){  // Not coming, as they were never moved here
+				removeFromRace(raceID, playerID);
 			}
+		}
+	}
+
+}
+
+void socketServer::migrateRacers(){
+	for(unsigned int d = 0; d < pendingMigrations.size(); d++){
+		migrateRacer(pendingMigrations.at(d));
+	}
+	pendingMigrations.clear();
+}
+
+void socketServer::migrateRacer(const migrationRequest &request){
 
+	// They may have left, or still be racing somewhere, since the race started
+	connection *racer = findPlayer(request.playerID);
+	if(racer == NULL || racer->worker != 0 || racer->playerData.roomID != LOBBY_ROOM){
+		cluster.post(request.from, clusterMessage::MIGRATE_FAILED, request.playerID, NULL, 0, 0, request.raceID);
+		return;
+	}
+
+	// Stop watching the socket first, as io_uring may have received more from them that has to go along too
+	unreadData.clear();
+	poller.removeSocket(racer->socket, &unreadData);
+
+	migrationHeader header;
+	header.playerID = racer->id;
+	header.raceID = request.raceID;
+	header.raceMap = request.raceMap;
+	header.raceSlot = racer->playerData.raceSlot;
+	header.rank = racer->playerData.rank;
+	header.headNum = racer->playerData.headNum;
+	header.bodyNum = racer->playerData.bodyNum;
+	header.footNum = racer->playerData.footNum;
+	header.speedPoints = racer->playerData.speedPoints;
+	header.jumpPoints = racer->playerData.jumpPoints;
+	header.tractionPoints = racer->playerData.tractionPoints;
+	header.userLength = racer->playerData.user.length();
+	header.incomingLength = racer->incoming.unread().length() + unreadData.length();
+
+	std::string data;
+	racer->outgoing.copyUnsent(data);
+	header.outgoingLength = data.length();
+	data.insert(0, unreadData);
+	data.insert(0, racer->incoming.unread());
+	data.insert(0, racer->playerData.user);
+	data.insert(0, (const char *)&header, sizeof(header));
+
+	// The other process can only take as much unread data as fits in a receive buffer. io_uring can have received more
+	// than that since the racer's messages were last handled, in which case they stay here and it's handled as usual
+	if(header.incomingLength > RECEIVE_BUFFER_SIZE || data.length() > CLUSTER_MIGRATION_SIZE || !cluster.sendConnection(request.from, racer->socket, data)){
+		printf("Unable to move socket #%i to server process %i, it stays in the lobby.\n", racer->socket, request.from + 1);
+		racer->playerData.raceMap = 0;
+		racer->playerData.raceSlot = 0;
+		cluster.post(request.from, clusterMessage::MIGRATE_FAILED, request.playerID, NULL, 0, 0, request.raceID);
+		if(!poller.addStream(racer->socket, racer->handle.pack())){
+			printf("Unable to watch socket #%i, closing connection.\n", racer->socket);
+			disconnectSocket(*racer);
+			return;
 		}
+		if(unreadData.empty()){
+			handleMessages(racer->handle);
+		}else{
+			receivedData(racer->handle, unreadData.data(), unreadData.length());  // A bufferful at a time
+		}
+		return;
+	}
 
-		std::ostringstream ss; ss << "d" << connectedSockets.at(socketNum);
-		for(unsigned int d = 0; d < playerData.size(); d++){  // Notify all other clients that the player has disconnected
-			if(d != socketNum){
-				if(send(connectedSockets.at(d), ss.str().c_str(), ss.str().length() + 1, 0) < 0){
-					reportError("send()", WSAGetLastError());
-				}
+	// The other process has the socket now, so the player is forgotten here without anyone being told they've left
+	serverMetrics::add(metrics.migrationsOut, 1);
+	closesocket(racer->socket);
+	clusterPlayers[racer->id - 1].index = slotMap<connection>::NO_SLOT;
+	rooms.leave(racer->handle);
+	connections.erase(racer->handle);
+
+}
+
+void socketServer::adoptMigrants(){
+
+	SOCKET socket;
+	while((socket = cluster.receiveConnection()) != INVALID_SOCKET){
+
+		migrationHeader header;
+		if(cluster.migration.length() < sizeof(header)){
+			closesocket(socket);
+			continue;
+		}
+		memcpy(&header, cluster.migration.data(), sizeof(header));
+		if(sizeof(header) + header.userLength + header.incomingLength + header.outgoingLength != cluster.migration.length()
+		   || header.playerID == 0 || header.playerID > CLUSTER_MAX_PLAYERS){
+			closesocket(socket);
+			continue;
+		}
+
+		connection *racer = addConnection(socket, header.playerID);
+		if(racer == NULL){
+			printf("Unable to watch socket #%i, closing connection.\n", socket);
+			closesocket(socket);
+			removeFromRace(header.raceID, header.playerID);
+			arenaScope scope(scratch);
+			std::string_view leftMessage = scratch.format("d%u", header.playerID);
+			broadcastRegistered(sharedMessageRef::copy(leftMessage.data(), leftMessage.length() + 1), header.playerID);
+			clusterLock guard(cluster);
+			cluster.releaseID(header.playerID);
+			continue;
+		}
+		serverMetrics::add(metrics.migrationsIn, 1);
+		printf("Accepted socket #%i from another server process.\n", socket);
+
+		const char *data = cluster.migration.data() + sizeof(header);
+		racer->playerData.user.assign(data, header.userLength);
+		racer->playerData.rank = header.rank;
+		racer->playerData.headNum = header.headNum;
+		racer->playerData.bodyNum = header.bodyNum;
+		racer->playerData.footNum = header.footNum;
+		racer->playerData.speedPoints = header.speedPoints;
+		racer->playerData.jumpPoints = header.jumpPoints;
+		racer->playerData.tractionPoints = header.tractionPoints;
+		racer->playerData.updateRecord(racer->id);
+		racer->registered = true;
+		publishRecord(*racer);  // Only the owner changes
+		lobby.recordsChanged();
+		data += header.userLength;
+
+		// Pick up where the other process left off: an incomplete message they were sending, and whatever they hadn't been sent yet
+		if(!racer->incoming.append(data, header.incomingLength)){
+			printf("Socket #%i has sent a message longer than %i bytes, closing connection.\n", socket, RECEIVE_BUFFER_SIZE);
+			removeFromRace(header.raceID, header.playerID);
+			disconnectSocket(*racer);  // Tells everyone they've left and releases their ID, now that they're registered here
+			continue;
+		}
+		data += header.incomingLength;
+		if(header.outgoingLength > 0){
+			queueMessage(*racer, data, header.outgoingLength);
+		}
+
+		// Put them in the race, as startRace() would have if they'd been here all along
+		bool inRace = false;
+		for(unsigned int d = 0; d < 4; d++){
+			if(currentRaces.at(header.raceID).playerIDs[d] == racer->id){
+				inRace = true;
 			}
 		}
+		if(inRace){
+			racer->playerData.roomID = header.raceID;
+			racer->playerData.raceMap = header.raceMap;
+			racer->playerData.raceSlot = header.raceSlot;
+			rooms.join(racer->handle, header.raceID);
+			raceMembersChanged(header.raceID);
+			arenaScope scope(scratch);
+			std::string_view startMessage = scratch.format("m%u", header.raceMap);
+			queueMessage(*racer, startMessage.data(), startMessage.length() + 1);
+			pendingHandoffs.push_back(racer->handle);
+		}else{  // The race has already finished
+			rooms.join(racer->handle, LOBBY_ROOM);
+		}
+
+	}
+
+}
 
-		playerData.erase(playerData.begin() + socketNum);
+bool socketServer::startMetrics(){
 
+	metricsSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(metricsSocket == INVALID_SOCKET){
+		reportError("socket()", lastSocketError());
+		return 0;
 	}
-	connectedSockets.erase(connectedSockets.begin() + socketNum);
+	allowAddressReuse(metricsSocket);
+
+	// Only reachable from this machine, the metrics aren't meant for players
+	sockaddr_in metricsAddress;
+	memset(&metricsAddress, 0, sizeof(metricsAddress));
+	metricsAddress.sin_family = AF_INET;
+	metricsAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	metricsAddress.sin_port = htons(metricsPort);
+
+	if(bind(metricsSocket, (sockaddr*)&metricsAddress, sizeof(metricsAddress)) == SOCKET_ERROR || listen(metricsSocket, SOMAXCONN) == SOCKET_ERROR
+	   || !setNonBlocking(metricsSocket) || !poller.addSocket(metricsSocket, METRICS_SOCKET_KEY)){
+		reportError("startMetrics()", lastSocketError());
+		closesocket(metricsSocket);
+		metricsSocket = INVALID_SOCKET;
+		return 0;
+	}
+
+	metrics.timing = true;
+	return 1;
+
+}
+
+void socketServer::acceptMetricsClients(){
+
+	while(true){
+
+		SOCKET client = accept(metricsSocket, NULL, NULL);
+		if(client == INVALID_SOCKET){  // No more pending connections (or accept() failed, which isn't worth stopping for)
+			return;
+		}
+
+		// Wait for the request before answering, since closing a socket with unread data in it resets the connection
+		if(!setNonBlocking(client) || !poller.addSocket(client, METRICS_CLIENT_KEY + (uint64_t)client)){
+			closesocket(client);
+		}
+
+	}
+
+}
+
+void socketServer::serveMetrics(SOCKET client){
+
+	char request[1024];
+	while(recv(client, request, sizeof(request), 0) > 0);  // The request itself doesn't matter, any request gets the metrics
+
+	std::ostringstream body;
+	body << "pr1_connections " << connections.size() << "\n";
+	body << "pr1_lobby_players " << rooms.members(LOBBY_ROOM).size() << "\n";
+	body << "pr1_races " << currentRaces.size() << "\n";
+	body << "pr1_race_workers " << raceWorkers.size() << "\n";
+	body << "pr1_process " << cluster.processIndex << "\n";
+	body << "pr1_cluster_held_back_total " << cluster.heldBack << "\n";
+	metrics.write(body);
+
+	// Answered as HTTP, so the metrics can be read with a browser, curl or a Prometheus scraper
+	std::ostringstream header;
+	header << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << body.str().length() << "\r\nConnection: close\r\n\r\n";
+	std::string response = header.str() + body.str();
+
+	ioBuffer buffer;
+	setIOBuffer(buffer, response.data(), response.length());
+	sendBuffers(client, &buffer, 1);  // A few kilobytes, which fits in an empty socket buffer
+
+	poller.removeSocket(client);
+	closesocket(client);
+
 }
@@ -1,41 +1,103 @@
 #ifndef SOCKETSERVER_H
 #define SOCKETSERVER_H
 
-#ifdef _WIN32
-	#include <winsock2.h>
-	#include <ws2tcpip.h>
-	#define WINSOCK_VERSION MAKEWORD(2, 2)
-#else
-	#include <sys/socket.h>
-	#include <arpa/inet.h>
-	#include <netdb.h>
-	#include <unistd.h>
-	#define INVALID_SOCKET -1
-	#define SOCKET_ERROR -1
-	typedef int SOCKET;
-#endif
-
 #define DEFAULT_PORT 7249
+#define DEFAULT_IDLE_TIMEOUT 30  // Seconds, clients send "a" every second
 
+#define MASTER_SOCKET_KEY 0xFFFFFFFFFFFFFFFFULL  // Poller key of the master socket, which no packed connectionHandle can match
+#define METRICS_SOCKET_KEY 0xFFFFFFFFFFFFFFFDULL  // Poller key of the metrics socket
+#define METRICS_CLIENT_KEY 0xFFFFFFFE00000000ULL  // Poller keys of metrics clients are this plus the socket (a connectionHandle would need a generation of 0xFFFFFFFE)
+
+#include <memory>
 #include <vector>
-#include "player.hpp"
+#include "platform.hpp"
+#include "eventPoller.hpp"
+#include "connection.hpp"
+#include "roomIndex.hpp"
+#include "raceWorker.hpp"
 #include "lobbySlotHandler.hpp"
+#include "racePool.hpp"
+#include "lobbySnapshot.hpp"
+#include "metrics.hpp"
+#include "raceTicker.hpp"
+#include "timingWheel.hpp"
+#include "admissionFilter.hpp"
+#include "processCluster.hpp"
+#include "messageArena.hpp"
+
+#ifdef POLLER_HAS_URING
+// One connection's part of a round of sends submitted to io_uring together
+struct batchedSend{
+	msghdr message;
+	ioBuffer buffers[MAX_IO_BUFFERS];
+	unsigned int gatheredBytes;  // 0 if nothing was sent
+};
+#endif
+
+struct socketServer;
+typedef void (socketServer::*messageHandler)(connection &sender, std::string_view message);
+
+// An entry in the dispatch tables (see socketServer.cpp)
+struct messageRoute{
+	messageHandler handler;
+	const messageRoute *subcodes;  // If set, the handler is looked up in this table by the message's second character instead
+	messageType type;  // What the metrics count the message as
+};
 
 struct socketServer{
 
-	char ip[15];
+	char ip[16];
 	uint16_t port;
 	SOCKET masterSocket;	 // Host's socket object
-	FD_SET socketSet;		 // Set of connected sockets for select()
-	std::vector<SOCKET> connectedSockets;
-	int recvBytes;			 // Length of the last buffer recieved
-	char lastBuffer[2048];	 // Last buffer ("message") received from a client. Buffers are capped at 2,048 bytes (which is way more then you'll need here)
+	eventPoller poller;		 // Tells us which sockets have data waiting
+	eventPoller::backendType pollerBackend;  // Backend requested in the config (epoll where available, select otherwise)
+	std::vector<pollerEvent> readySockets;  // Sockets reported as ready by the last call to poller.wait()
+	slotMap<connection> connections;  // Every connected client, along with their player data and buffers
+	roomIndex rooms;  // Which connections are in the lobby and in each race
+	std::vector<connectionHandle> pendingSends;  // Connections with queued messages to flush at the end of this pass
+	#ifdef POLLER_HAS_URING
+		std::vector<connectionHandle> sendBatch;  // The connections in the current round of submitSendQueues()
+		std::vector<batchedSend> batchedSends;
+		std::vector<int> sendResults;
+	#endif
 	std::string motd;
+	messageArena scratch;  // Temporaries built while handling a message, freed once it's been handled
+	player parsedPlayer;  // Where 'n' messages are parsed, reused so parsing doesn't allocate
 
-	std::vector<player> playerData;
 	std::vector<std::string> lastMessages;  // Last 20 chat messages
-	lobbySlotHandler lobbyMaps[8];
-	std::vector<raceInstance> currentRaces;
+	lobbySlotHandler localMaps[8];
+	lobbySlotHandler *lobbyMaps;  // localMaps, or the shared lobby's when clustered
+	lobbySnapshot lobby;  // What players are sent when they join the lobby
+	racePool currentRaces;
+	unsigned int raceCapacity;  // Races to preallocate, from the config
+
+	unsigned int raceWorkerCount;  // Worker threads requested in the config (0 relays every race on this thread)
+	std::vector<std::unique_ptr<raceWorker> > raceWorkers;
+	unsigned int nextWorker;  // Races are given to the workers in turn
+	commandInbox lobbyInbox;  // Commands from the workers
+	std::vector<std::vector<workerCommand> > workerOutboxes;  // Commands for each worker, posted at the end of each pass
+	std::vector<workerCommand> receivedCommands;
+	std::vector<connectionHandle> pendingHandoffs;  // Racers to move to their race's worker at the end of this pass
+
+	unsigned int raceTickRate;  // Ticks per second for race input, from the config (0 relays it straight away)
+	bool raceTickBypass;  // Whether '#t' and '#k' skip the tick and are sent straight away
+	raceTicker ticker;  // Races relayed on this thread with batched input waiting
+	sendLimits limits;  // From the config
+	unsigned int idleTimeout;  // Seconds a client can go without sending anything before they're disconnected (0 for never)
+	timingWheel idleTimers;  // A timer for every connection, keyed by its packed handle
+	std::vector<uint64_t> expiredTimers;
+	admissionFilter xlist;  // Addresses from xlist.txt and the per-address connection rate limit
+	std::vector<unsigned int> tickedRaces;
+
+	unsigned int processCount;  // Server processes sharing the port, from the config
+	processCluster cluster;
+	std::vector<connectionHandle> clusterPlayers;  // Handle of each player connected to this process by ID - 1, when clustered
+	std::vector<migrationRequest> pendingMigrations;  // Racers to send to other processes at the end of this pass
+	std::string unreadData;  // What the poller had received from a socket it has stopped watching
+
+	uint16_t metricsPort;  // Port the metrics are served on (localhost only), 0 if they aren't
+	SOCKET metricsSocket;
+	serverMetrics metrics;
 
 	socketServer();
 	~socketServer();
@@ -44,11 +106,65 @@ struct socketServer{
 	bool loadConfig(const char *prgPath);
 	bool initServer(const int argc, const char *argv[]);
 	void handleConnections();
-	void handleBuffer(unsigned int senderID);
-	void storeChatMessage(std::string chatMessageBuffer);
+	void acceptConnections();
+	void admitConnection(SOCKET clientSocket, const sockaddr_in &clientAddress, uint64_t second);  // Checks the address against xlist.txt and the rate limit before adding the connection
+	static uint64_t currentSecond();  // For the rate limit
+	connection *addConnection(SOCKET clientSocket, unsigned int playerID = 0);  // Starts watching an accepted socket, returns NULL if it can't be watched. The ID is only given for migrated racers
+	void receiveData(connectionHandle client);
+	void receivedData(connectionHandle client, const char *data, unsigned int length);  // Data io_uring has already received
+	bool handleMessages(connectionHandle client);  // Handles every complete message in the client's receive buffer, returns false if they were disconnected
+	connection *findPlayer(unsigned int playerID);  // Returns NULL if no one is connected with that ID
+	void queueMessage(connection &recipient, const char *message, unsigned int length, uint32_t coalesceKey = 0);  // See sendQueue::push()
+	void queueMessage(connection &recipient, const sharedMessageRef &message, uint32_t coalesceKey = 0);
+	void queueMessage(unsigned int playerID, const char *message, unsigned int length);
+	// Messages for more than one player are built once as a shared message, and each recipient's queue refers to it
+	void queueRoomMessage(unsigned int roomID, const sharedMessageRef &message, uint32_t coalesceKey = 0);  // Queues the message for everyone in the lobby (LOBBY_ROOM) or a race
+	void queueChatMessage(unsigned int roomID, const sharedMessageRef &message);  // Like queueRoomMessage(), but skips anyone over the chat limit
+	void queueRegisteredMessage(const sharedMessageRef &message, unsigned int exceptID, uint32_t coalesceKey = 0);  // Queues the message for every registered player but one
+	void broadcastLobby(const sharedMessageRef &message, uint32_t coalesceKey = 0, bool chat = false);  // queueRoomMessage(LOBBY_ROOM) (or queueChatMessage()) on every server process
+	void broadcastRegistered(const sharedMessageRef &message, unsigned int exceptID, uint32_t coalesceKey = 0);  // queueRegisteredMessage() on every server process
+	void relayRaceMessage(connection &sender, std::string_view message, bool includeSender, bool batched = false);  // The message must be a null-terminated view. Batched messages wait for the race's next tick
+	void flushSendQueues();
+	#ifdef POLLER_HAS_URING
+		void submitSendQueues();  // flushSendQueues() with every socket's sends submitted together
+	#endif
+	bool checkBacklog(connection &recipient);  // Disconnects the client if they've fallen too far behind, returns false if they were
+	void flushRaceTicks();  // Schedules the send queues of everyone in the races whose tick has come
+	void checkIdleTimers();  // Disconnects anyone whose idle timer has run out without them sending anything
+	void handleBuffer(connection &sender, std::string_view message);  // Looks the message's handler up in the dispatch tables and calls it
+	// Message handlers, one for each opcode. The message is a null-terminated view
+	void handlePlayerData(connection &sender, std::string_view message);  // 'n'
+	void handleJoinLobby(connection &sender, std::string_view message);  // 'o'
+	void handleChat(connection &sender, std::string_view message);  // '^'
+	void handleRaceSlot(connection &sender, std::string_view message);  // 'j'
+	void handleReady(connection &sender, std::string_view message);  // 'r'
+	void handleRaceInput(connection &sender, std::string_view message);  // '#q', '#t' and '#k'
+	void handleLeaveRace(connection &sender, std::string_view message);  // '#s'
+	void handleFinishTime(connection &sender, std::string_view message);  // '%f'
+	void handleRankUpdate(connection &sender, std::string_view message);  // 'b'
+	void handleKeepAlive(connection &sender, std::string_view message);  // 'a'
+	void handleUnknown(connection &sender, std::string_view message);  // Anything else
+	void handleUnregistered(connection &sender, std::string_view message);  // Anything but 'n' before the player's data has been accepted
+	bool publishRecord(connection &client);  // Shares the client's record with the other server processes, returns false if it's too long to
+	void slotsChanged();
 	void startRace(unsigned int raceMap);
-	void leaveRace(unsigned int socketNum);
-	void disconnectSocket(unsigned int socketID);
+	void leaveRace(connection &racer);
+	void removeFromRace(unsigned int raceID, unsigned int playerID);  // Clears the player's slot and tells the other racers they left
+	void disconnectSocket(connection &client);  // Invalidates any references to connections
+	void startRaceWorkers();
+	void handleWorkerCommands();
+	void raceMembersChanged(unsigned int raceID);  // Tells the race's worker (if it has one) who is in the race now
+	void handOffRacers();
+	void postWorkerCommands();
+	void handleClusterMessages();
+	void migrateRacers();
+	void migrateRacer(const migrationRequest &request);  // Sends a racer to the process their race started on
+	void adoptMigrants();  // Takes in racers sent here by other processes
+	void forgetProcess(unsigned int process);  // First process only: frees the players of a process that has exited
+	void dropExitedRacers(unsigned int process);  // Takes the players of a process that has exited out of the races here
+	bool startMetrics();
+	void acceptMetricsClients();
+	void serveMetrics(SOCKET client);  // Answers whatever the client sent with the current metrics and closes the connection
 
 };
 
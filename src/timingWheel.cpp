@@ -0,0 +1,103 @@
+#include "timingWheel.hpp"
+
+timingWheel::timingWheel(){
+	start = std::chrono::steady_clock::now();
+	tickLength = std::chrono::seconds(1);
+	currentTick = 0;
+	timerCount = 0;
+}
+
+void timingWheel::init(unsigned int tickMilliseconds){
+	start = std::chrono::steady_clock::now();
+	tickLength = std::chrono::milliseconds(tickMilliseconds);
+	currentTick = 0;
+}
+
+void timingWheel::schedule(uint64_t key, uint64_t expiry){
+
+	const uint64_t maxTicks = (uint64_t)SLOTS << ((LEVELS - 1) * SLOT_BITS);
+	if(expiry <= currentTick){  // This tick's timers have already fired
+		expiry = currentTick + 1;
+	}else if(expiry - currentTick >= maxTicks){  // Further than the wheel reaches, so it fires early and the owner schedules it again
+		expiry = currentTick + maxTicks - 1;
+	}
+
+	wheelTimer newTimer;
+	newTimer.key = key;
+	newTimer.expiry = expiry;
+	place(newTimer);
+
+}
+
+void timingWheel::place(const wheelTimer &timer){
+
+	// Find the lowest level whose slots reach the expiry from the current tick. A timer moving down on the tick it
+	// expires on ends up in the bottom slot that's about to fire
+	uint64_t ticksLeft = timer.expiry > currentTick ? timer.expiry - currentTick : 0;
+	unsigned int level = 0;
+	while(level < LEVELS - 1 && ticksLeft >= ((uint64_t)SLOTS << (level * SLOT_BITS))){
+		level++;
+	}
+	slots[level][(timer.expiry >> (level * SLOT_BITS)) & (SLOTS - 1)].push_back(timer);
+	timerCount++;
+
+}
+
+void timingWheel::advance(std::vector<uint64_t> &expired){
+
+	expired.clear();
+	uint64_t nowTick = (std::chrono::steady_clock::now() - start) / tickLength;
+
+	if(timerCount == 0){  // Nothing to fire, so skip straight there
+		currentTick = nowTick;
+		return;
+	}
+
+	while(currentTick < nowTick){
+
+		currentTick++;
+
+		// When a level wraps around, move the next slot of the level above down into the levels below
+		for(unsigned int level = 1; level < LEVELS; level++){
+			if((currentTick & ((1ULL << (level * SLOT_BITS)) - 1)) != 0){
+				break;
+			}
+			std::vector<wheelTimer> &slot = slots[level][(currentTick >> (level * SLOT_BITS)) & (SLOTS - 1)];
+			cascading.swap(slot);
+			timerCount -= cascading.size();
+			for(unsigned int d = 0; d < cascading.size(); d++){
+				place(cascading[d]);
+			}
+			cascading.clear();
+		}
+
+		std::vector<wheelTimer> &slot = slots[0][currentTick & (SLOTS - 1)];
+		for(unsigned int d = 0; d < slot.size(); d++){
+			expired.push_back(slot[d].key);
+		}
+		timerCount -= slot.size();
+		slot.clear();
+
+	}
+
+}
+
+int timingWheel::timeout() const{
+
+	if(timerCount == 0){
+		return -1;
+	}
+
+	// The next tick with something to fire on the bottom level, or the next time it wraps around (which may move timers down)
+	uint64_t nextTick = currentTick + 1;
+	while((nextTick & (SLOTS - 1)) != 0 && slots[0][nextTick & (SLOTS - 1)].empty()){
+		nextTick++;
+	}
+
+	std::chrono::steady_clock::duration remaining = start + tickLength * nextTick - std::chrono::steady_clock::now();
+	if(remaining <= std::chrono::steady_clock::duration::zero()){
+		return 0;
+	}
+	return (int)std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+
+}
@@ -0,0 +1,52 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+// A timer in a timingWheel. The key is whatever the owner uses to find what the timer is for (e.g. a packed connectionHandle)
+struct wheelTimer{
+	uint64_t key;
+	uint64_t expiry;  // Tick the timer fires on
+};
+
+// Hierarchical timing wheel. Each level has 64 slots, and each slot on a level covers 64 times as many ticks as one on
+// the level below. Timers go in the lowest level that reaches their expiry and move down a level each time the level
+// below wraps around, so scheduling and firing a timer are both O(1).
+// Timers can't be cancelled. Owners check whether a timer still applies when it fires (and schedule it again if it's
+// been pushed back), which keeps things like "this connection has just done something" to storing the current tick
+struct timingWheel{
+
+	static const unsigned int LEVELS = 4;
+	static const unsigned int SLOT_BITS = 6;
+	static const unsigned int SLOTS = 1 << SLOT_BITS;
+
+	std::vector<wheelTimer> slots[LEVELS][SLOTS];
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::duration tickLength;
+	uint64_t currentTick;  // Ticks since start, as of the last call to advance()
+	unsigned int timerCount;
+	std::vector<wheelTimer> cascading;
+
+	timingWheel();
+
+	void init(unsigned int tickMilliseconds);
+	void schedule(uint64_t key, uint64_t expiry);  // Expiries that have already passed fire on the next tick
+	void place(const wheelTimer &timer);
+	void advance(std::vector<uint64_t> &expired);  // Catches up to the current time and stores the keys of the timers that have fired
+	int timeout() const;  // Milliseconds until a timer could next fire, for the poller (-1 if there are none)
+
+};
+
+inline int earlierTimeout(int a, int b){  // For poller timeouts, where -1 means none
+	if(a == -1){
+		return b;
+	}
+	if(b == -1){
+		return a;
+	}
+	return a < b ? a : b;
+}
+
+#endif
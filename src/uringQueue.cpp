@@ -0,0 +1,297 @@
+#include "uringQueue.hpp"
+
+#ifdef POLLER_HAS_URING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+
+#define RECEIVE_BUFFER_GROUP 0  // The queue only has the one group of receive buffers
+
+static int uringSetup(unsigned int entries, io_uring_params *params){
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFD, unsigned int toSubmit, unsigned int minComplete, unsigned int flags, void *argument, size_t argumentSize){
+	return (int)syscall(__NR_io_uring_enter, ringFD, toSubmit, minComplete, flags, argument, argumentSize);
+}
+
+static int uringRegister(int ringFD, unsigned int opcode, void *argument, unsigned int argumentCount){
+	return (int)syscall(__NR_io_uring_register, ringFD, opcode, argument, argumentCount);
+}
+
+uringQueue::uringQueue(){
+	ringFD = -1;
+	submissionRing = MAP_FAILED;
+	completionRing = MAP_FAILED;
+	submissions = (io_uring_sqe*)MAP_FAILED;
+	bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+	buffers = NULL;
+	bufferCount = 0;
+	bufferSize = 0;
+	bufferTail = 0;
+	unsubmitted = 0;
+}
+
+uringQueue::~uringQueue(){
+	shutdown();
+}
+
+bool uringQueue::init(unsigned int entries, unsigned int receiveBuffers, unsigned int receiveBufferSize){
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = entries * 8;  // Every watched socket can have completions waiting, not just the ones submitted
+	ringFD = uringSetup(entries, &params);
+	if(ringFD == -1){
+		printf("io_uring_setup() has failed (%i).\n", errno);
+		return false;
+	}
+	if(!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG)){  // Linux 5.11
+		printf("This kernel's io_uring is too old.\n");
+		shutdown();
+		return false;
+	}
+
+	// Map the rings, which may share one mapping
+	submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(singleMapping){
+		submissionRingSize = completionRingSize = submissionRingSize > completionRingSize ? submissionRingSize : completionRingSize;
+	}
+	submissionRing = mmap(NULL, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQ_RING);
+	if(submissionRing == MAP_FAILED){
+		printf("Mapping the io_uring submission queue has failed (%i).\n", errno);
+		shutdown();
+		return false;
+	}
+	if(singleMapping){
+		completionRing = submissionRing;
+	}else{
+		completionRing = mmap(NULL, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_CQ_RING);
+		if(completionRing == MAP_FAILED){
+			printf("Mapping the io_uring completion queue has failed (%i).\n", errno);
+			shutdown();
+			return false;
+		}
+	}
+	submissionsSize = params.sq_entries * sizeof(io_uring_sqe);
+	submissions = (io_uring_sqe*)mmap(NULL, submissionsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQES);
+	if(submissions == MAP_FAILED){
+		printf("Mapping the io_uring submission entries has failed (%i).\n", errno);
+		shutdown();
+		return false;
+	}
+
+	char *submissionBase = (char*)submissionRing;
+	submissionEntries = params.sq_entries;
+	submissionHead = (unsigned int*)(submissionBase + params.sq_off.head);
+	submissionTail = (unsigned int*)(submissionBase + params.sq_off.tail);
+	submissionMask = (unsigned int*)(submissionBase + params.sq_off.ring_mask);
+	submissionArray = (unsigned int*)(submissionBase + params.sq_off.array);
+	char *completionBase = (char*)completionRing;
+	completionHead = (unsigned int*)(completionBase + params.cq_off.head);
+	completionTail = (unsigned int*)(completionBase + params.cq_off.tail);
+	completionMask = (unsigned int*)(completionBase + params.cq_off.ring_mask);
+	completions = (io_uring_cqe*)(completionBase + params.cq_off.cqes);
+
+	// Register the receive buffers (Linux 5.19). The kernel takes one whenever data arrives for a multishot receive,
+	// and it's given back with recycle() once the data has been copied out
+	bufferCount = receiveBuffers;
+	bufferSize = receiveBufferSize;
+	bufferRing = (io_uring_buf_ring*)mmap(NULL, bufferCount * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(bufferRing == MAP_FAILED){
+		printf("Allocating the io_uring buffer ring has failed (%i).\n", errno);
+		shutdown();
+		return false;
+	}
+	io_uring_buf_reg registration;
+	memset(&registration, 0, sizeof(registration));
+	registration.ring_addr = (uint64_t)(uintptr_t)bufferRing;
+	registration.ring_entries = bufferCount;
+	registration.bgid = RECEIVE_BUFFER_GROUP;
+	if(uringRegister(ringFD, IORING_REGISTER_PBUF_RING, &registration, 1) == -1){
+		printf("Registering the io_uring buffer ring has failed (%i).\n", errno);
+		munmap(bufferRing, bufferCount * sizeof(io_uring_buf));
+		bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+		shutdown();
+		return false;
+	}
+	buffers = new char[(size_t)bufferCount * bufferSize];
+	for(unsigned int d = 0; d < bufferCount; d++){
+		recycle(d);
+	}
+
+	return true;
+
+}
+
+void uringQueue::shutdown(){
+	if(buffers != NULL){
+		delete[] buffers;
+		buffers = NULL;
+	}
+	if(bufferRing != MAP_FAILED){
+		munmap(bufferRing, bufferCount * sizeof(io_uring_buf));  // Closing the ring unregisters it
+		bufferRing = (io_uring_buf_ring*)MAP_FAILED;
+	}
+	if(submissions != MAP_FAILED){
+		munmap(submissions, submissionsSize);
+		submissions = (io_uring_sqe*)MAP_FAILED;
+	}
+	if(completionRing != MAP_FAILED && completionRing != submissionRing){
+		munmap(completionRing, completionRingSize);
+	}
+	completionRing = MAP_FAILED;
+	if(submissionRing != MAP_FAILED){
+		munmap(submissionRing, submissionRingSize);
+		submissionRing = MAP_FAILED;
+	}
+	if(ringFD != -1){
+		close(ringFD);
+		ringFD = -1;
+	}
+}
+
+io_uring_sqe *uringQueue::next(){
+
+	// Full, so hand what's there to the kernel. Until it has taken some, the oldest entry is still waiting to be read and
+	// can't be written over. EAGAIN and EBUSY clear up once the kernel catches up, anything else means the ring is broken,
+	// and as nothing queued on it would ever run, the server can't go on
+	unsigned int tail = *submissionTail;
+	while(tail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE) == submissionEntries){
+		int result = enter(0);
+		if(result == -EAGAIN || result == -EBUSY){
+			std::this_thread::yield();
+		}else if(result < 0){
+			printf("io_uring_enter() has failed with a full submission queue: %i\n", -result);
+			abort();
+		}
+	}
+
+	unsigned int index = tail & *submissionMask;
+	io_uring_sqe *entry = &submissions[index];
+	memset(entry, 0, sizeof(io_uring_sqe));
+	submissionArray[index] = index;
+	__atomic_store_n(submissionTail, tail + 1, __ATOMIC_RELEASE);
+	unsubmitted++;
+	return entry;
+
+}
+
+int uringQueue::enter(unsigned int waitFor, int timeoutMilliseconds){
+
+	unsigned int flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+	io_uring_getevents_arg argument;
+	__kernel_timespec timeout;
+	void *argumentPointer = NULL;
+	size_t argumentSize = 0;
+	if(waitFor > 0 && timeoutMilliseconds >= 0){
+		timeout.tv_sec = timeoutMilliseconds / 1000;
+		timeout.tv_nsec = (long long)(timeoutMilliseconds % 1000) * 1000000;
+		memset(&argument, 0, sizeof(argument));
+		argument.ts = (uint64_t)(uintptr_t)&timeout;
+		argumentPointer = &argument;
+		argumentSize = sizeof(argument);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	int submitted = uringEnter(ringFD, unsubmitted, waitFor, flags, argumentPointer, argumentSize);
+	if(submitted == -1){
+		return errno == ETIME || errno == EINTR ? 0 : -errno;  // Timed out or interrupted, nothing waiting was submitted either way
+	}
+	unsubmitted -= submitted;
+	return submitted;
+
+}
+
+bool uringQueue::completion(uringCompletion &completed){
+
+	unsigned int head = *completionHead;
+	if(head == __atomic_load_n(completionTail, __ATOMIC_ACQUIRE)){
+		return false;
+	}
+	const io_uring_cqe &entry = completions[head & *completionMask];
+	completed.userData = entry.user_data;
+	completed.result = entry.res;
+	completed.flags = entry.flags;
+	__atomic_store_n(completionHead, head + 1, __ATOMIC_RELEASE);
+	return true;
+
+}
+
+void uringQueue::recycle(unsigned int bufferID){
+	io_uring_buf &entry = ((io_uring_buf*)bufferRing)[bufferTail & (bufferCount - 1)];  // Not bufferRing->bufs, which C++ puts after an empty struct in some versions of the header
+	entry.addr = (uint64_t)(uintptr_t)buffer(bufferID);
+	entry.len = bufferSize;
+	entry.bid = bufferID;
+	bufferTail++;
+	__atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+}
+
+bool uringQueue::multishotReceiveWorks(){
+
+	// Receive a byte sent over a socket pair with a multishot receive. Older kernels fail it with -EINVAL, or complete it
+	// without IORING_CQE_F_MORE because they ignore the flag
+	int sockets[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sockets) == -1){
+		return false;
+	}
+
+	io_uring_sqe *entry = next();
+	entry->opcode = IORING_OP_RECV;
+	entry->fd = sockets[0];
+	entry->ioprio = IORING_RECV_MULTISHOT;
+	entry->flags = IOSQE_BUFFER_SELECT;
+	entry->buf_group = RECEIVE_BUFFER_GROUP;
+	entry->user_data = 1;
+	bool works = enter(0) >= 0 && write(sockets[1], "x", 1) == 1;
+	if(works){
+		uringCompletion completed;
+		works = false;
+		if(enter(1, 1000) >= 0 && completion(completed)){
+			works = completed.userData == 1 && completed.result == 1 && (completed.flags & IORING_CQE_F_BUFFER) && (completed.flags & IORING_CQE_F_MORE);
+			if(completed.flags & IORING_CQE_F_BUFFER){
+				recycle(completed.flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+		}
+	}
+
+	// Cancel the receive and throw away its completions
+	entry = next();
+	entry->opcode = IORING_OP_ASYNC_CANCEL;
+	entry->fd = sockets[0];
+	entry->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	entry->user_data = 2;
+	bool cancelled = false;
+	while(!cancelled && enter(1, 1000) >= 0){
+		uringCompletion completed;
+		bool any = false;
+		while(completion(completed)){
+			any = true;
+			if(completed.userData == 2){
+				cancelled = true;
+			}else if(completed.flags & IORING_CQE_F_BUFFER){
+				recycle(completed.flags >> IORING_CQE_BUFFER_SHIFT);
+			}
+		}
+		if(!any){
+			break;
+		}
+	}
+
+	close(sockets[0]);
+	close(sockets[1]);
+	return works && cancelled;
+
+}
+
+#endif
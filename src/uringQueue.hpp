@@ -0,0 +1,70 @@
+#ifndef URINGQUEUE_H
+#define URINGQUEUE_H
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <linux/io_uring.h>
+		#define POLLER_HAS_URING
+	#endif
+#endif
+
+#ifdef POLLER_HAS_URING
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A completion copied out of the ring, for when it has to wait to be handled
+struct uringCompletion{
+	uint64_t userData;
+	int32_t result;
+	uint32_t flags;
+};
+
+// An io_uring instance set up with the raw system calls (no liburing), along with a ring of receive buffers the kernel
+// picks from for multishot receives. Only ever used by one thread
+struct uringQueue{
+
+	int ringFD;
+	unsigned int submissionEntries;
+	unsigned int *submissionHead;
+	unsigned int *submissionTail;
+	unsigned int *submissionMask;
+	unsigned int *submissionArray;
+	io_uring_sqe *submissions;
+	unsigned int *completionHead;
+	unsigned int *completionTail;
+	unsigned int *completionMask;
+	io_uring_cqe *completions;
+	unsigned int unsubmitted;  // Entries filled in since the last io_uring_enter()
+
+	void *submissionRing;
+	size_t submissionRingSize;
+	void *completionRing;
+	size_t completionRingSize;
+	size_t submissionsSize;
+
+	io_uring_buf_ring *bufferRing;
+	char *buffers;
+	unsigned int bufferCount;
+	unsigned int bufferSize;
+	uint16_t bufferTail;
+
+	uringQueue();
+	~uringQueue();
+
+	bool init(unsigned int entries, unsigned int receiveBuffers, unsigned int receiveBufferSize);  // Both counts must be powers of 2. False if the kernel doesn't support everything needed
+	void shutdown();
+
+	io_uring_sqe *next();  // A cleared submission to fill in, submitting the ones already filled in if the queue is full
+	int enter(unsigned int waitFor, int timeoutMilliseconds = -1);  // Submits everything filled in and waits for completions, returns -errno on failure
+	bool completion(uringCompletion &completed);  // Takes the next completion, false if there isn't one
+	char *buffer(unsigned int bufferID){ return buffers + (size_t)bufferID * bufferSize; }
+	void recycle(unsigned int bufferID);  // Gives a receive buffer back to the kernel
+
+	bool multishotReceiveWorks();  // Multishot receives need Linux 6.0, which nothing else here tells apart
+
+};
+
+#endif
+
+#endif